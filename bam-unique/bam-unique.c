@@ -1,14 +1,117 @@
 
 #include "hash.h"
+#include "fphash.h"
+#include "common.h"
 #include "samtools/sam.h"
 #include "samtools/bam.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 
+/* number of threads used to decompress the input and compress the output */
+int n_threads = 1;
+
+/* write SAM text rather than BAM */
+int sam_output = 0;
+
+/* count 64-bit words of fingerprint per read rather than whole names, or 0 */
+int fp_width = 0;
+
+/* check reads sharing a fingerprint really share a name */
+int verify = 0;
+
+/* trust this aux tag to say whether a read is unique, in one pass, or NULL */
+const char* unique_tag = NULL;
+
+/* hash on disk, within this many bytes of memory, if not 0 */
+size_t mem_budget = 0;
+
+/* where to put the partitions of external hashing */
+const char* tmp_dir = NULL;
+
 
 void usage()
 {
-    fprintf(stderr, "Usage: bam-unique in.bam\n");
+    fprintf(stderr, "Usage: bam-unique [-S] [-cCV] [-t TAG] [-m SIZE [-T DIR]] [-@ threads] in.bam > out.bam\n\n"
+                    "Options:\n"
+                    "-S         write SAM rather than BAM\n"
+                    "-c         compact: count 64-bit fingerprints of read names\n"
+                    "           rather than the names, in 9 bytes a table slot\n"
+                    "-C         as -c, with 128-bit fingerprints (17 bytes a slot)\n"
+                    "-V         as -c, but check reads sharing a fingerprint against\n"
+                    "           each other, so that collisions can not drop reads\n"
+                    "           (8 more bytes a slot)\n"
+                    "-t TAG     filter in one pass, trusting the aligner's TAG to say\n"
+                    "           which reads aligned once: NH, X0 or IH of 1, or XT of U.\n"
+                    "           Reads without it are counted by name, if the file\n"
+                    "           is sorted by name\n"
+                    "-m, --mem SIZE\n"
+                    "           hash on disk, keeping to about SIZE bytes of memory\n"
+                    "           (K, M and G suffixes allowed), with the fingerprints\n"
+                    "           of -c, or -C\n"
+                    "-T DIR     put the temporary files of -m in DIR (default: $TMPDIR\n"
+                    "           or /tmp)\n"
+                    "-@ N       use N threads to decompress and compress\n");
+}
+
+
+
+/* The read's name with "/1" or "/2" appended, as the exact tables key on,
+ * in buf, returning its length. */
+static size_t mate_name(const bam1_t* b, char** buf, size_t* size)
+{
+    if (*size < b->core.l_qname + 3) {
+        *size = b->core.l_qname + 3;
+        *buf = realloc(*buf, *size);
+    }
+
+    memcpy(*buf, bam1_qname(b), b->core.l_qname);
+    (*buf)[b->core.l_qname]     = '/';
+    (*buf)[b->core.l_qname + 1] = b->core.flag & BAM_FREAD2 ? '2' : '1';
+    (*buf)[b->core.l_qname + 2] = '\0';
+
+    return b->core.l_qname + 2;
+}
+
+
+static void read_fingerprint(const bam1_t* b, uint64_t* fp)
+{
+    fingerprint(bam1_qname(b), b->core.l_qname - 1,
+                b->core.flag & BAM_FREAD2 ? 2 : 1, fp, fp_width);
+}
+
+
+/* The number of reads the index records, if there is one, to size the
+ * table by, or 0. */
+static size_t expected_reads(const char* fn)
+{
+    size_t n = 0;
+    char* fnidx = malloc_or_die(strlen(fn) + 5);
+    sprintf(fnidx, "%s.bai", fn);
+
+    if (access(fnidx, R_OK) == 0) {
+        bam_index_t* idx = bam_index_load(fn);
+        samfile_t* f = samopen(fn, "rb", NULL);
+        uint64_t beg, end, n_mapped, n_unmapped;
+        int32_t tid;
+
+        for (tid = 0; idx && f && tid < f->header->n_targets; ++tid) {
+            if (bam_index_stats(idx, tid, &beg, &end, &n_mapped, &n_unmapped) == 0) {
+                n += n_mapped + n_unmapped;
+            }
+        }
+
+        if (f) samclose(f);
+        if (idx) bam_index_destroy(idx);
+    }
+
+    free(fnidx);
+    return n;
 }
 
 
@@ -24,53 +127,139 @@ hash_table* hash_ids(const char* fn)
         fprintf(stderr, "can't open bam file %s\n", fn);
         exit(1);
     }
+    samthreads(f, n_threads, 0);
 
     bam1_t* b = bam_init1();
 
     uint32_t n = 0;
 
     char* qname = NULL;
-    size_t qname_size = 0;
+    size_t qname_size = 0, len;
 
     while (samread(f, b) >= 0) {
         if (++n % 1000000 == 0) {
             fprintf(stderr, "\t%d reads\n", n);
         }
 
-        if (qname_size < b->core.l_qname + 3) {
-            qname_size = b->core.l_qname + 3;
-            qname = realloc(qname, qname_size);
+        len = mate_name(b, &qname, &qname_size);
+        inc_hash_table(T, qname, len);
+    }
+
+    free(qname);
+
+    bam_destroy1(b);
+    samclose(f);
+
+    fprintf(stderr, "done.\n");
+    return T;
+}
+
+
+
+/* As hash_ids, but counting fingerprints. With verify, the table keeps the
+ * offset of the first read with each fingerprint, and a later read with the
+ * same fingerprint is compared against it. Those found to differ are
+ * counted by name in *collisions instead, and their fingerprint flagged. */
+fp_table* hash_fingerprints(const char* fn, hash_table** collisions)
+{
+    fprintf(stderr, "hashing ... \n");
+
+    fp_table* T = create_fp_table(fp_width, verify, expected_reads(fn));
+    hash_table* X = verify ? create_hash_table() : NULL;
+
+    samfile_t* f = samopen(fn, "rb", NULL);
+    if (f == NULL) {
+        fprintf(stderr, "can't open bam file %s\n", fn);
+        exit(1);
+    }
+    samthreads(f, n_threads, 0);
+
+    /* a second handle, to read back the first read with a fingerprint */
+    bamFile g = NULL;
+    if (verify && (g = bam_open(fn, "r")) == NULL) {
+        fprintf(stderr, "can't open bam file %s\n", fn);
+        exit(1);
+    }
+
+    bam1_t* b = bam_init1();
+    bam1_t* c = bam_init1();
+
+    uint32_t n = 0;
+    uint32_t n_collisions = 0;
+
+    char* qname = NULL;
+    size_t qname_size = 0, len;
+
+    uint64_t fp[2];
+    int64_t offset;
+    size_t i;
+
+    while (1) {
+        offset = bam_tell(f->x.bam);
+        if (samread(f, b) < 0) break;
+
+        if (++n % 1000000 == 0) {
+            fprintf(stderr, "\t%d reads\n", n);
+        }
+
+        read_fingerprint(b, fp);
+
+        if (!verify) {
+            inc_fp_table(T, fp);
+            continue;
         }
 
-        memcpy(qname, bam1_qname(b), b->core.l_qname);
+        i = find_fp_table(T, fp);
+        if (i == T->n) {
+            i = inc_fp_table(T, fp);
+            T->V[i] = offset;
+            continue;
+        }
 
-        if (b->core.flag & BAM_FREAD2) {
-            qname[b->core.l_qname]     = '/';
-            qname[b->core.l_qname + 1] = '2';
-            qname[b->core.l_qname + 2] = '\0';
+        len = mate_name(b, &qname, &qname_size);
+        if ((T->C[i] & FP_FLAG) && get_hash_table(X, qname, len) > 0) {
+            inc_hash_table(X, qname, len);
+            continue;
         }
-        else {
-            qname[b->core.l_qname]     = '/';
-            qname[b->core.l_qname + 1] = '1';
-            qname[b->core.l_qname + 2] = '\0';
+
+        if (bam_seek(g, T->V[i], SEEK_SET) < 0 || bam_read1(g, c) < 0) {
+            fprintf(stderr, "can't reread bam file %s\n", fn);
+            exit(1);
         }
 
+        if (strcmp(bam1_qname(b), bam1_qname(c)) == 0 &&
+            (b->core.flag & BAM_FREAD2) == (c->core.flag & BAM_FREAD2)) {
+            inc_fp_table(T, fp);
+        }
+        else {
+            if (get_hash_table(X, qname, len) == 0) ++n_collisions;
+            inc_hash_table(X, qname, len);
+            T->C[i] |= FP_FLAG;
+        }
+    }
 
-        inc_hash_table(T, qname, b->core.l_qname + 2);
+    if (verify) {
+        fprintf(stderr, "\t%u fingerprint collisions\n", n_collisions);
     }
 
     free(qname);
 
     bam_destroy1(b);
+    bam_destroy1(c);
+    if (g) bam_close(g);
     samclose(f);
 
+    *collisions = X;
+
     fprintf(stderr, "done.\n");
     return T;
 }
 
 
 
-void filter_by_id(const char* fn, hash_table* T)
+/* Write out the reads seen once, as counted by name in T or, if F is given,
+ * by fingerprint in F, with the names of any collisions in T. */
+void filter_by_id(const char* fn, hash_table* T, fp_table* F)
 {
     fprintf(stderr, "filtering ... \n");
 
@@ -79,72 +268,637 @@ void filter_by_id(const char* fn, hash_table* T)
         fprintf(stderr, "can't open bam file %s\n", fn);
         exit(1);
     }
+    samthreads(fin, n_threads, 0);
 
-    samfile_t* fout = samopen("-", "w", (void*)fin->header);
+    samfile_t* fout = samopen("-", sam_output ? "wh" : "wb", (void*)fin->header);
     if (fout == NULL) {
         fprintf(stderr, "can't open stdout, for some reason.\n");
         exit(1);
     }
-
-    fputs(fin->header->text, stdout);
+    samthreads(fout, n_threads, 0);
 
     bam1_t* b = bam_init1();
     uint32_t n = 0;
 
     char* qname = NULL;
-    size_t qname_size = 0;
+    size_t qname_size = 0, len, i;
+
+    uint64_t fp[2];
+    uint32_t count, x;
 
     while (samread(fin, b) >= 0) {
         if (++n % 1000000 == 0) {
             fprintf(stderr, "\t%d reads\n", n);
         }
 
+        if (F == NULL) {
+            len = mate_name(b, &qname, &qname_size);
+            count = get_hash_table(T, qname, len);
+        }
+        else {
+            read_fingerprint(b, fp);
+            i = find_fp_table(F, fp);
+            count = F->C[i] & FP_COUNT_MASK;
+
+            /* a collision: the name is counted by itself, unless it is
+             * the first read with this fingerprint */
+            if (F->C[i] & FP_FLAG) {
+                len = mate_name(b, &qname, &qname_size);
+                if ((x = get_hash_table(T, qname, len)) > 0) count = x;
+            }
+        }
 
-        if (qname_size < b->core.l_qname + 3) {
-            qname_size = b->core.l_qname + 3;
-            qname = realloc(qname, qname_size);
+        if (count == 1) {
+            samwrite(fout, b);
         }
+    }
+
+    free(qname);
+
+    bam_destroy1(b);
+    samclose(fout);
+    samclose(fin);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+
+/* External hashing, for when the reads' fingerprints do not fit in memory.
+ * The first pass scatters (fingerprint, read number) records over k files
+ * by fingerprint. Each of those is then small enough to sort in memory,
+ * which leaves the numbers of the unique reads, in order, in a file per
+ * partition. The second pass merges those as it streams the reads. */
+
+typedef struct
+{
+    char*    dir;  /* temporary directory holding the partitions */
+    int      k;    /* number of partitions */
+    uint64_t n;    /* reads */
+} partitions;
+
+
+static char* part_path(const partitions* P, const char* what, int i)
+{
+    static char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.%d", P->dir, what, i);
+    return path;
+}
 
-        memcpy(qname, bam1_qname(b), b->core.l_qname);
 
-        if (b->core.flag & BAM_FREAD2) {
-            qname[b->core.l_qname]     = '/';
-            qname[b->core.l_qname + 1] = '2';
-            qname[b->core.l_qname + 2] = '\0';
+/* Enough partitions that each fits in the memory budget, judging the number
+ * of reads by the index if there is one, else allowing one read for every
+ * 8 compressed bytes, which errs on the side of too many. */
+static int choose_partitions(const char* fn, size_t rec_size)
+{
+    uint64_t n = expected_reads(fn);
+    struct stat st;
+    struct rlimit rl;
+
+    if (n == 0 && stat(fn, &st) == 0) n = st.st_size / 8;
+
+    uint64_t k = (n * rec_size) / (mem_budget / 2) + 1;
+    if (k < 16) k = 16;
+
+    /* each partition holds a file open in both passes */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (rl.rlim_cur < rl.rlim_max && rl.rlim_cur < k + 64) {
+            rl.rlim_cur = k + 64 < rl.rlim_max ? k + 64 : rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
         }
-        else {
-            qname[b->core.l_qname]     = '/';
-            qname[b->core.l_qname + 1] = '1';
-            qname[b->core.l_qname + 2] = '\0';
+        if (k + 64 > rl.rlim_cur) k = rl.rlim_cur > 80 ? rl.rlim_cur - 64 : 16;
+    }
+
+    return (int) k;
+}
+
+
+static FILE** open_partitions(const partitions* P, const char* what, const char* mode)
+{
+    FILE** F = malloc_or_die(P->k * sizeof(FILE*));
+
+    /* buffers take up to a quarter of the budget */
+    size_t buf_size = mem_budget / 4 / P->k;
+    if (buf_size > 1 << 20) buf_size = 1 << 20;
+    if (buf_size < 4096) buf_size = 4096;
+
+    int i;
+    for (i = 0; i < P->k; ++i) {
+        F[i] = fopen_or_die(part_path(P, what, i), mode);
+        setvbuf(F[i], NULL, _IOFBF, buf_size);
+    }
+
+    return F;
+}
+
+
+static void close_partitions(FILE** F, int k)
+{
+    int i;
+    for (i = 0; i < k; ++i) {
+        if (fclose(F[i]) != 0) {
+            fprintf(stderr, "can't write temporary file.\n");
+            exit(1);
         }
+    }
+    free(F);
+}
 
-        if (get_hash_table(T, qname, b->core.l_qname + 2) == 1) {
-            samwrite(fout, b);
+
+void scatter_fingerprints(const char* fn, partitions* P)
+{
+    fprintf(stderr, "partitioning ... \n");
+
+    samfile_t* f = samopen(fn, "rb", NULL);
+    if (f == NULL) {
+        fprintf(stderr, "can't open bam file %s\n", fn);
+        exit(1);
+    }
+    samthreads(f, n_threads, 0);
+
+    FILE** F = open_partitions(P, "part", "wb");
+
+    bam1_t* b = bam_init1();
+    uint64_t rec[3];
+    size_t rec_len = fp_width + 1;
+    int i;
+
+    P->n = 0;
+    while (samread(f, b) >= 0) {
+        if (++P->n % 1000000 == 0) {
+            fprintf(stderr, "\t%lu reads\n", (unsigned long) P->n);
+        }
+
+        read_fingerprint(b, rec);
+        rec[fp_width] = P->n - 1;
+
+        /* the top bits pick the partition, the bottom ones the order within */
+        i = ((rec[0] >> 32) * P->k) >> 32;
+        if (fwrite(rec, sizeof(uint64_t), rec_len, F[i]) != rec_len) {
+            fprintf(stderr, "can't write temporary file.\n");
+            exit(1);
         }
     }
 
-    free(qname);
+    close_partitions(F, P->k);
+    bam_destroy1(b);
+    samclose(f);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+static int cmp_numbers(const void* a_, const void* b_)
+{
+    uint64_t a = *(const uint64_t*) a_;
+    uint64_t b = *(const uint64_t*) b_;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+
+static int cmp_records(const void* a_, const void* b_)
+{
+    const uint64_t* a = a_;
+    const uint64_t* b = b_;
+    int i;
+
+    for (i = 0; i <= fp_width; ++i) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+
+/* Replace each partition of records with the sorted numbers of the reads
+ * whose fingerprint is in it once. */
+void count_partitions(partitions* P)
+{
+    fprintf(stderr, "counting ... \n");
+
+    size_t rec_len = fp_width + 1;
+    size_t rec_size = rec_len * sizeof(uint64_t);
+    uint64_t* R = NULL;
+    size_t size = 0, n, i, j, m;
+    struct stat st;
+    FILE* f;
+    int p;
+
+    for (p = 0; p < P->k; ++p) {
+        const char* path = part_path(P, "part", p);
+        if (stat(path, &st) != 0) {
+            fprintf(stderr, "can't read temporary file %s.\n", path);
+            exit(1);
+        }
+
+        n = st.st_size / rec_size;
+        if (n * rec_size > mem_budget) {
+            fprintf(stderr, "warning: partition %d holds %zu MB, more than the memory limit.\n",
+                    p, n * rec_size >> 20);
+        }
+
+        if (n > size) {
+            size = n;
+            free(R);
+            R = malloc_or_die(size * rec_size);
+        }
+
+        f = fopen_or_die(path, "rb");
+        if (fread(R, rec_size, n, f) != n) {
+            fprintf(stderr, "can't read temporary file %s.\n", path);
+            exit(1);
+        }
+        fclose(f);
+        unlink(path);
+
+        /* sorting by fingerprint brings reads of the same name together;
+         * the numbers of those left alone are gathered at the front */
+        qsort(R, n, rec_size, cmp_records);
+
+        for (i = 0, m = 0; i < n; i = j) {
+            for (j = i + 1; j < n && memcmp(R + i * rec_len, R + j * rec_len,
+                                            fp_width * sizeof(uint64_t)) == 0; ++j);
+            if (j == i + 1) R[m++] = R[i * rec_len + fp_width];
+        }
+
+        qsort(R, m, sizeof(uint64_t), cmp_numbers);
+
+        f = fopen_or_die(part_path(P, "kept", p), "wb");
+        if (fwrite(R, sizeof(uint64_t), m, f) != m || fclose(f) != 0) {
+            fprintf(stderr, "can't write temporary file.\n");
+            exit(1);
+        }
+    }
+
+    free(R);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+/* the next kept read number from each partition, as a heap */
+typedef struct
+{
+    uint64_t next;
+    FILE*    f;
+} kept_stream;
+
+
+static void sift_down(kept_stream* H, int n, int i)
+{
+    kept_stream t;
+    int j;
+
+    while ((j = 2 * i + 1) < n) {
+        if (j + 1 < n && H[j + 1].next < H[j].next) ++j;
+        if (H[i].next <= H[j].next) break;
+        t = H[i]; H[i] = H[j]; H[j] = t;
+        i = j;
+    }
+}
+
+
+void filter_by_partitions(const char* fn, partitions* P)
+{
+    fprintf(stderr, "filtering ... \n");
+
+    samfile_t* fin = samopen(fn, "rb", NULL);
+    if (fin == NULL) {
+        fprintf(stderr, "can't open bam file %s\n", fn);
+        exit(1);
+    }
+    samthreads(fin, n_threads, 0);
+
+    samfile_t* fout = samopen("-", sam_output ? "wh" : "wb", (void*)fin->header);
+    if (fout == NULL) {
+        fprintf(stderr, "can't open stdout, for some reason.\n");
+        exit(1);
+    }
+    samthreads(fout, n_threads, 0);
+
+    FILE** F = open_partitions(P, "kept", "rb");
+    kept_stream* H = malloc_or_die(P->k * sizeof(kept_stream));
+    int i, n_heap = 0;
+
+    for (i = 0; i < P->k; ++i) {
+        if (fread(&H[n_heap].next, sizeof(uint64_t), 1, F[i]) == 1) {
+            H[n_heap++].f = F[i];
+        }
+    }
+    for (i = n_heap / 2 - 1; i >= 0; --i) sift_down(H, n_heap, i);
+
+    bam1_t* b = bam_init1();
+    uint64_t n = 0;
+
+    while (n_heap > 0 && samread(fin, b) >= 0) {
+        if (++n % 1000000 == 0) {
+            fprintf(stderr, "\t%lu reads\n", (unsigned long) n);
+        }
+
+        if (H[0].next != n - 1) continue;
+
+        samwrite(fout, b);
+
+        if (fread(&H[0].next, sizeof(uint64_t), 1, H[0].f) != 1) {
+            H[0] = H[--n_heap];
+        }
+        sift_down(H, n_heap, 0);
+    }
+
+    free(H);
+    close_partitions(F, P->k);
+    for (i = 0; i < P->k; ++i) unlink(part_path(P, "kept", i));
+
+    bam_destroy1(b);
+    samclose(fout);
+    samclose(fin);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+
+/* Whether the header says the reads are grouped by name. */
+static int sorted_by_name(const bam_header_t* h)
+{
+    if (h->l_text < 4 || strncmp(h->text, "@HD", 3) != 0) return 0;
+
+    const char* eol = memchr(h->text, '\n', h->l_text);
+    const char* so = strstr(h->text, "\tSO:queryname");
+    return so != NULL && (eol == NULL || so < eol);
+}
+
+
+/* What the aligner's tag says of a read: 1 if it aligned once, 0 if more
+ * often, -1 if the read has no such tag. Integer tags (NH, X0, IH) count
+ * hits, character tags (BWA's XT) mark unique hits with 'U'. */
+static int tag_unique(const bam1_t* b)
+{
+    uint8_t* s = bam_aux_get(b, unique_tag);
+    if (s == NULL) return -1;
+
+    if (*s == 'A') return bam_aux2A(s) == 'U';
+    return bam_aux2i(s) == 1;
+}
+
+
+/* A group of consecutive reads with the same name, holding only those that
+ * might still be written. */
+typedef struct
+{
+    char*    name;
+    size_t   name_size;
+
+    bam1_t** reads;
+    int*     keep;
+    size_t   n, size;
+
+    /* per mate, the reads seen and where the first is held if it went
+     * untagged, or -1 */
+    uint32_t seen[2];
+    size_t   first[2];
+} name_group;
+
+
+static void flush_group(name_group* G, samfile_t* fout)
+{
+    size_t i;
+    for (i = 0; i < G->n; ++i) {
+        if (G->keep[i]) samwrite(fout, G->reads[i]);
+    }
+
+    G->n = 0;
+    G->seen[0] = G->seen[1] = 0;
+    G->first[0] = G->first[1] = (size_t) -1;
+}
+
+
+static void hold_read(name_group* G, const bam1_t* b)
+{
+    if (G->n == G->size) {
+        G->size = G->size ? 2 * G->size : 4;
+        G->reads = realloc_or_die(G->reads, G->size * sizeof(bam1_t*));
+        G->keep  = realloc_or_die(G->keep, G->size * sizeof(int));
+        memset(G->reads + G->n, 0, (G->size - G->n) * sizeof(bam1_t*));
+    }
+
+    if (G->reads[G->n] == NULL) G->reads[G->n] = bam_init1();
+    bam_copy1(G->reads[G->n], b);
+    G->keep[G->n] = 1;
+    G->n++;
+}
+
+
+/* Write the unique reads in one pass, going by the aligner's tag. Reads
+ * without the tag are counted among the reads of the same name around
+ * them, which is only right if the file is sorted by name, so those are
+ * an error otherwise. If the very first read has no tag and the file is not
+ * sorted by name, nothing is written and -1 returned, to fall back on
+ * hashing. */
+int filter_by_tag(const char* fn)
+{
+    samfile_t* fin = samopen(fn, "rb", NULL);
+    if (fin == NULL) {
+        fprintf(stderr, "can't open bam file %s\n", fn);
+        exit(1);
+    }
+    samthreads(fin, n_threads, 0);
+
+    int by_name = sorted_by_name(fin->header);
+
+    bam1_t* b = bam_init1();
+    int r = samread(fin, b);
+
+    if (r >= 0 && !by_name && tag_unique(b) < 0) {
+        fprintf(stderr, "reads have no %.2s tag and are not sorted by name, "
+                        "falling back on hashing.\n", unique_tag);
+        bam_destroy1(b);
+        samclose(fin);
+        return -1;
+    }
+
+    fprintf(stderr, "filtering by %.2s tag ... \n", unique_tag);
+
+    samfile_t* fout = samopen("-", sam_output ? "wh" : "wb", (void*)fin->header);
+    if (fout == NULL) {
+        fprintf(stderr, "can't open stdout, for some reason.\n");
+        exit(1);
+    }
+    samthreads(fout, n_threads, 0);
+
+    name_group G;
+    memset(&G, 0, sizeof(name_group));
+    G.first[0] = G.first[1] = (size_t) -1;
+
+    uint32_t n = 0, n_untagged = 0;
+    int unique, mate;
+
+    for (; r >= 0; r = samread(fin, b)) {
+        if (++n % 1000000 == 0) {
+            fprintf(stderr, "\t%d reads\n", n);
+        }
+
+        if (G.name == NULL || strcmp(G.name, bam1_qname(b)) != 0) {
+            flush_group(&G, fout);
+
+            if (G.name_size < b->core.l_qname) {
+                G.name_size = b->core.l_qname;
+                G.name = realloc_or_die(G.name, G.name_size);
+            }
+            memcpy(G.name, bam1_qname(b), b->core.l_qname);
+        }
+
+        unique = tag_unique(b);
+
+        /* a second read of a mate rules out the first, if it went untagged */
+        mate = b->core.flag & BAM_FREAD2 ? 1 : 0;
+        if (++G.seen[mate] == 2 && G.first[mate] < G.n) {
+            G.keep[G.first[mate]] = 0;
+        }
+
+        if (unique < 0) {
+            if (!by_name) {
+                fprintf(stderr, "read %s has no %.2s tag, and the file is not sorted by name.\n",
+                        bam1_qname(b), unique_tag);
+                exit(1);
+            }
+
+            ++n_untagged;
+            if (G.seen[mate] == 1) {
+                G.first[mate] = G.n;
+                hold_read(&G, b);
+            }
+        }
+        else if (unique) hold_read(&G, b);
+    }
+
+    flush_group(&G, fout);
+
+    if (n_untagged > 0) {
+        fprintf(stderr, "\t%u reads without a tag counted by name\n", n_untagged);
+    }
+
+    size_t i;
+    for (i = 0; i < G.size; ++i) {
+        if (G.reads[i]) bam_destroy1(G.reads[i]);
+    }
+    free(G.name);
+    free(G.reads);
+    free(G.keep);
 
     bam_destroy1(b);
     samclose(fout);
     samclose(fin);
 
     fprintf(stderr, "done.\n");
+    return 0;
 }
 
 
 
 int main(int argc, char* argv[])
 {
-    if (argc < 2) {
+    static struct option long_options[] = {
+        {"mem", required_argument, 0, 'm'},
+        {0, 0, 0, 0} };
+
+    char* end;
+    int c;
+    while ((c = getopt_long(argc, argv, "ScCVt:m:T:@:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'S':
+                sam_output = 1;
+                break;
+            case 'c':
+                fp_width = 1;
+                break;
+            case 'C':
+                fp_width = 2;
+                break;
+            case 'V':
+                verify = 1;
+                break;
+            case 't':
+                if (strlen(optarg) != 2) {
+                    fprintf(stderr, "tags are two characters, not '%s'.\n", optarg);
+                    exit(1);
+                }
+                unique_tag = optarg;
+                break;
+            case 'm':
+                mem_budget = strtoull(optarg, &end, 10);
+                switch (*end) {
+                    case 'k': case 'K': mem_budget <<= 10; break;
+                    case 'm': case 'M': mem_budget <<= 20; break;
+                    case 'g': case 'G': mem_budget <<= 30; break;
+                }
+                if (mem_budget < 1 << 20) {
+                    fprintf(stderr, "-m needs at least a megabyte, not '%s'.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'T':
+                tmp_dir = optarg;
+                break;
+            case '@':
+                n_threads = atoi(optarg);
+                break;
+            default:
+                usage();
+                exit(1);
+        }
+    }
+
+    if (optind >= argc) {
         usage();
         exit(1);
     }
 
-    hash_table* T = hash_ids(argv[1]);
-    filter_by_id(argv[1], T);
+    if (verify && fp_width == 0) fp_width = 1;
+
+    if (unique_tag && filter_by_tag(argv[optind]) == 0) {
+        return 0;
+    }
+
+    if (mem_budget > 0) {
+        if (verify) {
+            fprintf(stderr, "-V can not be used with -m.\n");
+            exit(1);
+        }
+        if (fp_width == 0) fp_width = 1;
 
-    destroy_hash_table(T);
+        if (tmp_dir == NULL) tmp_dir = getenv("TMPDIR");
+        if (tmp_dir == NULL) tmp_dir = "/tmp";
+
+        partitions P;
+        P.dir = malloc_or_die(strlen(tmp_dir) + 20);
+        sprintf(P.dir, "%s/bam-unique.XXXXXX", tmp_dir);
+        if (mkdtemp(P.dir) == NULL) {
+            fprintf(stderr, "can't make a temporary directory in %s.\n", tmp_dir);
+            exit(1);
+        }
+        P.k = choose_partitions(argv[optind], (fp_width + 1) * sizeof(uint64_t));
+
+        scatter_fingerprints(argv[optind], &P);
+        count_partitions(&P);
+        filter_by_partitions(argv[optind], &P);
+
+        rmdir(P.dir);
+        free(P.dir);
+    }
+    else if (fp_width > 0) {
+        hash_table* X;
+        fp_table* F = hash_fingerprints(argv[optind], &X);
+        filter_by_id(argv[optind], X, F);
+
+        destroy_fp_table(F);
+        destroy_hash_table(X);
+    }
+    else {
+        hash_table* T = hash_ids(argv[optind]);
+        filter_by_id(argv[optind], T, NULL);
+
+        destroy_hash_table(T);
+    }
 
     return 0;
 }
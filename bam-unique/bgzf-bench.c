@@ -0,0 +1,154 @@
+#include "samtools/bgzf_inflate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+
+/* Time every usable BGZF inflate backend on the blocks of one file. */
+
+
+void usage()
+{
+    fprintf(stderr, "Usage: bgzf-bench [-n rounds] in.bam\n\n"
+                    "Options:\n"
+                    "-n N       decompress the file N times per backend (default 5)\n");
+}
+
+
+double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+/* read the whole file into memory */
+uint8_t* read_file(const char* fn, size_t* size)
+{
+    FILE* f = fopen(fn, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "can't open %s\n", fn);
+        exit(1);
+    }
+
+    size_t n = 0, m = 1 << 20;
+    uint8_t* data = malloc(m);
+    size_t k;
+    while ((k = fread(data + n, 1, m - n, f)) > 0) {
+        n += k;
+        if (n == m) data = realloc(data, m *= 2);
+    }
+    fclose(f);
+
+    *size = n;
+    return data;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int rounds = 5;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (optind >= argc || rounds < 1) {
+        usage();
+        return 1;
+    }
+
+    size_t size;
+    uint8_t* data = read_file(argv[optind], &size);
+
+    /* find block boundaries from the BSIZE field of each header */
+    size_t n_blocks = 0, m_blocks = 1024;
+    size_t* offsets = malloc(m_blocks * sizeof(size_t));
+    size_t off = 0;
+    uint64_t uncompressed_size = 0;
+    while (off + 18 <= size) {
+        if (data[off] != 31 || data[off + 1] != 139 ||
+            data[off + 12] != 'B' || data[off + 13] != 'C') {
+            fprintf(stderr, "%s: not a BGZF file, or corrupt at offset %zu\n",
+                    argv[optind], off);
+            return 1;
+        }
+        size_t block_length = (data[off + 16] | data[off + 17] << 8) + 1;
+        if (off + block_length > size) break;
+
+        if (n_blocks == m_blocks) {
+            offsets = realloc(offsets, (m_blocks *= 2) * sizeof(size_t));
+        }
+        offsets[n_blocks++] = off;
+
+        const uint8_t* isize = data + off + block_length - 4;
+        uncompressed_size += isize[0] | isize[1] << 8 | isize[2] << 16 | (uint32_t) isize[3] << 24;
+        off += block_length;
+    }
+    if (n_blocks == 0) {
+        fprintf(stderr, "%s: no complete BGZF blocks\n", argv[optind]);
+        return 1;
+    }
+    offsets = realloc(offsets, (n_blocks + 1) * sizeof(size_t));
+    offsets[n_blocks] = off;
+
+    printf("%s: %zu blocks, %.1f MB compressed, %.1f MB uncompressed\n",
+           argv[optind], n_blocks, off / 1e6, uncompressed_size / 1e6);
+    printf("default backend: %s\n\n", bgzf_get_inflater()->name);
+    printf("%-14s %12s %12s\n", "backend", "inflate MB/s", "crc32 MB/s");
+
+    uint8_t* out = malloc(0x10000);
+    const bgzf_inflater_t* b;
+    for (b = bgzf_inflaters(); b->name; ++b) {
+        if (!b->usable()) {
+            printf("%-14s %12s %12s\n", b->name, "-", "-");
+            continue;
+        }
+        bgzf_set_inflater(b->name);
+
+        /* inflating includes checking the CRC, as bgzf_read does */
+        double t0 = now();
+        int r;
+        size_t i;
+        const char* error = NULL;
+        for (r = 0; r < rounds; ++r) {
+            for (i = 0; i < n_blocks; ++i) {
+                if (bgzf_inflate_block(data + offsets[i], offsets[i + 1] - offsets[i],
+                                       out, 0x10000, &error) < 0) {
+                    fprintf(stderr, "%s: block %zu: %s\n", b->name, i, error);
+                    return 1;
+                }
+            }
+        }
+        double t_inflate = now() - t0;
+
+        /* the CRC kernel alone, over the same bytes */
+        volatile uint32_t crc = 0;
+        t0 = now();
+        for (r = 0; r < rounds; ++r) {
+            crc = b->crc32(crc, data, size);
+        }
+        double t_crc = now() - t0;
+
+        printf("%-14s %12.1f %12.1f\n", b->name,
+               rounds * uncompressed_size / 1e6 / t_inflate,
+               rounds * size / 1e6 / t_crc);
+    }
+
+    free(out);
+    free(offsets);
+    free(data);
+    return 0;
+}
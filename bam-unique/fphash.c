@@ -0,0 +1,245 @@
+/*
+ * This file is part of fastq-tools.
+ *
+ * Copyright (c) 2011 by Daniel C. Jones <dcjones@cs.washington.edu>
+ *
+ */
+
+
+#include "fphash.h"
+#include "common.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+static const size_t INITIAL_TABLE_SIZE = 1024;
+static const double MAX_LOAD = 0.8;
+
+
+/*
+ * Austin Appleby's MurmurHash3, x64 128-bit variant (public domain)
+ * http://code.google.com/p/smhasher/
+ */
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline uint64_t get64bits(const uint8_t* p)
+{
+    uint64_t k;
+    memcpy(&k, p, sizeof(uint64_t));
+    return k;
+}
+
+static void murmur3_128(const void* key, size_t len, uint32_t seed, uint64_t out[2])
+{
+    const uint8_t* data = (const uint8_t*) key;
+    const size_t nblocks = len / 16;
+
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    uint64_t k1, k2;
+    size_t i;
+
+    /* body */
+    for (i = 0; i < nblocks; i++) {
+        k1 = get64bits(data + 16 * i);
+        k2 = get64bits(data + 16 * i + 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    /* tail */
+    const uint8_t* tail = data + nblocks * 16;
+    k1 = 0;
+    k2 = 0;
+
+    switch (len & 15) {
+        case 15: k2 ^= ((uint64_t) tail[14]) << 48;
+        case 14: k2 ^= ((uint64_t) tail[13]) << 40;
+        case 13: k2 ^= ((uint64_t) tail[12]) << 32;
+        case 12: k2 ^= ((uint64_t) tail[11]) << 24;
+        case 11: k2 ^= ((uint64_t) tail[10]) << 16;
+        case 10: k2 ^= ((uint64_t) tail[ 9]) << 8;
+        case  9: k2 ^= ((uint64_t) tail[ 8]) << 0;
+                 k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+
+        case  8: k1 ^= ((uint64_t) tail[ 7]) << 56;
+        case  7: k1 ^= ((uint64_t) tail[ 6]) << 48;
+        case  6: k1 ^= ((uint64_t) tail[ 5]) << 40;
+        case  5: k1 ^= ((uint64_t) tail[ 4]) << 32;
+        case  4: k1 ^= ((uint64_t) tail[ 3]) << 24;
+        case  3: k1 ^= ((uint64_t) tail[ 2]) << 16;
+        case  2: k1 ^= ((uint64_t) tail[ 1]) << 8;
+        case  1: k1 ^= ((uint64_t) tail[ 0]) << 0;
+                 k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    /* finalization */
+    h1 ^= len;
+    h2 ^= len;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    out[0] = h1;
+    out[1] = h2;
+}
+
+
+void fingerprint(const char* value, size_t len, uint32_t seed, uint64_t* fp, int width)
+{
+    uint64_t h[2];
+    murmur3_128(value, len, seed, h);
+
+    /* an all zero key marks an empty slot */
+    if (h[0] == 0) h[0] = 1;
+
+    fp[0] = h[0];
+    if (width > 1) fp[1] = h[1];
+}
+
+
+
+static void rehash(fp_table* T, size_t new_n);
+
+
+
+static fp_table* alloc_fp_table(int width, int with_values, size_t n)
+{
+    fp_table* T = malloc_or_die(sizeof(fp_table));
+    T->K = malloc_or_die(n * width * sizeof(uint64_t));
+    memset(T->K, 0, n * width * sizeof(uint64_t));
+    T->C = malloc_or_die(n * sizeof(uint8_t));
+    memset(T->C, 0, n * sizeof(uint8_t));
+    T->V = with_values ? malloc_or_die(n * sizeof(uint64_t)) : NULL;
+    T->width = width;
+    T->n = n;
+    T->m = 0;
+    T->max_m = T->n * MAX_LOAD;
+
+    return T;
+}
+
+
+fp_table* create_fp_table(int width, int with_values, size_t n_expected)
+{
+    size_t n = n_expected / MAX_LOAD + 1;
+    if (n < INITIAL_TABLE_SIZE) n = INITIAL_TABLE_SIZE;
+
+    return alloc_fp_table(width, with_values, n);
+}
+
+
+void destroy_fp_table(fp_table* T)
+{
+    if (T != NULL) {
+        free(T->K);
+        free(T->C);
+        free(T->V);
+        free(T);
+    }
+}
+
+
+/* Linear probing from the slot the first word picks: either the slot
+ * holding key or the empty one where it would go. */
+static size_t probe(const fp_table* T, const uint64_t* key)
+{
+    size_t i = key[0] % T->n;
+    const uint64_t* k;
+
+    while (1) {
+        k = T->K + i * T->width;
+        if (k[0] == key[0] && (T->width == 1 || k[1] == key[1])) return i;
+        if (k[0] == 0) return i;
+        if (++i == T->n) i = 0;
+    }
+}
+
+
+static void rehash(fp_table* T, size_t new_n)
+{
+    fp_table* U = alloc_fp_table(T->width, T->V != NULL, new_n);
+
+    size_t i, j;
+    for (i = 0; i < T->n; i++) {
+        if (T->K[i * T->width] == 0) continue;
+
+        j = probe(U, T->K + i * T->width);
+        memcpy(U->K + j * U->width, T->K + i * T->width, T->width * sizeof(uint64_t));
+        U->C[j] = T->C[i];
+        if (T->V) U->V[j] = T->V[i];
+    }
+
+    free(T->K);
+    free(T->C);
+    free(T->V);
+    T->K = U->K;
+    T->C = U->C;
+    T->V = U->V;
+    T->n = U->n;
+    T->max_m = U->max_m;
+    free(U);
+}
+
+
+size_t inc_fp_table(fp_table* T, const uint64_t* key)
+{
+    /* grow by half, rather than doubling, to keep the slack small */
+    if (T->m >= T->max_m) rehash(T, T->n + T->n / 2);
+
+    size_t i = probe(T, key);
+    uint64_t* k = T->K + i * T->width;
+
+    if (k[0] == 0) {
+        memcpy(k, key, T->width * sizeof(uint64_t));
+        T->m++;
+    }
+
+    if ((T->C[i] & FP_COUNT_MASK) < FP_COUNT_MASK) T->C[i]++;
+
+    return i;
+}
+
+
+size_t find_fp_table(const fp_table* T, const uint64_t* key)
+{
+    size_t i = probe(T, key);
+    return T->K[i * T->width] == 0 ? T->n : i;
+}
+
+
+uint32_t get_fp_table(const fp_table* T, const uint64_t* key)
+{
+    size_t i = probe(T, key);
+    return T->K[i * T->width] == 0 ? 0 : T->C[i] & FP_COUNT_MASK;
+}
+
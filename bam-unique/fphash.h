@@ -0,0 +1,62 @@
+/*
+ * This file is part of fastq-tools.
+ *
+ * Copyright (c) 2011 by Daniel C. Jones <dcjones@cs.washington.edu>
+ *
+ * fphash :
+ * A compact table counting fixed-width fingerprints rather than strings.
+ *
+ * Keys are one or two 64-bit words, kept inline in an open-addressing
+ * table next to a one byte saturating counter, so an entry costs 9 or 17
+ * bytes rather than a string and a chained node.
+ *
+ */
+
+
+#ifndef FASTQ_TOOLS_FPHASH_H
+#define FASTQ_TOOLS_FPHASH_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+/* the counter's low bits; the top bit is left for the caller to flag
+ * entries by */
+#define FP_COUNT_MASK 0x7f
+#define FP_FLAG       0x80
+
+
+typedef struct
+{
+    uint64_t* K;      /* keys, width words each, all zero if empty */
+    uint8_t*  C;      /* counters */
+    uint64_t* V;      /* a value per key, if asked for, else NULL */
+    int width;        /* words per key, 1 or 2 */
+    size_t n;         /* table size */
+    size_t m;         /* hashed items */
+    size_t max_m;     /* max hashed items before rehash */
+} fp_table;
+
+
+/* 128-bit fingerprint of a string, of which width words are written to fp.
+ * Different seeds give independent fingerprints of the same string. */
+void fingerprint(const char* value, size_t len, uint32_t seed, uint64_t* fp, int width);
+
+/* Create a table of keys of width words, sized to hold n_expected keys
+ * without rehashing (or a small default if 0), with room for a value per
+ * key if with_values is set. */
+fp_table* create_fp_table(int width, int with_values, size_t n_expected);
+
+void destroy_fp_table(fp_table*);
+
+/* Count one occurrence of key, returning its slot. */
+size_t inc_fp_table(fp_table*, const uint64_t* key);
+
+/* The slot of key, or T->n if it is absent. */
+size_t find_fp_table(const fp_table*, const uint64_t* key);
+
+/* The number of occurrences of key, saturating at FP_COUNT_MASK. */
+uint32_t get_fp_table(const fp_table*, const uint64_t* key);
+
+
+#endif
@@ -575,6 +575,29 @@ extern "C" {
 	 */
 	int bam_index_build(const char *fn);
 
+	/*!
+	  @abstract   Build index for a BAM file on several threads.
+	  @discussion The file is split at BGZF block boundaries and the
+	  pieces are read in parallel; the index written is identical to
+	  bam_index_build()'s. Remote files and files too small to split are
+	  indexed on one thread.
+	  @param  fn  name of the BAM file
+	  @param  n_threads  number of threads; 1 or less is bam_index_build()
+	  @return     0 on success; -1 on failure
+	 */
+	int bam_index_build_mt(const char *fn, int n_threads);
+
+	/*!
+	  @abstract   Write the memory-mapped sidecar index "fn.bmi" from "fn.bai".
+	  @discussion bam_index_build() already writes it; this converts
+	  indices made elsewhere. bam_index_load() uses "fn.bmi" in place of
+	  "fn.bai" when the BAM's size and modification time match those it
+	  was built from, and it is at least as new as "fn.bai".
+	  @param  fn  name of the BAM file
+	  @return     0 on success; -1 on failure
+	 */
+	int bam_index_build_mmap(const char *fn);
+
 	/*!
 	  @abstract   Load index from file "fn.bai".
 	  @param  fn  name of the BAM file (NOT the index file)
@@ -582,6 +605,36 @@ extern "C" {
 	 */
 	bam_index_t *bam_index_load(const char *fn);
 
+	/*!
+	  @abstract   Write an index, built or loaded from a .bai, in the .bmi layout.
+	  @param  fn  name of the BAM file indexed, whose size and
+	              modification time are recorded
+	  @return     0 on success; -1 on failure
+	 */
+	int bam_index_save_mmap(const bam_index_t *idx, const char *fn, FILE *fp);
+
+	/*!
+	  @abstract   The linear index of a reference.
+	  @discussion offset[i] is the smallest virtual file offset of the
+	  alignments overlapping [i<<14, (i+1)<<14), or 0 before the first one.
+	  @param  tid     reference ID
+	  @param  offset  set to the offsets, owned by the index
+	  @return         number of 16 kb windows; 0 if tid has none
+	 */
+	int bam_index_linear(const bam_index_t *idx, int tid, const uint64_t **offset);
+
+	/*!
+	  @abstract   The statistics an index keeps for a reference.
+	  @param  tid         reference ID
+	  @param  off_beg     virtual file offset of its first alignment
+	  @param  off_end     virtual file offset just past its last alignment
+	  @param  n_mapped    number of mapped alignments
+	  @param  n_unmapped  number of unmapped alignments placed on the reference
+	  @return             0; or -1 if the index has no statistics for tid
+	 */
+	int bam_index_stats(const bam_index_t *idx, int tid, uint64_t *off_beg, uint64_t *off_end,
+						uint64_t *n_mapped, uint64_t *n_unmapped);
+
 	/*!
 	  @abstract    Destroy an index structure.
 	  @param  idx  pointer to the index structure
@@ -616,6 +669,51 @@ extern "C" {
 	int bam_iter_read(bamFile fp, bam_iter_t iter, bam1_t *b);
 	void bam_iter_destroy(bam_iter_t iter);
 
+	/*! @typedef
+	  @abstract  A region for the multi-region queries: [beg,end) on tid, 0-based.
+	 */
+	typedef struct {
+		int tid, beg, end;
+	} bam_region_t;
+
+	typedef struct __bam_miter_t *bam_miter_t;
+
+	/*! @typedef
+	  @abstract      Type of function to be called by bam_fetch_multi().
+	  @param  b     the alignment
+	  @param  i     index of an overlapped region in the list passed in
+	  @param  data  user provided data
+	 */
+	typedef int (*bam_fetch_multi_f)(const bam1_t *b, int i, void *data);
+
+	/*!
+	  @abstract Retrieve the alignments overlapping any of a list of regions.
+
+	  @discussion The chunks of all regions are merged, so each BGZF
+	  block is read and inflated at most once however many regions
+	  share it. func is called once for every (alignment, overlapped
+	  region) pair, alignments in file order. Regions need not be
+	  sorted and may overlap each other.
+
+	  @param  fp       BAM file handler
+	  @param  idx      pointer to the alignment index
+	  @param  n        number of regions
+	  @param  regions  the regions
+	  @param  data     user provided data (will be transferred to func)
+	  @param  func     user defined function
+	 */
+	int bam_fetch_multi(bamFile fp, const bam_index_t *idx, int n, const bam_region_t *regions, void *data, bam_fetch_multi_f func);
+
+	/*!
+	  @abstract  Iterator form of bam_fetch_multi().
+	  @discussion bam_iter_read_multi() returns the next alignment that
+	  overlaps at least one region, and points *hits at the indices of
+	  the n_hits regions it overlaps. *hits is valid until the next call.
+	 */
+	bam_miter_t bam_iter_query_multi(const bam_index_t *idx, int n, const bam_region_t *regions);
+	int bam_iter_read_multi(bamFile fp, bam_miter_t iter, bam1_t *b, const int **hits, int *n_hits);
+	void bam_iter_destroy_multi(bam_miter_t iter);
+
 	/*!
 	  @abstract       Parse a region in the format: "chr2:100,000-200,000".
 	  @discussion     bam_header_t::hash will be initialized if empty.
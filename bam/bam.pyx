@@ -98,6 +98,59 @@ cdef extern from 'samtools/sam.h':
 cdef extern from 'samtools/bam.h':
     int32_t bam_get_tid(bam_header_t *header, char *seq_name)
 
+    ctypedef int* const_int_ptr "const int*"
+
+    ctypedef struct bam_region_t:
+        int tid
+        int beg
+        int end
+
+    struct __bam_miter_t:
+        pass
+
+    ctypedef __bam_miter_t* bam_miter_t
+
+    bam_miter_t bam_iter_query_multi( bam_index_t *idx, int n, bam_region_t *regions )
+    int bam_iter_read_multi( bamFile fp, bam_miter_t iter, bam1_t *b, \
+                             const_int_ptr *hits, int *n_hits )
+    void bam_iter_destroy_multi( bam_miter_t iter )
+
+
+cdef extern from 'samtools/bgzf.h':
+    ctypedef struct bgzf_cache_stats_t:
+        uint64_t hits
+        uint64_t misses
+        uint64_t evictions
+        size_t size
+        size_t capacity
+
+    void bgzf_set_cache_size( bamFile fp, int cache_size )
+    void bgzf_cache_set_size( size_t size )
+    void bgzf_cache_stats( bgzf_cache_stats_t* stats )
+    void bgzf_cache_reset_stats()
+
+
+def set_block_cache_size( size ):
+    '''
+    Set the size in bytes of the cache of decompressed blocks shared by all
+    open Bam objects. Zero disables it.
+    '''
+    bgzf_cache_set_size( size )
+
+
+def block_cache_stats( reset = False ):
+    '''
+    Return a dict with the hits, misses and evictions of the shared block
+    cache, and its size and capacity in bytes. If reset is true, the counters
+    start again from zero.
+    '''
+    cdef bgzf_cache_stats_t s
+    bgzf_cache_stats( &s )
+    if reset:
+        bgzf_cache_reset_stats()
+    return { 'hits' : s.hits, 'misses' : s.misses, 'evictions' : s.evictions,
+             'size' : s.size, 'capacity' : s.capacity }
+
 
 cdef extern from "bam_init_header_hash.h":
     void bam_init_header_hash(bam_header_t *header)
@@ -129,6 +182,14 @@ cdef char bam1_basei( bam1_t* b, int i ):
 
 
 
+# Strand given as '+', '-', 0, 1 or None.
+cdef object strand_code( strand ):
+    if strand == '+' or strand == 0: return 0
+    if strand == '-' or strand == 1: return 1
+    return None
+
+
+
 # Cigar operations.
 BAM_CMATCH     = 0
 BAM_CINS       = 1
@@ -290,12 +351,20 @@ cdef class Bam:
     cdef bam_index_t* reads_index
     cdef object seqlens
 
-    def __cinit__( self, fn ):
+    def __cinit__( self, fn, cache_size = 8 << 20 ):
+        '''
+        Open an indexed BAM file. Decompressed blocks go through a cache shared
+        by all Bam objects, which this grows to at least cache_size bytes;
+        repeated queries of nearby regions then skip re-inflating blocks.
+        cache_size = 0 keeps this file out of the cache.
+        '''
         self.reads_f = samopen( fn, 'rb', NULL )
         if( self.reads_f == NULL ):
             raise IOError( 'Can\'t open file %s\n' % fn )
             exit(1)
 
+        bgzf_set_cache_size( self.reads_f.x.bam, cache_size )
+
         self.reads_index = bam_index_load( fn )
         if( self.reads_index == NULL ):
             raise IOError( 'Can\'t open bam index %s.bai\n' % fn )
@@ -459,4 +528,172 @@ cdef class Bam:
         return xs
 
 
+    cdef object query_regions( self, regions, bam_region_t* rs,
+                               int* strands, strand ):
+        '''
+        Convert (chrom, start, end[, strand]) tuples to C regions covering
+        [start, end] in rs, and their strands to 0, 1 or -1 for either.
+        Unknown sequences get tid -1 and match nothing.
+        '''
+
+        cdef int k
+
+        for k, region in enumerate(regions):
+            rs[k].tid = bam_get_tid( self.reads_f.header, region[0] )
+            rs[k].beg = region[1]
+            rs[k].end = region[2] + 1
+
+            s = strand_code( region[3] if len(region) > 3 else strand )
+            strands[k] = -1 if s is None else s
+
+
+    cdef object region_arrays( self, regions, size_t* offsets ):
+        '''
+        One zeroed array holding every region's values end to end, with
+        region k starting at offsets[k].
+        '''
+
+        cdef size_t total = 0
+        cdef int k
+
+        for k, region in enumerate(regions):
+            offsets[k] = total
+            total += region[2] - region[1] + 1
+
+        return np.zeros( max(total, 1), dtype=np.float )
+
+
+    def counts_many( self, regions, strand=None, mate = 1 ):
+        '''
+        counts() for each of a list of (chrom, start, end[, strand]) regions,
+        returned as a list of arrays. The regions are fetched together, so
+        blocks shared between nearby regions are only read once.
+        '''
+
+        cdef int n = len(regions)
+        cdef int* strands = <int*>malloc( max(n, 1) * sizeof(int) )
+        cdef size_t* offsets = <size_t*>malloc( max(n, 1) * sizeof(size_t) )
+        cdef bam_region_t* rs = \
+            <bam_region_t*>malloc( max(n, 1) * sizeof(bam_region_t) )
+        cdef bam_miter_t it = NULL
+        cdef bam1_t* read = NULL
+        cdef const_int_ptr hits
+        cdef int n_hits, k, r, s
+        cdef int32_t i
+        cdef double[:] x
+
+        # the C arrays are freed however we leave, a bad region included
+        try:
+            self.query_regions( regions, rs, strands, strand )
+            it   = bam_iter_query_multi( self.reads_index, n, rs )
+            read = bam_init1()
+
+            flat = self.region_arrays( regions, offsets )
+            x = flat
+
+            while bam_iter_read_multi( self.reads_f.x.bam, it, read, &hits, &n_hits ) >= 0:
+                if mate == 1 and read.core.flag & BAM_FREAD2: continue
+                if mate == 2 and read.core.flag & BAM_FREAD1: continue
+
+                s = bam1_strand(read)
+                if s == 0:
+                    i = read.core.pos
+                else:
+                    i = bam_calend( &read.core, bam1_cigar(read) ) - 1
+
+                for k in range(n_hits):
+                    r = hits[k]
+                    if strands[r] != -1 and strands[r] != s: continue
+                    if rs[r].beg <= i < rs[r].end: x[offsets[r] + i - rs[r].beg] += 1
+
+            xs = []
+            for r in range(n):
+                xr = flat[offsets[r]:offsets[r] + rs[r].end - rs[r].beg]
+                xs.append( xr[::-1] if strands[r] == 1 else xr )
+
+        finally:
+            bam_destroy1(read)
+            bam_iter_destroy_multi(it)
+            free(rs)
+            free(strands)
+            free(offsets)
+
+        return xs
+
+
+    def count_many( self, regions, strand = None ):
+        '''
+        count() for each of a list of (chrom, start, end[, strand]) regions,
+        returned as one array.
+        '''
+
+        return np.array( [ xs.sum() for xs in
+                           self.counts_many( regions, strand, mate = 0 ) ] )
+
+
+    def coverage_many( self, regions, strand=None ):
+        '''
+        coverage() for each of a list of (chrom, start, end[, strand])
+        regions, returned as a list of arrays.
+        '''
 
+        cdef int n = len(regions)
+        cdef int* strands = <int*>malloc( max(n, 1) * sizeof(int) )
+        cdef size_t* offsets = <size_t*>malloc( max(n, 1) * sizeof(size_t) )
+        cdef bam_region_t* rs = \
+            <bam_region_t*>malloc( max(n, 1) * sizeof(bam_region_t) )
+        cdef bam_miter_t it = NULL
+        cdef bam1_t* read = NULL
+        cdef const_int_ptr hits
+        cdef int n_hits, k, r, s
+        cdef size_t i, j
+
+        cdef uint32_t* cigar
+        cdef int32_t pos, beg, end
+        cdef uint8_t op
+        cdef uint32_t clen
+        cdef double[:] x
+
+        try:
+            self.query_regions( regions, rs, strands, strand )
+            it   = bam_iter_query_multi( self.reads_index, n, rs )
+            read = bam_init1()
+
+            flat = self.region_arrays( regions, offsets )
+            x = flat
+
+            while bam_iter_read_multi( self.reads_f.x.bam, it, read, &hits, &n_hits ) >= 0:
+                s     = bam1_strand(read)
+                cigar = bam1_cigar(read)
+
+                for k in range(n_hits):
+                    r = hits[k]
+                    if strands[r] != -1 and strands[r] != s: continue
+
+                    beg = rs[r].beg
+                    end = rs[r].end - 1
+                    pos = read.core.pos
+
+                    for i in range(read.core.n_cigar):
+                        if pos > end: break
+                        op   = cigar[i] & BAM_CIGAR_MASK
+                        clen = cigar[i] >> BAM_CIGAR_SHIFT
+
+                        if op == BAM_CMATCH:
+                            for j in range(clen):
+                                if beg <= pos <= end: x[offsets[r] + pos - beg] += 1
+                                pos += 1
+                        else:
+                            pos += clen
+
+            xs = [ flat[offsets[r]:offsets[r] + rs[r].end - rs[r].beg]
+                   for r in range(n) ]
+
+        finally:
+            bam_destroy1(read)
+            bam_iter_destroy_multi(it)
+            free(rs)
+            free(strands)
+            free(offsets)
+
+        return xs
@@ -1,32 +1,24 @@
 
 #include "hash.h"
-#include <samtools/sam.h>
+#include "packed.h"
+#include "cluster.h"
+#include "samtools/sam.h"
+#include <unistd.h>
 
 
 void usage()
 {
     fprintf( stderr,
-            "Usage: bamHash <reads.bam> [k] [d]\n"
+            "Usage: bamHash [-@ threads] <reads.bam> [k] [d]\n"
             "Hashes the first k nucleotides of each read and prints counts\n"
             "in the form:\n"
             "   seq1   count1\n"
             "   seq2   count2\n"
             "If d is specified, produce counts for the sequence and all sequence\n"
-            "within Hamming distance d\n" );
-}
-
-const char* NT = "ATCGN";
-
-char* bam_seq_to_seq( bam1_t* read )
-{
-    char* seq = malloc(sizeof(char)*(1+read->core.l_qseq));
-    int i;
-    for( i = 0; i < read->core.l_qseq; i++ ) {
-        seq[i] = bam_nt16_rev_table[bam1_seqi( bam1_seq(read), i )];
-    }
-    seq[i] = '\0';
-
-    return seq;
+            "within Hamming distance d (sequences shorter than k, or with\n"
+            "ambiguity codes other than N, keep their own count)\n"
+            "The -@ option decompresses the BAM file, and clusters, using the\n"
+            "given number of threads.\n" );
 }
 
 
@@ -44,60 +36,98 @@ void bam_seq_to_seq_n( bam1_t* read, char* out, size_t n )
 
 
 
-void print_reads( bam_header_t* header, struct table* T,
-                      struct hashed_value** S )
+/* Count the first k nucleotides of a read: packed if it has k and they are
+ * all A, C, G or T, else as a string. */
+void count_read( struct table* T, struct packed_table* P, bam1_t* read, char* seq )
 {
-    size_t i;
-    for( i = 0; i < T->m; i++ ) {
-        fprintf( stdout, "%s\t%llu\n", S[i]->seq, S[i]->count );
+    uint64_t key;
+
+    if( P && read->core.l_qseq >= P->read_len &&
+        nt16_pack( bam1_seq(read), P->read_len, &key ) ) {
+        packed_inc( P, key );
+    }
+    else {
+        bam_seq_to_seq_n( read, seq, T->read_len );
+        table_inc( T, seq );
     }
 }
 
 
-
-uint64_t subst_count( struct table* T, char* seq, size_t d )
+/* Print both tables, each sorted by count, merged. */
+void print_reads( struct table* T, struct hashed_value** S,
+                  struct packed_table* P )
 {
-    if( d == 0 ) return 0;
-
-    char c;
-    uint64_t n = 0;
-    size_t i, j;
-    for( i = 0; i < T->read_len; i++ ) {
-        c = seq[i];
-
-        for( j = 0; j < 5; j++ ) {
-            if( c == NT[j] ) continue;
-            seq[i] = NT[j];
-            n += table_get( T, seq );
-            n += subst_count( T, seq, d-1 );
+    char* seq = malloc(sizeof(char)*(1+T->read_len));
+    size_t i = 0, j = 0;
+
+    while( i < T->m || (P && j < P->m) ) {
+        if( P && j < P->m && (i == T->m || P->A[j].count > S[i]->count) ) {
+            seq_unpack( P->A[j].key, P->read_len, seq );
+            fprintf( stdout, "%s\t%llu\n", seq, (unsigned long long) P->A[j].count );
+            j++;
+        }
+        else {
+            fprintf( stdout, "%s\t%llu\n", S[i]->seq, (unsigned long long) S[i]->count );
+            i++;
         }
-
-        seq[i] = c;
     }
 
-    return n;
+    free(seq);
 }
 
 
-void add_cluster_counts( struct table* T, size_t d )
+
+/* Add to each sequence the counts of those within Hamming distance d of
+ * it. Sequences that are shorter than the rest or have ambiguity codes
+ * other than N keep their own count. */
+void add_cluster_counts( struct table* T, struct packed_table* P, size_t d,
+                         int n_threads )
 {
-    size_t i;
+    struct cluster_items C;
+    size_t i, n = T->m + (P ? P->m : 0);
     struct hashed_value *j;
+
+    /* where each sequence's count is kept */
+    uint64_t** target = malloc( sizeof(uint64_t*) * n );
+
+    cluster_create( &C, n, T->read_len );
+
     for( i = 0; i < T->n; i++ ) {
-        j = T->A[i];
-        while( j ) {
-            j->count += subst_count(T,j->seq,d);
-            j = j->next;
-        }
-        if( i > 0 && i % 100000 == 0 ) {
-            fprintf( stderr, "\t%d reads...\n", i );
+        for( j = T->A[i]; j; j = j->next ) {
+            if( cluster_add_seq( &C, j->seq, j->count ) ) target[C.n - 1] = &j->count;
         }
     }
+
+    for( i = 0; P && i < P->n; i++ ) {
+        if( P->A[i].count == 0 ) continue;
+        cluster_add_key( &C, P->A[i].key, P->A[i].count );
+        target[C.n - 1] = &P->A[i].count;
+    }
+
+    cluster_count( &C, d, n_threads );
+
+    for( i = 0; i < C.n; i++ ) *target[i] += C.add[i];
+
+    cluster_destroy( &C );
+    free(target);
 }
 
 
 int main( int argc, char* argv[] )
 {
+    int c, n_threads = 1;
+    while( (c = getopt( argc, argv, "@:" )) != -1 ) {
+        if( c == '@' ) n_threads = atoi(optarg);
+        else {
+            usage();
+            exit(1);
+        }
+    }
+
+    /* the remaining arguments are positional */
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if( argc < 2 ) {
         usage();
         exit(1);
@@ -107,6 +137,10 @@ int main( int argc, char* argv[] )
     size_t d = 0;
     struct table T;
 
+    /* short prefixes are packed into integers, the rest kept in T */
+    struct packed_table packed;
+    struct packed_table* P = NULL;
+
     samfile_t* fp = NULL;
     bam1_t* read  = bam_init1();
 
@@ -115,6 +149,7 @@ int main( int argc, char* argv[] )
         fprintf( stderr, "Can't open file '%s'.\n", argv[1] );
         exit(1);
     }
+    samthreads( fp, n_threads, 0 );
 
     if( argc > 2 ) {
         table_create( &T, atoi(argv[2]) );
@@ -124,28 +159,31 @@ int main( int argc, char* argv[] )
          * the length */
         samread(fp,read);
         table_create( &T, read->core.l_qseq );
-        char* tmp = bam_seq_to_seq(read);
-        table_inc( &T, tmp );
-        free(tmp);
         n = 1;
     }
 
+    if( T.read_len > 0 && T.read_len <= PACKED_MAX_LEN ) {
+        packed_create( &packed, T.read_len );
+        P = &packed;
+    }
+
     if( argc > 3 ) d = atoi(argv[3]);
 
 
     char* seq = malloc(sizeof(char)*(1+T.read_len));
 
+    if( n == 1 ) count_read( &T, P, read, seq );
+
     fprintf( stderr, "Reading...\n" );
     while( samread(fp,read) > 0 ) {
-        bam_seq_to_seq_n( read, seq, T.read_len );
-        table_inc( &T, seq );
+        count_read( &T, P, read, seq );
         n++;
 
         if( n % 1000000 == 0 ) {
-            fprintf( stderr, "\t%d reads (%d unique)...\n", n, T.m );
+            fprintf( stderr, "\t%zu reads (%zu unique)...\n", n, T.m + (P ? P->m : 0) );
         }
     }
-    fprintf( stderr, "%d reads (%d unique). Finished.\n", n, T.m );
+    fprintf( stderr, "%zu reads (%zu unique). Finished.\n", n, T.m + (P ? P->m : 0) );
 
 
     struct hashed_value** S;
@@ -153,18 +191,20 @@ int main( int argc, char* argv[] )
     fprintf( stderr, "Clustering...\n" );
 
     if( d > 0 ) {
-        add_cluster_counts( &T, d );
+        add_cluster_counts( &T, P, d, n_threads );
     }
 
     fprintf( stderr, "Sorting...\n" );
 
     sort_by_count( &T, &S );
+    if( P ) packed_sort_by_count( P );
 
-    print_reads( fp->header, &T, S );
+    print_reads( &T, S, P );
 
     free(S);
 
     table_destroy(&T);
+    if( P ) packed_destroy( P );
 
     bam_destroy1(read);
     samclose(fp);
@@ -0,0 +1,306 @@
+#include "cluster.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+
+#define EVEN_BITS 0x5555555555555555ULL
+
+/* groups of each segment are spread over this many shards, which threads
+ * take one at a time */
+#define SHARD_BITS 8
+
+
+void cluster_create( struct cluster_items* C, size_t size, size_t k )
+{
+    C->n       = 0;
+    C->size    = size;
+    C->k       = k;
+    C->n_words = (k + 31) / 32;
+    C->seqs    = malloc( sizeof(uint64_t) * 2 * C->n_words * size );
+    C->count   = malloc( sizeof(uint64_t) * size );
+    C->add     = malloc( sizeof(uint64_t) * size );
+    memset( C->seqs, 0, sizeof(uint64_t) * 2 * C->n_words * size );
+    memset( C->add, 0, sizeof(uint64_t) * size );
+}
+
+
+void cluster_destroy( struct cluster_items* C )
+{
+    free(C->seqs);
+    free(C->count);
+    free(C->add);
+}
+
+
+/* the nucleotides packed into word w */
+static inline size_t word_len( const struct cluster_items* C, size_t w )
+{
+    return w + 1 < C->n_words ? 32 : C->k - 32 * w;
+}
+
+
+bool cluster_add_seq( struct cluster_items* C, const char* seq, uint64_t count )
+{
+    uint64_t* s = C->seqs + 2 * C->n_words * C->n;
+    uint64_t code, flag;
+    size_t w, i, p;
+
+    for( w = 0, p = 0; w < C->n_words; w++ ) {
+        code = flag = 0;
+        for( i = 0; i < word_len( C, w ); i++, p++ ) {
+            code <<= 2;
+            flag <<= 2;
+            switch( seq[p] ) {
+                case 'A':              break;
+                case 'C': code |= 1;   break;
+                case 'G': code |= 2;   break;
+                case 'T': code |= 3;   break;
+                case 'N': flag |= 1;   break;
+                default:  return false;
+            }
+        }
+
+        s[2*w]     = code;
+        s[2*w + 1] = flag;
+    }
+
+    C->count[C->n++] = count;
+    return true;
+}
+
+
+void cluster_add_key( struct cluster_items* C, uint64_t key, uint64_t count )
+{
+    uint64_t* s = C->seqs + 2 * C->n_words * C->n;
+    s[0] = key;
+    s[1] = 0;
+
+    C->count[C->n++] = count;
+}
+
+
+
+/* Bases differing between two sequences: those coded differently where
+ * neither is N, and those where just one is. */
+static inline size_t distance( const uint64_t* a, const uint64_t* b,
+                               size_t n_words, size_t d )
+{
+    uint64_t x, diff;
+    size_t w, dist = 0;
+
+    for( w = 0; w < n_words; w++ ) {
+        x = a[2*w] ^ b[2*w];
+        diff = ((x | (x >> 1)) & EVEN_BITS & ~(a[2*w+1] | b[2*w+1]))
+             | (a[2*w+1] ^ b[2*w+1]);
+        dist += __builtin_popcountll(diff);
+        if( dist > d ) break;
+    }
+
+    return dist;
+}
+
+
+/* A segment is a run of bases, given as a mask over each pair of words. */
+static inline bool segment_equal( const uint64_t* a, const uint64_t* b,
+                                  const uint64_t* mask, size_t n_words )
+{
+    size_t w;
+    for( w = 0; w < n_words; w++ ) {
+        if( ((a[2*w] ^ b[2*w]) | (a[2*w+1] ^ b[2*w+1])) & mask[w] ) return false;
+    }
+    return true;
+}
+
+
+static inline uint64_t fmix64( uint64_t k )
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+
+static inline uint64_t segment_hash( const uint64_t* a, const uint64_t* mask, size_t n_words )
+{
+    uint64_t h = 0;
+    size_t w;
+    for( w = 0; w < n_words; w++ ) {
+        if( mask[w] == 0 ) continue;
+        h = fmix64( h ^ (a[2*w] & mask[w]) );
+        h = fmix64( h ^ (a[2*w+1] & mask[w]) );
+    }
+    return h;
+}
+
+
+
+struct entry
+{
+    uint64_t h;
+    size_t   i;
+};
+
+
+static int comp_entry( const void* x, const void* y )
+{
+    const struct entry* a = x;
+    const struct entry* b = y;
+
+    if( a->h < b->h ) return -1;
+    if( a->h > b->h ) return 1;
+    return a->i < b->i ? -1 : (a->i > b->i);
+}
+
+
+struct segment_job
+{
+    struct cluster_items* C;
+    size_t d;
+
+    const uint64_t* masks;  /* n_words masks per segment */
+    size_t s;               /* the segment being grouped on */
+
+    struct entry* E;        /* entries, by shard */
+    size_t* shard_start;    /* where each shard begins, and one past the end */
+
+    size_t next_shard;
+    pthread_mutex_t lock;
+};
+
+
+/* Compare all pairs within a group sharing segment s, counting those
+ * within distance d that agree on no earlier segment. */
+static void count_group( struct segment_job* J, const struct entry* E, size_t n )
+{
+    struct cluster_items* C = J->C;
+    size_t nw = C->n_words;
+    const uint64_t *a, *b;
+    size_t u, v, t;
+
+    for( u = 0; u < n; u++ ) {
+        a = C->seqs + 2 * nw * E[u].i;
+        for( v = u + 1; v < n; v++ ) {
+            b = C->seqs + 2 * nw * E[v].i;
+
+            if( !segment_equal( a, b, J->masks + J->s * nw, nw ) ) continue;
+            if( distance( a, b, nw, J->d ) > J->d ) continue;
+
+            for( t = 0; t < J->s; t++ ) {
+                if( segment_equal( a, b, J->masks + t * nw, nw ) ) break;
+            }
+            if( t < J->s ) continue;
+
+            __sync_fetch_and_add( &C->add[E[u].i], C->count[E[v].i] );
+            __sync_fetch_and_add( &C->add[E[v].i], C->count[E[u].i] );
+        }
+    }
+}
+
+
+static void* segment_worker( void* arg )
+{
+    struct segment_job* J = arg;
+    struct entry* E;
+    size_t shard, n, i, j;
+
+    while( true ) {
+        pthread_mutex_lock( &J->lock );
+        shard = J->next_shard++;
+        pthread_mutex_unlock( &J->lock );
+
+        if( shard >= (1 << SHARD_BITS) ) break;
+
+        E = J->E + J->shard_start[shard];
+        n = J->shard_start[shard + 1] - J->shard_start[shard];
+        qsort( E, n, sizeof(struct entry), comp_entry );
+
+        for( i = 0; i < n; i = j ) {
+            for( j = i + 1; j < n && E[j].h == E[i].h; j++ );
+            if( j - i > 1 ) count_group( J, E + i, j - i );
+        }
+    }
+
+    return NULL;
+}
+
+
+void cluster_count( struct cluster_items* C, size_t d, int n_threads )
+{
+    size_t nw = C->n_words;
+    size_t n_seg = d + 1, s, w, p, beg, end, i;
+    uint64_t total = 0;
+
+    /* every pair is within distance k */
+    if( d >= C->k ) {
+        for( i = 0; i < C->n; i++ ) total += C->count[i];
+        for( i = 0; i < C->n; i++ ) C->add[i] = total - C->count[i];
+        return;
+    }
+
+    /* the bases of each segment, flagged in the low bit of their pair */
+    uint64_t* masks = malloc( sizeof(uint64_t) * n_seg * nw );
+    memset( masks, 0, sizeof(uint64_t) * n_seg * nw );
+    for( s = 0; s < n_seg; s++ ) {
+        beg = s * C->k / n_seg;
+        end = (s + 1) * C->k / n_seg;
+        for( p = beg; p < end; p++ ) {
+            w = p / 32;
+            masks[s * nw + w] |= 3ULL << (2 * (word_len( C, w ) - 1 - p % 32));
+        }
+    }
+
+    struct entry* E   = malloc( sizeof(struct entry) * C->n );
+    struct entry* tmp = malloc( sizeof(struct entry) * C->n );
+    size_t* shard_start = malloc( sizeof(size_t) * ((1 << SHARD_BITS) + 1) );
+
+    pthread_t* threads = malloc( sizeof(pthread_t) * n_threads );
+    struct segment_job J;
+    J.C = C;
+    J.d = d;
+    J.masks = masks;
+    J.E = E;
+    J.shard_start = shard_start;
+    pthread_mutex_init( &J.lock, NULL );
+
+    int t;
+    for( s = 0; s < n_seg; s++ ) {
+        fprintf( stderr, "\tsegment %zu of %zu...\n", s + 1, n_seg );
+
+        /* hash on the segment, and lay the entries out by shard */
+        memset( shard_start, 0, sizeof(size_t) * ((1 << SHARD_BITS) + 1) );
+        for( i = 0; i < C->n; i++ ) {
+            tmp[i].h = segment_hash( C->seqs + 2 * nw * i, masks + s * nw, nw );
+            tmp[i].i = i;
+            shard_start[(tmp[i].h >> (64 - SHARD_BITS)) + 1]++;
+        }
+        for( i = 0; i < (1 << SHARD_BITS); i++ ) shard_start[i + 1] += shard_start[i];
+        for( i = 0; i < C->n; i++ ) {
+            E[shard_start[tmp[i].h >> (64 - SHARD_BITS)]++] = tmp[i];
+        }
+        for( i = (1 << SHARD_BITS); i > 0; i-- ) shard_start[i] = shard_start[i - 1];
+        shard_start[0] = 0;
+
+        J.s = s;
+        J.next_shard = 0;
+
+        for( t = 1; t < n_threads; t++ ) {
+            pthread_create( &threads[t], NULL, segment_worker, &J );
+        }
+        segment_worker( &J );
+        for( t = 1; t < n_threads; t++ ) {
+            pthread_join( threads[t], NULL );
+        }
+    }
+
+    pthread_mutex_destroy( &J.lock );
+    free(threads);
+    free(shard_start);
+    free(tmp);
+    free(E);
+    free(masks);
+}
+
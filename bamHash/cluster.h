@@ -0,0 +1,49 @@
+
+#ifndef BAMHASH_CLUSTER
+#define BAMHASH_CLUSTER
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+/* Neighbour counts over Hamming distance, by pigeonhole: split into d+1
+ * segments, two sequences within distance d agree exactly on at least one
+ * segment. So for each segment the sequences are grouped by its value, and
+ * only those sharing a group are compared. A pair is counted in the first
+ * segment it agrees on, and so exactly once.
+ *
+ * Sequences of k nucleotides over A, C, G, T and N are stored packed, a
+ * pair of words for every 32 bases: two bits a base as in packed.h, and a
+ * word flagging the bases that are N. */
+
+struct cluster_items
+{
+    size_t    n;        /* sequences */
+    size_t    size;     /* room for sequences */
+    size_t    k;        /* nucleotides in each */
+    size_t    n_words;  /* words of 2-bit code, and as many of N flags */
+    uint64_t* seqs;     /* 2 * n_words words per sequence */
+    uint64_t* count;    /* each sequence's own count */
+    uint64_t* add;      /* the sum of its neighbours' counts */
+};
+
+
+/* Make room for up to size sequences of k nucleotides. */
+void cluster_create( struct cluster_items* C, size_t size, size_t k );
+void cluster_destroy( struct cluster_items* C );
+
+/* Add a sequence from ASCII, or from a key packed by packed.h when k <= 32.
+ * Returns false if the sequence is shorter than k or has bases other than
+ * A, C, G, T or N, which can not take part. */
+bool cluster_add_seq( struct cluster_items* C, const char* seq, uint64_t count );
+void cluster_add_key( struct cluster_items* C, uint64_t key, uint64_t count );
+
+/* For each sequence, sum the counts of the others within distance d, on
+ * n_threads threads. */
+void cluster_count( struct cluster_items* C, size_t d, int n_threads );
+
+
+#endif
+
@@ -1,6 +1,7 @@
 
 
 #include "hash.h"
+#include <string.h>
 
 
 #define INITIAL_TABLE_SIZE 128
@@ -77,33 +78,11 @@ uint32_t hash( const void *key, uint32_t length )
 
 
 
-/* Test string equality. (Slightly faster than memcmp, since we don't care about
- * ordering. Note: n is in nibbles! */
-bool memeq( const void* x, const void* y, size_t n )
+/* Reads shorter than the table's read length give shorter keys, so keys are
+ * compared and hashed only up to their end. */
+static inline size_t key_len( const struct table* T, const char* seq )
 {
-    uint8_t* a = (uint8_t*)x;
-    uint8_t* b = (uint8_t*)y;
-
-    if( a == b ) return true;
-
-    while( n >= 2*sizeof(uint32_t) ) {
-        if( *((uint32_t*)a) != *((uint32_t*)b) ) return false;
-        a += sizeof(uint32_t);
-        b += sizeof(uint32_t);
-        n -= 2*sizeof(uint32_t);
-    }
-
-    while( n ) {
-        if( (*a & 0xf) != (*b & 0xf) )   return false;
-        if( --n == 0 ) break;
-        if( (*a & 0xf0) != (*b & 0xf0) ) return false;
-
-        a++;
-        b++;
-        n--;
-    }
-
-    return true;
+    return strnlen( seq, T->read_bytes );
 }
 
 
@@ -157,12 +136,13 @@ void table_inc( struct table* T, char* seq )
 {
     if( T->m == T->max_m ) rehash( T, T->n*2 );
 
-    uint32_t h = hash(seq, T->read_bytes) % T->n;
+    size_t len = key_len( T, seq );
+    uint32_t h = hash(seq, len) % T->n;
 
     struct hashed_value* u = T->A[h];
 
     while(u) {
-        if( memeq( u->seq, seq, T->read_bytes ) ) {
+        if( strncmp( u->seq, seq, T->read_bytes ) == 0 ) {
             u->count++;
             return;
         }
@@ -171,7 +151,7 @@ void table_inc( struct table* T, char* seq )
     }
 
     u = malloc(sizeof(struct hashed_value));
-    u->seq = strdup(seq);
+    u->seq = strndup(seq, len);
 
     u->count = 1;
 
@@ -183,11 +163,11 @@ void table_inc( struct table* T, char* seq )
 
 uint64_t table_get( struct table* T, char* seq )
 {
-    uint32_t h = hash(seq, T->read_bytes) % T->n;
+    uint32_t h = hash(seq, key_len( T, seq )) % T->n;
 
     struct hashed_value* u = T->A[h];
     while(u) {
-        if( memeq( u->seq, seq, T->read_bytes ) ) {
+        if( strncmp( u->seq, seq, T->read_bytes ) == 0 ) {
             return u->count;
         }
 
@@ -204,7 +184,7 @@ bool table_insert_without_copy( struct table* T, struct hashed_value* V )
 {
     if( T->m == T->max_m ) rehash( T, T->n*2 );
 
-    uint32_t h = hash(V->seq,T->read_bytes) % T->n;
+    uint32_t h = hash(V->seq, key_len( T, V->seq )) % T->n;
 
     V->next = T->A[h];
     T->A[h] = V;
@@ -7,7 +7,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <samtools/sam.h>
+#include "samtools/sam.h"
 
 struct hashed_value
 {
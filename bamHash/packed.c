@@ -0,0 +1,195 @@
+#include "packed.h"
+#include <string.h>
+
+
+#define INITIAL_TABLE_BITS 10
+#define MAX_LOAD 0.7
+
+
+/* Fibonacci hashing: the key's bits are already well spread, they just need
+ * mixing into the top bits, which pick the slot. */
+static inline size_t slot( const struct packed_table* T, uint64_t key )
+{
+    return (key * 0x9e3779b97f4a7c15ULL) >> T->shift;
+}
+
+
+static void alloc_table( struct packed_table* T, int bits )
+{
+    T->n = (size_t)1 << bits;
+    T->shift = 64 - bits;
+    T->A = malloc( sizeof(struct packed_value) * T->n );
+    memset( T->A, 0, sizeof(struct packed_value) * T->n );
+    T->m = 0;
+    T->max_m = T->n * MAX_LOAD;
+}
+
+
+void packed_create( struct packed_table* T, size_t read_len )
+{
+    alloc_table( T, INITIAL_TABLE_BITS );
+    T->read_len = read_len;
+}
+
+
+void packed_destroy( struct packed_table* T )
+{
+    free(T->A);
+    T->A = NULL;
+    T->n = T->m = 0;
+}
+
+
+static void rehash( struct packed_table* T )
+{
+    struct packed_value* A = T->A;
+    size_t n = T->n, m = T->m, i, j;
+
+    alloc_table( T, 64 - T->shift + 1 );
+    T->m = m;
+
+    for( i = 0; i < n; i++ ) {
+        if( A[i].count == 0 ) continue;
+
+        j = slot( T, A[i].key );
+        while( T->A[j].count ) j = (j + 1) & (T->n - 1);
+        T->A[j] = A[i];
+    }
+
+    free(A);
+}
+
+
+void packed_inc( struct packed_table* T, uint64_t key )
+{
+    if( T->m == T->max_m ) rehash(T);
+
+    size_t i = slot( T, key );
+    while( T->A[i].count ) {
+        if( T->A[i].key == key ) {
+            T->A[i].count++;
+            return;
+        }
+        i = (i + 1) & (T->n - 1);
+    }
+
+    T->A[i].key   = key;
+    T->A[i].count = 1;
+    T->m++;
+}
+
+
+uint64_t packed_get( const struct packed_table* T, uint64_t key )
+{
+    size_t i = slot( T, key );
+    while( T->A[i].count ) {
+        if( T->A[i].key == key ) return T->A[i].count;
+        i = (i + 1) & (T->n - 1);
+    }
+
+    return 0;
+}
+
+
+static int comp_packed_value( const void* x, const void* y )
+{
+    const struct packed_value* a = x;
+    const struct packed_value* b = y;
+
+    if( a->count > b->count ) return -1;
+    if( a->count < b->count ) return 1;
+    return 0;
+}
+
+
+void packed_sort_by_count( struct packed_table* T )
+{
+    size_t i, k;
+    for( i = 0, k = 0; i < T->n; i++ ) {
+        if( T->A[i].count ) T->A[k++] = T->A[i];
+    }
+
+    qsort( T->A, T->m, sizeof(struct packed_value), comp_packed_value );
+}
+
+
+
+/* Two nt16 codes a byte map to four bits of key, with 0x10 or 0x20 set if
+ * the first or second is not one of A, C, G or T. */
+static uint8_t nt16_byte[256];
+static bool    nt16_byte_ready = false;
+
+static void nt16_byte_init()
+{
+    /* nt16 codes A=1, C=2, G=4, T=8 */
+    static const int8_t code[16] =
+        { -1, 0, 1, -1, 2, -1, -1, -1, 3, -1, -1, -1, -1, -1, -1, -1 };
+
+    int x, hi, lo;
+    for( x = 0; x < 256; x++ ) {
+        hi = code[x >> 4];
+        lo = code[x & 0xf];
+        nt16_byte[x] = (hi < 0 ? 0x10 : hi << 2) | (lo < 0 ? 0x20 : lo);
+    }
+
+    nt16_byte_ready = true;
+}
+
+
+bool nt16_pack( const uint8_t* seq, size_t n, uint64_t* key_ )
+{
+    if( !nt16_byte_ready ) nt16_byte_init();
+
+    uint64_t key = 0;
+    uint8_t  bad = 0, x;
+    size_t i;
+
+    /* a byte at a time, two bases */
+    for( i = 0; i < n / 2; i++ ) {
+        x = nt16_byte[seq[i]];
+        key = (key << 4) | (x & 0xf);
+        bad |= x;
+    }
+
+    if( n & 1 ) {
+        x = nt16_byte[seq[i]];
+        key = (key << 2) | ((x >> 2) & 0x3);
+        bad |= x & 0x10;
+    }
+
+    *key_ = key;
+    return (bad & 0x30) == 0;
+}
+
+
+bool seq_pack( const char* seq, size_t n, uint64_t* key_ )
+{
+    uint64_t key = 0;
+    size_t i;
+
+    for( i = 0; i < n; i++ ) {
+        key <<= 2;
+        switch( seq[i] ) {
+            case 'A':              break;
+            case 'C': key |= 1;    break;
+            case 'G': key |= 2;    break;
+            case 'T': key |= 3;    break;
+            default:  return false;
+        }
+    }
+
+    *key_ = key;
+    return true;
+}
+
+
+void seq_unpack( uint64_t key, size_t n, char* seq )
+{
+    size_t i;
+    for( i = 0; i < n; i++ ) {
+        seq[n - 1 - i] = "ACGT"[key & 0x3];
+        key >>= 2;
+    }
+    seq[n] = '\0';
+}
+
@@ -0,0 +1,59 @@
+
+#ifndef BAMHASH_PACKED
+#define BAMHASH_PACKED
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+/* Sequences of up to 32 nucleotides, packed two bits a base (A=0, C=1, G=2,
+ * T=3), first base in the highest bits, counted in an open-addressing
+ * table. Key and count share a slot, so a lookup is one memory access in
+ * the common case. Sequences with any other base can not be packed, and
+ * are left to the caller to count some other way. */
+
+#define PACKED_MAX_LEN 32
+
+
+struct packed_value
+{
+    uint64_t key;
+    uint64_t count; /* 0 if the slot is empty */
+};
+
+
+struct packed_table
+{
+    struct packed_value* A; /* table proper */
+    size_t n;               /* table size, a power of two */
+    size_t m;               /* hashed items */
+    size_t max_m;           /* max hashed items before rehash */
+    int    shift;           /* 64 - log2(n) */
+    size_t read_len;        /* nucleotides in a key */
+};
+
+
+void packed_create( struct packed_table* T, size_t read_len );
+void packed_destroy( struct packed_table* T );
+
+void     packed_inc( struct packed_table*, uint64_t key );
+uint64_t packed_get( const struct packed_table*, uint64_t key );
+
+/* Move the items to the front of the table, sorted by decreasing count. The
+ * table can only be destroyed after this. */
+void packed_sort_by_count( struct packed_table* T );
+
+
+/* Pack the first n nucleotides of a BAM-encoded (nt16) sequence straight,
+ * without going through ASCII. Returns false if any is not A, C, G or T. */
+bool nt16_pack( const uint8_t* seq, size_t n, uint64_t* key );
+
+/* Pack or unpack n nucleotides of ASCII. */
+bool seq_pack( const char* seq, size_t n, uint64_t* key );
+void seq_unpack( uint64_t key, size_t n, char* seq );
+
+
+#endif
+
@@ -17,76 +17,549 @@
 #include <string.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <pthread.h>
 #include "samtools/sam.h"
+#include "samtools/kstring.h"
+#include "coverage.h"
+#include "bigwig.h"
 
 
 
-/* I. Run length encoding of an array, to covert the coverage array to bedGraph. */
-void print_rle( uint32_t* A, size_t n, const char* chrom )
+/* I. An output counts the reads of one strand, or of both, in one of the
+ * input files or in all of them, and writes their coverage, or their starts,
+ * as bedGraph lines or into a bigWig file. Every record is read once and
+ * handed to each output that counts it. */
+
+typedef struct {
+    uint32_t start, end, depth;
+} run_t;
+
+typedef struct {
+    char        strand;  /* '+', '-', or '*' for both */
+    bool        starts;
+    int         file;    /* the input file counted, or -1 for all of them */
+    const char* fn;      /* "-" for standard output */
+    bool        bigwig;
+    FILE*       f;
+    bigwig*     bw;
+
+    /* the sequential pass */
+    coverage*   C;
+    int32_t     tid;     /* the chromosome being counted, or -1 */
+
+    /* writing slices */
+    run_t       open;
+    bool        printing;
+} output_t;
+
+
+bam_header_t* header;
+output_t*     outputs;
+int           n_outputs;
+
+
+bool output_counts( const output_t* o, const bam1_t* b, int file )
+{
+    if( o->file >= 0 && o->file != file ) return false;
+    if( o->strand == '+' && bam1_strand(b) == 1 ) return false;
+    if( o->strand == '-' && bam1_strand(b) == 0 ) return false;
+    return true;
+}
+
+
+void write_run( output_t* o, int32_t tid, uint32_t start, uint32_t end, uint32_t depth )
 {
-    size_t i,j;
-    uint32_t k;
+    if( o->bw == NULL ) {
+        fprintf( o->f, "%s\t%u\t%u\t%u\n", header->target_name[tid], start, end, depth );
+    }
+    /* bases without coverage are left out of a bigWig file */
+    else if( depth > 0 ) bigwig_add( o->bw, tid, start, end, depth );
+}
 
-    i = 0;
 
-    while( i < n ) {
-        j = i;
-        k = A[i];
-        while( j < n && A[j] == k ) j++;
+void print_run( uint32_t start, uint32_t end, uint32_t depth, void* data )
+{
+    output_t* o = data;
+    write_run( o, o->tid, start, end, depth );
+}
 
-        printf( "%s\t%d\t%d\t%d\n", chrom, i, j, k );
 
-        i = j;
+output_t* add_output( const char* fn, bool bigwig, char strand, bool starts, int file )
+{
+    outputs = realloc( outputs, (n_outputs + 1) * sizeof(output_t) );
+    if( outputs == NULL ) {
+        fprintf( stderr, "Error: out of memory.\n" );
+        exit(1);
     }
+
+    output_t* o = &outputs[n_outputs++];
+    memset( o, 0, sizeof(output_t) );
+    o->fn     = fn;
+    o->bigwig = bigwig;
+    o->strand = strand;
+    o->starts = starts;
+    o->file   = file;
+    o->tid    = -1;
+    return o;
 }
 
 
-void print_usage()
+/* An output spec is [WHAT=]FILE, where WHAT lists, separated by commas, '+'
+ * or '-' for one strand, 'starts', and the number of an input file. */
+void parse_output( char* spec, int n_files )
 {
-    fprintf( stderr,
-            "Usage: bamToBedGraph [options] in.bam\n"
-            "Covert a BAM file to a Bed Graph file.\n\n"
-            "Options:\n"
-            "  -t, --starts               Plot read starts rather than coverage.\n"
-            "  -s, --strand=STRAND        Where STRAND is '+' or '-'. Count only reads aligned\n"
-            "                             to this strand. (By default reads on both strands\n"
-            "                             are counted.)\n"
-           );
+    char strand = '*';
+    bool starts = false;
+    int  file = -1;
+    char *fn, *what, *next;
+    size_t n;
+
+    fn = strchr( spec, '=' );
+    if( fn == NULL ) fn = spec;
+    else {
+        *fn++ = '\0';
+        for( what = spec; what != NULL; what = next ) {
+            next = strchr( what, ',' );
+            if( next != NULL ) *next++ = '\0';
+
+            if(      strcmp( what, "+" ) == 0 || strcmp( what, "plus" ) == 0 )  strand = '+';
+            else if( strcmp( what, "-" ) == 0 || strcmp( what, "minus" ) == 0 ) strand = '-';
+            else if( strcmp( what, "starts" ) == 0 ) starts = true;
+            else if( what[0] >= '1' && what[0] <= '9' && atoi( what ) <= n_files ) {
+                file = atoi( what ) - 1;
+            }
+            else {
+                fprintf( stderr, "Error: Invalid output: %s\n", what );
+                exit(1);
+            }
+        }
+    }
+
+    n = strlen( fn );
+    add_output( fn, (n > 3 && strcasecmp( fn + n - 3, ".bw" ) == 0) ||
+                    (n > 7 && strcasecmp( fn + n - 7, ".bigwig" ) == 0),
+                strand, starts, file );
+}
+
+
+void open_output( output_t* o )
+{
+    if( o->bigwig ) {
+        o->bw = bigwig_open( o->fn, header->n_targets, header->target_name, header->target_len );
+    }
+    else if( strcmp( o->fn, "-" ) == 0 ) o->f = stdout;
+    else o->f = fopen( o->fn, "w" );
+
+    if( o->f == NULL && o->bw == NULL ) {
+        fprintf( stderr, "Error: Can't open file '%s'.\n", o->fn );
+        exit(1);
+    }
 }
 
 
-void count_read( bam1_t* b, uint32_t* A, size_t n )
+void close_output( output_t* o )
 {
-    uint32_t* cigar = bam1_cigar(b);
+    int ret = 0;
 
-    int32_t pos = b->core.pos;
+    if( o->bw != NULL ) ret = bigwig_close( o->bw );
+    else if( o->f != stdout ) ret = fclose( o->f );
+    else ret = fflush( o->f );
 
-    size_t i, j;
-    uint8_t  op;
-    uint32_t len;
+    if( ret != 0 ) {
+        fprintf( stderr, "Error: Can't write file '%s'.\n", o->fn );
+        exit(1);
+    }
+}
 
-    for( i = 0; i < b->core.n_cigar; i++ ) {
-        op  = cigar[i] & BAM_CIGAR_MASK;
-        len = cigar[i] >> BAM_CIGAR_SHIFT;
 
-        switch( op ) {
-            case BAM_CMATCH:
-                for( j = 0; j < len; j++ ) A[pos++]++;
-                break;
-            case BAM_CDEL:
-            case BAM_CREF_SKIP:
-                pos += len;
-                break;
+/* II. Without an index, the input files are read through once, merged by
+ * position, and each output counts one chromosome at a time. */
 
-            case BAM_CSOFT_CLIP:
-            case BAM_CHARD_CLIP:
-            /* note: insertions are not plotted, because there is no reasonable
-             * way to do so. */
-            case BAM_CINS:
-            default:
-                break;
+void run_sequential( samfile_t** in, int n_files, bool stream )
+{
+    bam1_t** b = malloc( n_files * sizeof(bam1_t*) );
+    bool* has = malloc( n_files * sizeof(bool) );
+    uint64_t key, min_key;
+    int i, j, k;
+
+    for( i = 0; i < n_files; i++ ) {
+        b[i] = bam_init1();
+        has[i] = samread( in[i], b[i] ) > 0;
+    }
+
+    for( j = 0; j < n_outputs; j++ ) outputs[j].C = create_coverage();
+
+    while( true ) {
+        /* the next record by position; unplaced reads come last */
+        for( i = -1, min_key = UINT64_MAX, k = 0; k < n_files; k++ ) {
+            if( !has[k] ) continue;
+            key = (uint64_t) (uint32_t) b[k]->core.tid << 32 | (uint32_t) b[k]->core.pos;
+            if( i < 0 || key < min_key ) {
+                i = k;
+                min_key = key;
+            }
+        }
+        if( i < 0 ) break;
+
+        if( b[i]->core.tid >= 0 ) {
+            for( j = 0; j < n_outputs; j++ ) {
+                output_t* o = &outputs[j];
+                if( !output_counts( o, b[i], i ) ) continue;
+
+                if( b[i]->core.tid != o->tid ) {
+                    if( o->tid != -1 ) coverage_runs( o->C, print_run, o );
+
+                    o->tid = b[i]->core.tid;
+                    if( stream ) coverage_start_stream( o->C, header->target_len[o->tid],
+                                                        print_run, o );
+                    else         coverage_start( o->C, header->target_len[o->tid] );
+                }
+
+                if( !o->starts ) coverage_add_read( o->C, b[i] );
+                else             coverage_add_pos( o->C, b[i]->core.pos );
+            }
         }
+
+        has[i] = samread( in[i], b[i] ) > 0;
+    }
+
+    for( j = 0; j < n_outputs; j++ ) {
+        if( outputs[j].tid != -1 ) coverage_runs( outputs[j].C, print_run, &outputs[j] );
+        destroy_coverage( outputs[j].C );
     }
+
+    for( i = 0; i < n_files; i++ ) bam_destroy1( b[i] );
+    free(b);
+    free(has);
+}
+
+
+/* III. With an index, the genome is cut into slices of at most SLICE_LEN
+ * bases, and each slice is counted on its own by a pool of threads. Slices
+ * are written out in header order as they finish. */
+
+#define SLICE_LEN (8 << 20)
+
+/* the runs of one output over one slice */
+typedef struct {
+    output_t* o;
+    int32_t   tid;
+    bool      has_reads;
+
+    /* The first and last runs are kept apart, to be merged with those of the
+     * neighbouring slices. The runs between are printed into body, or for a
+     * bigWig file stored there as run_t. */
+    size_t    n_runs;
+    run_t     first, last;
+    kstring_t body;
+} piece_t;
+
+typedef struct {
+    int32_t     tid;
+    uint32_t    beg, end;
+    bool        final;  /* last slice of the chromosome */
+    bool        done;
+    piece_t*    pieces; /* one for each output */
+} slice_t;
+
+
+typedef struct {
+    char**              bam_fns;
+    bam_index_t**       idx;
+    int                 n_files;
+
+    slice_t* slices;
+    size_t   n_slices;
+    size_t   next;     /* next slice to count */
+    size_t   written;  /* slices written out so far */
+    size_t   window;   /* slices counted ahead of the writer at most */
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} pool_t;
+
+
+/* what each thread has of its own */
+typedef struct {
+    bamFile*    f;
+    bam1_t**    b;
+    bool*       has;
+    bam_iter_t* iter;
+    coverage**  C;
+} worker_t;
+
+
+void collect_run( uint32_t start, uint32_t end, uint32_t depth, void* data )
+{
+    piece_t* p = data;
+    run_t r = { start, end, depth };
+
+    if( p->n_runs == 0 ) p->first = r;
+    else {
+        if( p->n_runs > 1 ) {
+            if( p->o->bw == NULL ) {
+                ksprintf( &p->body, "%s\t%u\t%u\t%u\n", header->target_name[p->tid],
+                          p->last.start, p->last.end, p->last.depth );
+            }
+            else kputsn( (const char*) &p->last, sizeof(run_t), &p->body );
+        }
+        p->last = r;
+    }
+    p->n_runs++;
+}
+
+
+void count_slice( pool_t* P, slice_t* s, worker_t* W )
+{
+    int i, j, k;
+
+    /* reads lying past the end of the chromosome still count as reads */
+    for( k = 0; k < P->n_files; k++ ) {
+        W->iter[k] = bam_iter_query( P->idx[k], s->tid, s->beg, s->final ? 1 << 29 : s->end );
+        W->has[k] = bam_iter_read( W->f[k], W->iter[k], W->b[k] ) >= 0;
+    }
+
+    for( j = 0; j < n_outputs; j++ ) {
+        coverage_start_range( W->C[j], s->beg, s->end, collect_run, &s->pieces[j] );
+    }
+
+    while( true ) {
+        for( i = -1, k = 0; k < P->n_files; k++ ) {
+            if( W->has[k] && (i < 0 || W->b[k]->core.pos < W->b[i]->core.pos) ) i = k;
+        }
+        if( i < 0 ) break;
+
+        for( j = 0; j < n_outputs; j++ ) {
+            if( !output_counts( &outputs[j], W->b[i], i ) ) continue;
+
+            s->pieces[j].has_reads = true;
+
+            if( !outputs[j].starts ) coverage_add_read( W->C[j], W->b[i] );
+            else                     coverage_add_pos( W->C[j], W->b[i]->core.pos );
+        }
+
+        W->has[i] = bam_iter_read( W->f[i], W->iter[i], W->b[i] ) >= 0;
+    }
+
+    for( j = 0; j < n_outputs; j++ ) coverage_runs( W->C[j], collect_run, &s->pieces[j] );
+    for( k = 0; k < P->n_files; k++ ) bam_iter_destroy( W->iter[k] );
+}
+
+
+void* slice_worker( void* arg )
+{
+    pool_t* P = arg;
+    worker_t W;
+    size_t i;
+    int k;
+
+    W.f    = malloc( P->n_files * sizeof(bamFile) );
+    W.b    = malloc( P->n_files * sizeof(bam1_t*) );
+    W.has  = malloc( P->n_files * sizeof(bool) );
+    W.iter = malloc( P->n_files * sizeof(bam_iter_t) );
+    W.C    = malloc( n_outputs * sizeof(coverage*) );
+
+    for( k = 0; k < P->n_files; k++ ) {
+        W.f[k] = bam_open( P->bam_fns[k], "r" );
+        if( W.f[k] == NULL ) {
+            fprintf( stderr, "Error: Can't open file '%s'.\n", P->bam_fns[k] );
+            exit(1);
+        }
+        W.b[k] = bam_init1();
+    }
+
+    for( k = 0; k < n_outputs; k++ ) W.C[k] = create_coverage();
+
+    while( true ) {
+        pthread_mutex_lock( &P->lock );
+        while( P->next < P->n_slices && P->next >= P->written + P->window ) {
+            pthread_cond_wait( &P->cond, &P->lock );
+        }
+        i = P->next++;
+        pthread_mutex_unlock( &P->lock );
+
+        if( i >= P->n_slices ) break;
+
+        count_slice( P, &P->slices[i], &W );
+
+        pthread_mutex_lock( &P->lock );
+        P->slices[i].done = true;
+        pthread_cond_broadcast( &P->cond );
+        pthread_mutex_unlock( &P->lock );
+    }
+
+    for( k = 0; k < n_outputs; k++ ) destroy_coverage( W.C[k] );
+    for( k = 0; k < P->n_files; k++ ) {
+        bam_destroy1( W.b[k] );
+        bam_close( W.f[k] );
+    }
+    free(W.f);
+    free(W.b);
+    free(W.has);
+    free(W.iter);
+    free(W.C);
+    return NULL;
+}
+
+
+/* Write a piece, merging its first run into the one left open by the slice
+ * before. As in a sequential pass, chromosomes without reads are left out:
+ * until the first slice with reads, everything is one run of depth zero. */
+void write_piece( piece_t* p, uint32_t beg )
+{
+    output_t* o = p->o;
+    run_t r;
+
+    if( !o->printing ) {
+        if( !p->has_reads ) return;
+        o->printing = true;
+        o->open.start = o->open.end = o->open.depth = 0;
+        if( beg > 0 ) o->open.end = beg;
+    }
+
+    if( p->n_runs == 0 ) return;
+
+    r = p->first;
+    if( o->open.end > o->open.start ) {
+        if( o->open.depth == r.depth ) r.start = o->open.start;
+        else write_run( o, p->tid, o->open.start, o->open.end, o->open.depth );
+    }
+
+    if( p->n_runs == 1 ) {
+        o->open = r;
+        return;
+    }
+
+    write_run( o, p->tid, r.start, r.end, r.depth );
+    if( o->bw == NULL ) fwrite( p->body.s, 1, p->body.l, o->f );
+    else {
+        const run_t* body = (const run_t*) p->body.s;
+        size_t i, n = p->body.l / sizeof(run_t);
+        for( i = 0; i < n; i++ ) write_run( o, p->tid, body[i].start, body[i].end, body[i].depth );
+    }
+    o->open = p->last;
+}
+
+
+void run_parallel( char** bam_fns, bam_index_t** idx, int n_files, int n_threads )
+{
+    pool_t P;
+    int32_t tid;
+    uint32_t beg;
+    size_t i;
+    int j, k;
+
+    memset( &P, 0, sizeof(pool_t) );
+    P.bam_fns = bam_fns;
+    P.idx     = idx;
+    P.n_files = n_files;
+    P.window  = 4 * n_threads;
+
+    for( tid = 0; tid < header->n_targets; tid++ ) {
+        P.n_slices += header->target_len[tid] == 0 ? 1 :
+                      (header->target_len[tid] + SLICE_LEN - 1) / SLICE_LEN;
+    }
+
+    P.slices = calloc( P.n_slices, sizeof(slice_t) );
+    piece_t* pieces = calloc( P.n_slices * n_outputs, sizeof(piece_t) );
+    if( P.slices == NULL || pieces == NULL ) {
+        fprintf( stderr, "Error: out of memory.\n" );
+        exit(1);
+    }
+
+    for( tid = 0, i = 0; tid < header->n_targets; tid++ ) {
+        beg = 0;
+        do {
+            P.slices[i].tid    = tid;
+            P.slices[i].beg    = beg;
+            P.slices[i].end    = header->target_len[tid] - beg > SLICE_LEN ?
+                                 beg + SLICE_LEN : header->target_len[tid];
+            P.slices[i].pieces = pieces + i * n_outputs;
+            for( j = 0; j < n_outputs; j++ ) {
+                P.slices[i].pieces[j].o   = &outputs[j];
+                P.slices[i].pieces[j].tid = tid;
+            }
+            beg = P.slices[i].end;
+            P.slices[i++].final = beg >= header->target_len[tid];
+        } while( beg < header->target_len[tid] );
+    }
+
+    pthread_mutex_init( &P.lock, NULL );
+    pthread_cond_init( &P.cond, NULL );
+
+    pthread_t* threads = malloc( n_threads * sizeof(pthread_t) );
+    for( k = 0; k < n_threads; k++ ) {
+        if( pthread_create( &threads[k], NULL, slice_worker, &P ) != 0 ) {
+            fprintf( stderr, "Error: Can't start thread.\n" );
+            exit(1);
+        }
+    }
+
+    for( i = 0; i < P.n_slices; i++ ) {
+        slice_t* s = &P.slices[i];
+
+        pthread_mutex_lock( &P.lock );
+        while( !s->done ) pthread_cond_wait( &P.cond, &P.lock );
+        pthread_mutex_unlock( &P.lock );
+
+        for( j = 0; j < n_outputs; j++ ) {
+            output_t* o = &outputs[j];
+
+            if( s->beg == 0 ) o->printing = false;
+            write_piece( &s->pieces[j], s->beg );
+            if( o->printing && s->final && o->open.end > o->open.start ) {
+                write_run( o, s->tid, o->open.start, o->open.end, o->open.depth );
+            }
+
+            free( s->pieces[j].body.s );
+            s->pieces[j].body.s = NULL;
+        }
+
+        pthread_mutex_lock( &P.lock );
+        P.written = i + 1;
+        pthread_cond_broadcast( &P.cond );
+        pthread_mutex_unlock( &P.lock );
+    }
+
+    for( k = 0; k < n_threads; k++ ) pthread_join( threads[k], NULL );
+    free(threads);
+
+    pthread_cond_destroy( &P.cond );
+    pthread_mutex_destroy( &P.lock );
+    free(pieces);
+    free(P.slices);
+}
+
+
+void print_usage()
+{
+    fprintf( stderr,
+            "Usage: bamToBedGraph [options] in.bam [in2.bam ...]\n"
+            "Covert BAM files to Bed Graph files.\n\n"
+            "Options:\n"
+            "  -t, --starts               Plot read starts rather than coverage.\n"
+            "  -s, --strand=STRAND        Where STRAND is '+' or '-'. Count only reads aligned\n"
+            "                             to this strand. (By default reads on both strands\n"
+            "                             are counted.)\n"
+            "  -@, --threads=N            Use N threads. If the BAM files are indexed, slices\n"
+            "                             of the genome are counted in parallel; otherwise\n"
+            "                             the threads decompress the files.\n"
+            "  -S, --stream               Keep only the coverage of reads still open in\n"
+            "                             memory, rather than whole chromosomes. Needs\n"
+            "                             input sorted by coordinate.\n"
+            "  -b, --bigwig=FILE          Write a bigWig file rather than a bedGraph. Bases\n"
+            "                             without coverage are left out.\n"
+            "  -o, --output=[WHAT=]FILE   Write an output to FILE. May be given several times,\n"
+            "                             and all outputs are made in one pass over the input.\n"
+            "                             WHAT is a comma separated list of '+' or '-' to\n"
+            "                             count one strand, 'starts' to plot read starts, and\n"
+            "                             N to count only the N-th input file rather than all\n"
+            "                             of them. FILE ending in .bw is written as bigWig;\n"
+            "                             '-' is the standard output.\n\n"
+            "Without -o, a single output is written to the standard output, or with -b to\n"
+            "a bigWig file, counting as -t and -s say. Several input files must be sorted\n"
+            "by coordinate, have the same reference sequences, and imply -S.\n"
+           );
 }
 
 
@@ -94,6 +567,12 @@ int main( int argc, char* argv[] )
 {
     char strand = '*';
     bool starts = false;
+    int  n_threads = 1;
+    bool stream = false;
+    const char* bigwig_fn = NULL;
+    char** specs = NULL;
+    int    n_specs = 0;
+    int    i, j;
 
 
     /* 1. Parse Args */
@@ -101,11 +580,15 @@ int main( int argc, char* argv[] )
     static struct option long_options[] = {
         {"starts", no_argument, 0, 0},
         {"strand", required_argument, 0, 0},
+        {"threads", required_argument, 0, 0},
+        {"stream", no_argument, 0, 0},
+        {"bigwig", required_argument, 0, 0},
+        {"output", required_argument, 0, 0},
         {0,0,0,0} };
 
     int c, option_index;
     do {
-        c = getopt_long( argc, argv, "ts:", long_options, &option_index );
+        c = getopt_long( argc, argv, "ts:@:Sb:o:", long_options, &option_index );
 
         if( c == 's' || (c == 0 && option_index == 1) ) {
             strand = optarg[0];
@@ -117,6 +600,19 @@ int main( int argc, char* argv[] )
         else if( c == 't' || (c == 0 && option_index == 0) ) {
             starts = true;
         }
+        else if( c == '@' || (c == 0 && option_index == 2) ) {
+            n_threads = atoi(optarg);
+        }
+        else if( c == 'S' || (c == 0 && option_index == 3) ) {
+            stream = true;
+        }
+        else if( c == 'b' || (c == 0 && option_index == 4) ) {
+            bigwig_fn = optarg;
+        }
+        else if( c == 'o' || (c == 0 && option_index == 5) ) {
+            specs = realloc( specs, (n_specs + 1) * sizeof(char*) );
+            specs[n_specs++] = optarg;
+        }
         else if( c == '?' ) {
             print_usage();
             exit(1);
@@ -129,54 +625,82 @@ int main( int argc, char* argv[] )
         exit(1);
     }
 
-    char* bam_fn   = argv[optind];
-
+    char** bam_fns = argv + optind;
+    int    n_files = argc - optind;
 
-    samfile_t* bam_f = samopen( bam_fn, "rb", NULL );
+    if( n_files > 1 ) stream = true;
 
-    if( bam_f == NULL ) {
-        fprintf( stderr, "Error: Can't open file '%s'.\n", bam_fn );
-        exit(1);
+    if( bigwig_fn != NULL || n_specs == 0 ) {
+        add_output( bigwig_fn != NULL ? bigwig_fn : "-", bigwig_fn != NULL, strand, starts, -1 );
     }
+    for( i = 0; i < n_specs; i++ ) parse_output( specs[i], n_files );
 
-    bam1_t* b = bam_init1();
+    for( i = 0; i < n_outputs; i++ ) {
+        for( j = 0; j < i; j++ ) {
+            if( strcmp( outputs[i].fn, outputs[j].fn ) == 0 ) {
+                fprintf( stderr, "Error: Two outputs go to '%s'.\n", outputs[i].fn );
+                exit(1);
+            }
+        }
+    }
 
-    int32_t curr_tid = -1;
-    uint32_t* A = NULL;
-    size_t    n = 0;
 
-    while( samread( bam_f, b ) > 0 ) {
-        if( strand == '+' && bam1_strand(b) == 1 ) continue;
-        if( strand == '-' && bam1_strand(b) == 0 ) continue;
+    /* 2. Open the inputs, which must all have the same reference sequences */
 
-        if( b->core.tid != curr_tid ) {
-            if( curr_tid != -1 ) {
-                print_rle( A, n, bam_f->header->target_name[curr_tid] );
-                free(A);
-            }
+    samfile_t** in = malloc( n_files * sizeof(samfile_t*) );
 
-            curr_tid = b->core.tid;
+    for( i = 0; i < n_files; i++ ) {
+        in[i] = samopen( bam_fns[i], "rb", NULL );
 
-            n = bam_f->header->target_len[curr_tid];
-            A = calloc( n, sizeof(uint32_t) );
-            memset( A, 0, n*sizeof(uint32_t) );
+        if( in[i] == NULL ) {
+            fprintf( stderr, "Error: Can't open file '%s'.\n", bam_fns[i] );
+            exit(1);
+        }
 
+        bool same = in[i]->header->n_targets == in[0]->header->n_targets;
+        for( j = 0; same && j < in[0]->header->n_targets; j++ ) {
+            same = in[i]->header->target_len[j] == in[0]->header->target_len[j] &&
+                   strcmp( in[i]->header->target_name[j], in[0]->header->target_name[j] ) == 0;
         }
+        if( !same ) {
+            fprintf( stderr, "Error: '%s' and '%s' have different reference sequences.\n",
+                     bam_fns[0], bam_fns[i] );
+            exit(1);
+        }
+    }
+
+    header = in[0]->header;
+
+    for( i = 0; i < n_outputs; i++ ) open_output( &outputs[i] );
+
+
+    /* 3. Count */
 
-        if( !starts ) count_read( b, A, n );
-        else          A[b->core.pos]++;
+    bam_index_t** idx = calloc( n_files, sizeof(bam_index_t*) );
+    bool indexed = n_threads > 1;
+
+    for( i = 0; indexed && i < n_files; i++ ) {
+        idx[i] = bam_index_load( bam_fns[i] );
+        indexed = idx[i] != NULL;
+    }
+
+    if( indexed ) run_parallel( bam_fns, idx, n_files, n_threads );
+    else {
+        for( i = 0; i < n_files; i++ ) samthreads( in[i], n_threads, 0 );
+        run_sequential( in, n_files, stream );
     }
 
-    if( curr_tid != -1 ) {
-        print_rle( A, n, bam_f->header->target_name[curr_tid] );
-        free(A);
+    for( i = 0; i < n_files; i++ ) {
+        if( idx[i] != NULL ) bam_index_destroy( idx[i] );
+        samclose( in[i] );
     }
 
-    bam_destroy1(b);
+    for( i = 0; i < n_outputs; i++ ) close_output( &outputs[i] );
 
-    samclose( bam_f );
+    free(idx);
+    free(in);
+    free(specs);
+    free(outputs);
 
     return 0;
 }
-
-
@@ -0,0 +1,594 @@
+/*
+ *                  bigwig
+ *                  ------
+ *                  Write runs of equal value straight to a bigWig file.
+ *
+ */
+
+#include "bigwig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+
+#define BIGWIG_MAGIC 0x888FFC26
+#define BPT_MAGIC    0x78CA8C91  /* chromosome B+ tree */
+#define CIR_MAGIC    0x2468ACE0  /* R-tree over blocks */
+
+#define ITEMS_PER_SLOT 1024  /* runs, or summaries, per compressed block */
+#define BLOCK_SIZE     256   /* children per index node */
+
+/* Zoom levels summarize 256 bases, 1 kb, 4 kb, and so on. The levels are
+ * fixed because runs are only seen once; on closing, levels that do not at
+ * least halve the data of the level below are left out of the header. */
+#define MAX_ZOOMS  10
+#define ZOOM_FIRST 256
+#define ZOOM_STEP  4
+
+#define HEADER_SIZE         64
+#define ZOOM_HEADER_SIZE    24
+#define SUMMARY_SIZE        40
+#define SECTION_HEADER_SIZE 24
+#define ITEM_SIZE           12  /* start, end, value */
+#define RECORD_SIZE         32  /* a zoom summary */
+
+
+/* a compressed block and the range it covers, as kept for the R-tree */
+typedef struct {
+    uint32_t start_tid, start;
+    uint32_t end_tid, end;
+    uint64_t offset, size;
+} block_t;
+
+typedef struct {
+    block_t* v;
+    size_t   n, m;
+} block_list;
+
+
+/* a zoom summary being accumulated */
+typedef struct {
+    uint32_t tid, start, end, valid;
+    double   min, max, sum, sum_sq;
+} summary_t;
+
+typedef struct {
+    uint32_t   reduction;
+    summary_t  cur;
+    bool       open;
+    uint8_t*   buf;     /* packed records not yet written */
+    size_t     n_buf;
+    block_t    bounds;  /* of the records in buf */
+    uint64_t   n_recs;
+    uint64_t   count_offset;
+    uint64_t   index_offset;
+    block_list blocks;
+} zoom_t;
+
+
+struct bigwig_
+{
+    FILE*     f;
+    int32_t   n;
+    char**    names;
+    uint32_t* lens;
+
+    /* the bedGraph section being filled */
+    uint8_t*   sec;
+    size_t     n_sec;
+    block_t    sec_bounds;
+    block_list blocks;
+
+    zoom_t zooms[MAX_ZOOMS];
+
+    uint8_t* zbuf;
+    uLong    zbuf_size;
+    uint32_t max_block;  /* largest block before compression */
+
+    /* over the whole file */
+    uint64_t bases;
+    double   min, max, sum, sum_sq;
+
+    uint64_t chrom_tree_offset;
+    uint64_t data_offset;
+};
+
+
+static void* malloc_or_die( size_t size )
+{
+    void* p = malloc( size );
+    if( p == NULL ) {
+        fprintf( stderr, "Error: out of memory.\n" );
+        exit(1);
+    }
+    return p;
+}
+
+
+static void* realloc_or_die( void* p, size_t size )
+{
+    p = realloc( p, size );
+    if( p == NULL ) {
+        fprintf( stderr, "Error: out of memory.\n" );
+        exit(1);
+    }
+    return p;
+}
+
+
+/* Values are written in native byte order; readers tell it by the magic. */
+static void put( bigwig* B, const void* x, size_t size ) { fwrite( x, 1, size, B->f ); }
+static void put8 ( bigwig* B, uint8_t  x ) { put( B, &x, 1 ); }
+static void put16( bigwig* B, uint16_t x ) { put( B, &x, 2 ); }
+static void put32( bigwig* B, uint32_t x ) { put( B, &x, 4 ); }
+static void put64( bigwig* B, uint64_t x ) { put( B, &x, 8 ); }
+static void putd ( bigwig* B, double   x ) { put( B, &x, 8 ); }
+
+static void put_zeros( bigwig* B, size_t size )
+{
+    static const uint8_t zeros[256];
+    while( size > 0 ) {
+        size_t k = size < sizeof(zeros) ? size : sizeof(zeros);
+        put( B, zeros, k );
+        size -= k;
+    }
+}
+
+static inline uint8_t* pack16( uint8_t* p, uint16_t x ) { memcpy( p, &x, 2 ); return p + 2; }
+static inline uint8_t* pack32( uint8_t* p, uint32_t x ) { memcpy( p, &x, 4 ); return p + 4; }
+static inline uint8_t* packf ( uint8_t* p, float    x ) { memcpy( p, &x, 4 ); return p + 4; }
+
+
+/* Compress a block, append it to the file, and note it for the index. */
+static void write_block( bigwig* B, const uint8_t* data, size_t len,
+                         block_t bounds, block_list* list )
+{
+    uLongf zlen = B->zbuf_size;
+    if( compress( B->zbuf, &zlen, data, len ) != Z_OK ) {
+        fprintf( stderr, "Error: compression failed.\n" );
+        exit(1);
+    }
+
+    bounds.offset = ftello( B->f );
+    bounds.size   = zlen;
+    put( B, B->zbuf, zlen );
+
+    if( len > B->max_block ) B->max_block = len;
+
+    if( list->n == list->m ) {
+        list->m = list->m == 0 ? 1024 : 2 * list->m;
+        list->v = realloc_or_die( list->v, list->m * sizeof(block_t) );
+    }
+    list->v[list->n++] = bounds;
+}
+
+
+static void flush_section( bigwig* B )
+{
+    uint8_t* p = B->sec;
+
+    if( B->n_sec == 0 ) return;
+
+    p = pack32( p, B->sec_bounds.start_tid );
+    p = pack32( p, B->sec_bounds.start );
+    p = pack32( p, B->sec_bounds.end );
+    p = pack32( p, 0 );  /* item step and span: unused for bedGraph */
+    p = pack32( p, 0 );
+    *p++ = 1;            /* bedGraph */
+    *p++ = 0;
+    pack16( p, B->n_sec );
+
+    write_block( B, B->sec, SECTION_HEADER_SIZE + B->n_sec * ITEM_SIZE,
+                 B->sec_bounds, &B->blocks );
+    B->n_sec = 0;
+}
+
+
+static void flush_zoom( bigwig* B, zoom_t* z )
+{
+    if( z->n_buf == 0 ) return;
+    write_block( B, z->buf, z->n_buf * RECORD_SIZE, z->bounds, &z->blocks );
+    z->n_buf = 0;
+}
+
+
+static void push_summary( bigwig* B, zoom_t* z )
+{
+    summary_t* s = &z->cur;
+    uint8_t* p = z->buf + z->n_buf * RECORD_SIZE;
+
+    p = pack32( p, s->tid );
+    p = pack32( p, s->start );
+    p = pack32( p, s->end );
+    p = pack32( p, s->valid );
+    p = packf( p, s->min );
+    p = packf( p, s->max );
+    p = packf( p, s->sum );
+    p = packf( p, s->sum_sq );
+
+    if( z->n_buf == 0 ) {
+        z->bounds.start_tid = s->tid;
+        z->bounds.start     = s->start;
+    }
+    z->bounds.end_tid = s->tid;
+    z->bounds.end     = s->end;
+
+    z->open = false;
+    z->n_recs++;
+    if( ++z->n_buf == ITEMS_PER_SLOT ) flush_zoom( B, z );
+}
+
+
+/* Summaries begin where data begins and span the reduction, or up to the
+ * end of the chromosome; runs crossing their end continue in the next. */
+static void zoom_add( bigwig* B, zoom_t* z, int32_t tid,
+                      uint32_t start, uint32_t end, float value )
+{
+    summary_t* s = &z->cur;
+    uint64_t s_end;
+    uint32_t overlap;
+
+    while( start < end ) {
+        if( !z->open || s->tid != (uint32_t) tid || s->end <= start ) {
+            if( z->open ) push_summary( B, z );
+
+            s_end = (uint64_t) start + z->reduction;
+            if( s_end > B->lens[tid] ) s_end = B->lens[tid];
+            if( s_end <= start )       s_end = end;
+
+            s->tid    = tid;
+            s->start  = start;
+            s->end    = s_end;
+            s->valid  = 0;
+            s->min    = s->max = value;
+            s->sum    = s->sum_sq = 0.0;
+            z->open   = true;
+        }
+
+        overlap = (end < s->end ? end : s->end) - start;
+        s->valid  += overlap;
+        if( value < s->min ) s->min = value;
+        if( value > s->max ) s->max = value;
+        s->sum    += (double) value * overlap;
+        s->sum_sq += (double) value * value * overlap;
+        start += overlap;
+    }
+}
+
+
+void bigwig_add( bigwig* B, int32_t tid, uint32_t start, uint32_t end, float value )
+{
+    uint8_t* p;
+    int i;
+
+    if( end <= start ) return;
+
+    if( B->n_sec == ITEMS_PER_SLOT ||
+        (B->n_sec > 0 && B->sec_bounds.start_tid != (uint32_t) tid) ) {
+        flush_section( B );
+    }
+
+    if( B->n_sec == 0 ) {
+        B->sec_bounds.start_tid = B->sec_bounds.end_tid = tid;
+        B->sec_bounds.start     = start;
+    }
+    B->sec_bounds.end = end;
+
+    p = B->sec + SECTION_HEADER_SIZE + B->n_sec++ * ITEM_SIZE;
+    p = pack32( p, start );
+    p = pack32( p, end );
+    p = packf( p, value );
+
+    if( B->bases == 0 || value < B->min ) B->min = value;
+    if( B->bases == 0 || value > B->max ) B->max = value;
+    B->bases  += end - start;
+    B->sum    += (double) value * (end - start);
+    B->sum_sq += (double) value * value * (end - start);
+
+    for( i = 0; i < MAX_ZOOMS; i++ ) zoom_add( B, &B->zooms[i], tid, start, end, value );
+}
+
+
+
+/* Number of nodes on each level of a tree over n items, with up to b
+ * children per node, leaves first. Returns the number of levels. */
+static int tree_levels( uint64_t n, uint32_t b, uint64_t* nodes )
+{
+    int k = 0;
+    nodes[0] = n == 0 ? 1 : (n + b - 1) / b;
+    while( nodes[k] > 1 ) {
+        nodes[k + 1] = (nodes[k] + b - 1) / b;
+        k++;
+    }
+    return k + 1;
+}
+
+
+static const char** sort_names;
+
+static int cmp_name( const void* a, const void* b )
+{
+    return strcmp( sort_names[*(const int32_t*) a], sort_names[*(const int32_t*) b] );
+}
+
+
+/* The B+ tree mapping chromosome names, in sorted order, to ids (here, the
+ * tid) and lengths. Nodes are written root first, every one padded to the
+ * full block size. */
+static void write_chrom_tree( bigwig* B )
+{
+    uint32_t b = B->n < BLOCK_SIZE ? B->n : BLOCK_SIZE;
+    uint32_t key_size = 1, item_size, node_size;
+    uint64_t nodes[64], level_offset[64], span;
+    int32_t* ix;
+    int32_t i;
+    uint64_t j, c, first, count;
+    int depth, k;
+    char* key;
+
+    if( b == 0 ) b = 1;
+    for( i = 0; i < B->n; i++ ) {
+        if( strlen( B->names[i] ) > key_size ) key_size = strlen( B->names[i] );
+    }
+    item_size = key_size + 8;
+    node_size = 4 + b * item_size;
+
+    ix = malloc_or_die( (B->n + 1) * sizeof(int32_t) );
+    for( i = 0; i < B->n; i++ ) ix[i] = i;
+    sort_names = (const char**) B->names;
+    qsort( ix, B->n, sizeof(int32_t), cmp_name );
+
+    key = malloc_or_die( key_size );
+
+    put32( B, BPT_MAGIC );
+    put32( B, b );
+    put32( B, key_size );
+    put32( B, 8 );
+    put64( B, B->n );
+    put64( B, 0 );
+
+    depth = tree_levels( B->n, b, nodes );
+    level_offset[depth - 1] = ftello( B->f );
+    for( k = depth - 1; k > 0; k-- ) {
+        level_offset[k - 1] = level_offset[k] + nodes[k] * node_size;
+    }
+
+    /* the inner levels: each child is keyed by the first name below it */
+    for( span = 1, k = 1; k < depth; k++ ) span *= b;
+    for( k = depth - 1; k > 0; k-- ) {
+        for( j = 0; j < nodes[k]; j++ ) {
+            first = j * b;
+            count = nodes[k - 1] - first < b ? nodes[k - 1] - first : b;
+
+            put8( B, 0 );
+            put8( B, 0 );
+            put16( B, count );
+            for( c = first; c < first + count; c++ ) {
+                memset( key, 0, key_size );
+                memcpy( key, B->names[ix[c * span]], strlen( B->names[ix[c * span]] ) );
+                put( B, key, key_size );
+                put64( B, level_offset[k - 1] + c * node_size );
+            }
+            put_zeros( B, (b - count) * item_size );
+        }
+        span /= b;
+    }
+
+    for( j = 0; j < nodes[0]; j++ ) {
+        first = j * b;
+        count = B->n - first < b ? B->n - first : b;
+
+        put8( B, 1 );
+        put8( B, 0 );
+        put16( B, count );
+        for( c = first; c < first + count; c++ ) {
+            memset( key, 0, key_size );
+            memcpy( key, B->names[ix[c]], strlen( B->names[ix[c]] ) );
+            put( B, key, key_size );
+            put32( B, ix[c] );
+            put32( B, B->lens[ix[c]] );
+        }
+        put_zeros( B, (b - count) * item_size );
+    }
+
+    free(key);
+    free(ix);
+}
+
+
+/* The R-tree over the blocks of one list, with inner nodes bounding the
+ * range of the blocks below them. Returns where it starts. */
+static uint64_t write_rtree( bigwig* B, const block_list* list )
+{
+    const block_t* v = list->v;
+    uint64_t n = list->n;
+    uint32_t b = BLOCK_SIZE;
+    uint32_t leaf_size = 4 + b * 32, inner_size = 4 + b * 24;
+    uint64_t nodes[64], level_offset[64], span;
+    uint64_t offset = ftello( B->f );
+    uint64_t j, c, first, count, last;
+    int depth, k;
+
+    put32( B, CIR_MAGIC );
+    put32( B, b );
+    put64( B, n );
+    put32( B, n ? v[0].start_tid : 0 );
+    put32( B, n ? v[0].start : 0 );
+    put32( B, n ? v[n - 1].end_tid : 0 );
+    put32( B, n ? v[n - 1].end : 0 );
+    put64( B, n ? v[n - 1].offset + v[n - 1].size : offset );
+    put32( B, ITEMS_PER_SLOT );
+    put32( B, 0 );
+
+    depth = tree_levels( n, b, nodes );
+    level_offset[depth - 1] = ftello( B->f );
+    for( k = depth - 1; k > 0; k-- ) {
+        level_offset[k - 1] = level_offset[k] + nodes[k] * inner_size;
+    }
+
+    for( span = 1, k = 1; k < depth; k++ ) span *= b;
+    for( k = depth - 1; k > 0; k-- ) {
+        for( j = 0; j < nodes[k]; j++ ) {
+            first = j * b;
+            count = nodes[k - 1] - first < b ? nodes[k - 1] - first : b;
+
+            put8( B, 0 );
+            put8( B, 0 );
+            put16( B, count );
+            for( c = first; c < first + count; c++ ) {
+                last = (c + 1) * span < n ? (c + 1) * span - 1 : n - 1;
+                put32( B, v[c * span].start_tid );
+                put32( B, v[c * span].start );
+                put32( B, v[last].end_tid );
+                put32( B, v[last].end );
+                put64( B, level_offset[k - 1] + c * (k > 1 ? inner_size : leaf_size) );
+            }
+            put_zeros( B, (b - count) * 24 );
+        }
+        span /= b;
+    }
+
+    for( j = 0; j < nodes[0]; j++ ) {
+        first = j * b;
+        count = n - first < b ? n - first : b;
+
+        put8( B, 1 );
+        put8( B, 0 );
+        put16( B, count );
+        for( c = first; c < first + count; c++ ) {
+            put32( B, v[c].start_tid );
+            put32( B, v[c].start );
+            put32( B, v[c].end_tid );
+            put32( B, v[c].end );
+            put64( B, v[c].offset );
+            put64( B, v[c].size );
+        }
+        put_zeros( B, (b - count) * 32 );
+    }
+
+    return offset;
+}
+
+
+bigwig* bigwig_open( const char* fn, int32_t n, char** names, const uint32_t* lens )
+{
+    bigwig* B;
+    int i;
+
+    FILE* f = fopen( fn, "wb" );
+    if( f == NULL ) return NULL;
+
+    B = malloc_or_die( sizeof(bigwig) );
+    memset( B, 0, sizeof(bigwig) );
+
+    B->f     = f;
+    B->n     = n;
+    B->names = names;
+    B->lens  = malloc_or_die( (n + 1) * sizeof(uint32_t) );
+    memcpy( B->lens, lens, n * sizeof(uint32_t) );
+
+    B->sec       = malloc_or_die( SECTION_HEADER_SIZE + ITEMS_PER_SLOT * ITEM_SIZE );
+    B->zbuf_size = compressBound( ITEMS_PER_SLOT * RECORD_SIZE );
+    B->zbuf      = malloc_or_die( B->zbuf_size );
+
+    for( i = 0; i < MAX_ZOOMS; i++ ) {
+        B->zooms[i].reduction = i == 0 ? ZOOM_FIRST : B->zooms[i - 1].reduction * ZOOM_STEP;
+        B->zooms[i].buf = malloc_or_die( ITEMS_PER_SLOT * RECORD_SIZE );
+    }
+
+    /* The header, zoom headers and summary are filled in on closing. The
+     * item counts of the full data and of each zoom level come next, also
+     * filled in later, and then the blocks of all of them as they come. */
+    put_zeros( B, HEADER_SIZE + MAX_ZOOMS * ZOOM_HEADER_SIZE + SUMMARY_SIZE );
+
+    B->chrom_tree_offset = ftello( f );
+    write_chrom_tree( B );
+
+    B->data_offset = ftello( f );
+    put64( B, 0 );
+    for( i = 0; i < MAX_ZOOMS; i++ ) {
+        B->zooms[i].count_offset = ftello( f );
+        put32( B, 0 );
+    }
+
+    return B;
+}
+
+
+int bigwig_close( bigwig* B )
+{
+    uint64_t index_offset;
+    zoom_t* kept[MAX_ZOOMS];
+    int i, n_kept = 0;
+    int ret;
+
+    flush_section( B );
+    for( i = 0; i < MAX_ZOOMS; i++ ) {
+        if( B->zooms[i].open ) push_summary( B, &B->zooms[i] );
+        flush_zoom( B, &B->zooms[i] );
+    }
+
+    index_offset = write_rtree( B, &B->blocks );
+
+    for( i = 0; i < MAX_ZOOMS; i++ ) {
+        zoom_t* z = &B->zooms[i];
+        if( z->n_recs == 0 ) break;
+        if( n_kept > 0 && 2 * z->n_recs > kept[n_kept - 1]->n_recs ) break;
+        z->index_offset = write_rtree( B, &z->blocks );
+        kept[n_kept++] = z;
+    }
+
+    put32( B, BIGWIG_MAGIC );
+
+    fseeko( B->f, 0, SEEK_SET );
+    put32( B, BIGWIG_MAGIC );
+    put16( B, 4 );
+    put16( B, n_kept );
+    put64( B, B->chrom_tree_offset );
+    put64( B, B->data_offset );
+    put64( B, index_offset );
+    put16( B, 0 );  /* no bigBed fields */
+    put16( B, 0 );
+    put64( B, 0 );
+    put64( B, HEADER_SIZE + MAX_ZOOMS * ZOOM_HEADER_SIZE );
+    put32( B, B->max_block );
+    put64( B, 0 );
+
+    for( i = 0; i < n_kept; i++ ) {
+        put32( B, kept[i]->reduction );
+        put32( B, 0 );
+        put64( B, kept[i]->count_offset );
+        put64( B, kept[i]->index_offset );
+    }
+
+    fseeko( B->f, HEADER_SIZE + MAX_ZOOMS * ZOOM_HEADER_SIZE, SEEK_SET );
+    put64( B, B->bases );
+    putd( B, B->min );
+    putd( B, B->max );
+    putd( B, B->sum );
+    putd( B, B->sum_sq );
+
+    fseeko( B->f, B->data_offset, SEEK_SET );
+    put64( B, B->blocks.n );
+    for( i = 0; i < MAX_ZOOMS; i++ ) {
+        fseeko( B->f, B->zooms[i].count_offset, SEEK_SET );
+        put32( B, B->zooms[i].n_recs );
+    }
+
+    ret = ferror( B->f ) ? -1 : 0;
+    if( fclose( B->f ) != 0 ) ret = -1;
+
+    for( i = 0; i < MAX_ZOOMS; i++ ) {
+        free( B->zooms[i].buf );
+        free( B->zooms[i].blocks.v );
+    }
+    free( B->blocks.v );
+    free( B->zbuf );
+    free( B->sec );
+    free( B->lens );
+    free( B );
+
+    return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ *                  bigwig
+ *                  ------
+ *                  Write runs of equal value straight to a bigWig file.
+ *
+ *                  The file is written in one pass: runs are packed into
+ *                  compressed bedGraph sections as they arrive, and every
+ *                  zoom level is summarized on the fly into compressed
+ *                  blocks appended alongside them. Only the index entries,
+ *                  one per block, are kept until the R-trees and header
+ *                  are written when the file is closed.
+ *
+ */
+
+#ifndef BAMTOBEDGRAPH_BIGWIG_H
+#define BAMTOBEDGRAPH_BIGWIG_H
+
+#include <stdint.h>
+
+
+typedef struct bigwig_ bigwig;
+
+
+/* Create a bigWig file for the given chromosomes. Returns NULL if the file
+ * can not be opened. */
+bigwig* bigwig_open( const char* fn, int32_t n, char** names, const uint32_t* lens );
+
+/* Add value over [start, end) of chromosome tid. Runs must be added in order
+ * of tid, and of position within a chromosome, and must not overlap. */
+void bigwig_add( bigwig*, int32_t tid, uint32_t start, uint32_t end, float value );
+
+/* Write out what is pending, the indexes and the header, and close the
+ * file. Returns 0, or -1 if writing failed. */
+int bigwig_close( bigwig* );
+
+
+#endif
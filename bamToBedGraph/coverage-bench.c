@@ -0,0 +1,174 @@
+/*
+ *                  coverage-bench
+ *                  --------------
+ *                  Time the difference-array coverage engine against
+ *                  painting every aligned base, on simulated reads.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include "coverage.h"
+
+
+void print_usage()
+{
+    fprintf( stderr,
+            "Usage: coverage-bench [options]\n"
+            "Options:\n"
+            "  -n N     chromosome length (default: 50000000)\n"
+            "  -d D     mean depth of the simulated reads (default: 30)\n"
+           );
+}
+
+
+double now()
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+/* A sorted set of reads of length len, one in ten split by an intron. */
+bam1_t* simulate_reads( size_t n, uint32_t len, double depth, size_t* n_reads )
+{
+    size_t m = (size_t) (depth * n / len);
+    bam1_t* bs = calloc( m, sizeof(bam1_t) );
+    size_t i;
+    uint32_t* cigar;
+
+    for( i = 0; i < m; i++ ) {
+        bs[i].core.tid = 0;
+        bs[i].core.pos = (uint32_t) ((double) i / m * (n - 2 * len));
+        bs[i].core.l_qname = 4;
+        bs[i].data_len = bs[i].m_data = 4 + 3 * sizeof(uint32_t);
+        bs[i].data = calloc( 1, bs[i].m_data );
+        cigar = bam1_cigar(&bs[i]);
+
+        if( i % 10 == 0 ) {
+            bs[i].core.n_cigar = 3;
+            cigar[0] = (len / 2) << BAM_CIGAR_SHIFT | BAM_CMATCH;
+            cigar[1] = (len / 2) << BAM_CIGAR_SHIFT | BAM_CREF_SKIP;
+            cigar[2] = (len - len / 2) << BAM_CIGAR_SHIFT | BAM_CMATCH;
+        }
+        else {
+            bs[i].core.n_cigar = 1;
+            cigar[0] = len << BAM_CIGAR_SHIFT | BAM_CMATCH;
+        }
+    }
+
+    *n_reads = m;
+    return bs;
+}
+
+
+/* What bamToBedGraph did before: one increment per aligned base, then a
+ * run-length pass over the whole array. */
+void paint_read( const bam1_t* b, uint32_t* A )
+{
+    const uint32_t* cigar = bam1_cigar(b);
+    uint32_t pos = b->core.pos;
+    uint32_t i, j, len;
+
+    for( i = 0; i < b->core.n_cigar; i++ ) {
+        len = cigar[i] >> BAM_CIGAR_SHIFT;
+        switch( cigar[i] & BAM_CIGAR_MASK ) {
+            case BAM_CMATCH:
+                for( j = 0; j < len; j++ ) A[pos++]++;
+                break;
+            case BAM_CDEL:
+            case BAM_CREF_SKIP:
+                pos += len;
+                break;
+        }
+    }
+}
+
+
+size_t paint_runs( const uint32_t* A, size_t n, uint64_t* sum )
+{
+    size_t i = 0, j, runs = 0;
+    while( i < n ) {
+        j = i;
+        while( j < n && A[j] == A[i] ) j++;
+        *sum += (uint64_t) A[i] * (j - i);
+        runs++;
+        i = j;
+    }
+    return runs;
+}
+
+
+typedef struct
+{
+    size_t   runs;
+    uint64_t sum;
+} run_totals;
+
+
+void count_run( uint32_t start, uint32_t end, uint32_t depth, void* data )
+{
+    run_totals* t = data;
+    t->runs++;
+    t->sum += (uint64_t) depth * (end - start);
+}
+
+
+int main( int argc, char* argv[] )
+{
+    size_t n = 50000000;
+    double depth = 30;
+    uint32_t lens[] = { 150, 10000 };
+
+    int c;
+    while( (c = getopt( argc, argv, "n:d:" )) != -1 ) {
+        switch( c ) {
+            case 'n': n = strtoul( optarg, NULL, 10 ); break;
+            case 'd': depth = atof( optarg ); break;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    printf( "%-8s %10s %12s %12s %8s\n", "read len", "reads", "painting s", "diff-array s", "speedup" );
+
+    size_t k;
+    for( k = 0; k < sizeof(lens) / sizeof(lens[0]); k++ ) {
+        size_t m, i;
+        bam1_t* bs = simulate_reads( n, lens[k], depth, &m );
+
+        double t0 = now();
+        uint32_t* A = calloc( n, sizeof(uint32_t) );
+        for( i = 0; i < m; i++ ) paint_read( &bs[i], A );
+        uint64_t paint_sum = 0;
+        size_t paint_n = paint_runs( A, n, &paint_sum );
+        free(A);
+        double t_paint = now() - t0;
+
+        t0 = now();
+        coverage* C = create_coverage();
+        coverage_start( C, n );
+        for( i = 0; i < m; i++ ) coverage_add_read( C, &bs[i] );
+        run_totals totals = { 0, 0 };
+        coverage_runs( C, count_run, &totals );
+        destroy_coverage(C);
+        double t_diff = now() - t0;
+
+        if( totals.runs != paint_n || totals.sum != paint_sum ) {
+            fprintf( stderr, "Error: results differ for %u bp reads.\n", lens[k] );
+            return 1;
+        }
+
+        printf( "%-8u %10zu %12.3f %12.3f %7.1fx\n", lens[k], m, t_paint, t_diff, t_paint / t_diff );
+
+        for( i = 0; i < m; i++ ) free( bs[i].data );
+        free(bs);
+    }
+
+    return 0;
+}
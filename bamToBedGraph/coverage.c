@@ -0,0 +1,231 @@
+/*
+ *                  coverage
+ *                  --------
+ *                  Per-base coverage as a difference array.
+ *
+ */
+
+#include "coverage.h"
+#include <stdio.h>
+#include <string.h>
+
+
+static void* calloc_or_die( size_t n, size_t size )
+{
+    void* p = calloc( n, size );
+    if( p == NULL ) {
+        fprintf( stderr, "Error: out of memory.\n" );
+        exit(1);
+    }
+    return p;
+}
+
+
+coverage* create_coverage()
+{
+    coverage* C = calloc_or_die( 1, sizeof(coverage) );
+    return C;
+}
+
+
+void destroy_coverage( coverage* C )
+{
+    free(C->D);
+    free(C->R);
+    free(C);
+}
+
+
+void coverage_start( coverage* C, size_t n )
+{
+    /* D is all zeros here: coverage_runs clears what it reads */
+    if( n + 1 > C->m ) {
+        free(C->D);
+        C->m = n + 1;
+        C->D = calloc_or_die( C->m, sizeof(int32_t) );
+    }
+
+    C->n = n;
+    C->beg = 0;
+    C->stream = false;
+}
+
+
+void coverage_start_stream( coverage* C, size_t n, coverage_run_f f, void* data )
+{
+    coverage_start_range( C, 0, n, f, data );
+}
+
+
+void coverage_start_range( coverage* C, size_t beg, size_t end, coverage_run_f f, void* data )
+{
+    /* R is all zeros here, as after coverage_runs */
+    if( C->R == NULL ) {
+        C->r_mask = 0xffff;
+        C->R = calloc_or_die( C->r_mask + 1, sizeof(int32_t) );
+    }
+
+    C->beg = beg;
+    C->n = end;
+    C->stream = true;
+    C->pending = 0;
+    C->base = C->run_start = beg;
+    C->depth = 0;
+    C->f = f;
+    C->data = data;
+}
+
+
+/* Hand out the runs left of pos, which no later read can reach. */
+static void advance( coverage* C, size_t pos )
+{
+    int32_t* R = C->R;
+    size_t i;
+
+    if( pos < C->base ) {
+        fprintf( stderr, "Error: reads are not sorted by position, "
+                         "which streaming needs.\n" );
+        exit(1);
+    }
+
+    for( i = C->base; i < pos && C->pending > 0; i++ ) {
+        if( R[i & C->r_mask] != 0 ) {
+            if( i > C->run_start ) C->f( C->run_start, i, C->depth, C->data );
+            C->depth += R[i & C->r_mask];
+            R[i & C->r_mask] = 0;
+            C->pending--;
+            C->run_start = i;
+        }
+    }
+
+    /* past the last event, the depth stays as it is */
+    C->base = pos;
+}
+
+
+/* Make room in R for positions up to pos. */
+static void grow_ring( coverage* C, size_t pos )
+{
+    size_t m = C->r_mask + 1, new_m = m, i;
+    while( pos - C->base >= new_m ) new_m *= 2;
+
+    int32_t* R = calloc_or_die( new_m, sizeof(int32_t) );
+    for( i = C->base; i < C->base + m; i++ ) {
+        R[i & (new_m - 1)] = C->R[i & (m - 1)];
+    }
+
+    free(C->R);
+    C->R = R;
+    C->r_mask = new_m - 1;
+}
+
+
+static inline void ring_add( coverage* C, size_t pos, int32_t x )
+{
+    if( pos - C->base > C->r_mask ) grow_ring( C, pos );
+
+    int32_t* d = &C->R[pos & C->r_mask];
+    if( *d == 0 ) C->pending++;
+    *d += x;
+    if( *d == 0 ) C->pending--;
+}
+
+
+static inline void add_block( coverage* C, uint32_t start, uint32_t end )
+{
+    if( start >= C->n || end <= C->beg ) return;
+    if( start < C->beg ) start = C->beg;
+    if( end > C->n ) end = C->n;
+
+    if( C->stream ) {
+        ring_add( C, start, 1 );
+        ring_add( C, end, -1 );
+    }
+    else {
+        C->D[start]++;
+        C->D[end]--;
+    }
+}
+
+
+void coverage_add_read( coverage* C, const bam1_t* b )
+{
+    const uint32_t* cigar = bam1_cigar(b);
+    uint32_t pos = b->core.pos;
+    uint32_t i, len;
+
+    if( C->stream ) advance( C, pos < C->beg ? C->beg : pos < C->n ? pos : C->n );
+
+    for( i = 0; i < b->core.n_cigar; i++ ) {
+        len = cigar[i] >> BAM_CIGAR_SHIFT;
+
+        switch( cigar[i] & BAM_CIGAR_MASK ) {
+            case BAM_CMATCH:
+                add_block( C, pos, pos + len );
+                pos += len;
+                break;
+
+            case BAM_CDEL:
+            case BAM_CREF_SKIP:
+                pos += len;
+                break;
+
+            /* note: insertions are not plotted, because there is no reasonable
+             * way to do so. */
+            default:
+                break;
+        }
+    }
+}
+
+
+void coverage_add_pos( coverage* C, uint32_t pos )
+{
+    if( pos < C->beg || pos >= C->n ) return;
+    if( C->stream ) advance( C, pos );
+    add_block( C, pos, pos + 1 );
+}
+
+
+static void finish_stream( coverage* C, coverage_run_f f, void* data )
+{
+    size_t n = C->n;
+
+    C->f = f;
+    C->data = data;
+    advance( C, n );
+    if( n > C->run_start ) f( C->run_start, n, C->depth, data );
+
+    /* what is left are the -1s at n */
+    C->R[n & C->r_mask] = 0;
+    C->pending = 0;
+    C->n = 0;
+}
+
+
+void coverage_runs( coverage* C, coverage_run_f f, void* data )
+{
+    int32_t* D = C->D;
+    size_t   n = C->n;
+    size_t   i, start = 0;
+    int32_t  depth = 0;
+
+    if( C->stream ) {
+        finish_stream( C, f, data );
+        return;
+    }
+
+    for( i = 0; i < n; i++ ) {
+        if( D[i] != 0 ) {
+            if( i > start ) f( start, i, depth, data );
+            depth += D[i];
+            D[i] = 0;
+            start = i;
+        }
+    }
+
+    if( n > start ) f( start, n, depth, data );
+    D[n] = 0;
+
+    C->n = 0;
+}
@@ -0,0 +1,82 @@
+/*
+ *                  coverage
+ *                  --------
+ *                  Per-base coverage of one chromosome at a time.
+ *
+ *                  Reads are not painted base by base. Each aligned block
+ *                  adds +1 where it starts and -1 just past its end, and a
+ *                  single prefix-sum pass when the chromosome is finished
+ *                  turns those events into depths, handed out directly as
+ *                  runs of equal depth.
+ *
+ *                  In streaming mode, for sorted reads, the differences are
+ *                  kept in a ring buffer spanning only the reads that are
+ *                  still open, and runs left of the current read start are
+ *                  handed out as soon as they are final, so memory depends
+ *                  on the longest read span rather than on the chromosome.
+ *
+ */
+
+#ifndef BAMTOBEDGRAPH_COVERAGE_H
+#define BAMTOBEDGRAPH_COVERAGE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "samtools/bam.h"
+
+
+/* a run [start, end) of bases covered by depth reads */
+typedef void (*coverage_run_f)( uint32_t start, uint32_t end, uint32_t depth, void* data );
+
+
+typedef struct
+{
+    int32_t* D;  /* D[i] = depth(i) - depth(i-1); zero outside of a chromosome */
+    size_t   n;  /* length of the current chromosome, or end of the range */
+    size_t   m;  /* allocated length of D */
+    size_t   beg; /* start of the range; 0 for whole chromosomes */
+
+    /* streaming mode */
+    bool     stream;
+    int32_t* R;         /* ring buffer: D[i] is R[i & r_mask] for base <= i < base + r_mask + 1 */
+    size_t   r_mask;
+    size_t   pending;   /* non-zero entries of R */
+    size_t   base;      /* first position whose run is not final */
+    size_t   run_start; /* the run in progress, [run_start, base) so far */
+    int32_t  depth;
+    coverage_run_f f;
+    void*    data;
+} coverage;
+
+
+coverage* create_coverage();
+
+void destroy_coverage( coverage* );
+
+/* Begin a chromosome of length n. The previous one must have been finished
+ * with coverage_runs. */
+void coverage_start( coverage*, size_t n );
+
+/* Begin a chromosome of length n in streaming mode. Reads must then be
+ * added in order of position; runs are passed to f as soon as no later read
+ * can change them, and coverage_runs passes the rest. */
+void coverage_start_stream( coverage*, size_t n, coverage_run_f f, void* data );
+
+/* Streaming mode for only the bases [beg, end) of a chromosome. Reads may
+ * start left of beg; only their part inside the range is counted, and
+ * coverage_add_pos ignores positions outside of it. */
+void coverage_start_range( coverage*, size_t beg, size_t end, coverage_run_f f, void* data );
+
+/* Count the aligned (M) blocks of a read; deletions and skips are gaps. */
+void coverage_add_read( coverage*, const bam1_t* b );
+
+/* Count one base, e.g. the start of a read. */
+void coverage_add_pos( coverage*, uint32_t pos );
+
+/* Finish the chromosome: call f on each maximal run of equal depth, in
+ * order, covering [0, n), or the range. Leaves the coverage empty. */
+void coverage_runs( coverage*, coverage_run_f f, void* data );
+
+
+#endif
@@ -0,0 +1,1492 @@
+#include <ctype.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include "bam.h"
+#include "khash.h"
+#include "ksort.h"
+#include "bam_endian.h"
+#ifdef _USE_KNETFILE
+#include "knetfile.h"
+#endif
+
+/*!
+  @header
+
+  Alignment indexing. Before indexing, BAM must be sorted based on the
+  leftmost coordinate of alignments. In indexing, BAM uses two indices:
+  a UCSC binning index and a simple linear index. The binning index is
+  efficient for alignments spanning long distance, while the auxiliary
+  linear index helps to reduce unnecessary seek calls especially for
+  short alignments.
+
+  The UCSC binning scheme was suggested by Richard Durbin and Lincoln
+  Stein and is explained by Kent et al. (2002). In this scheme, each bin
+  represents a contiguous genomic region which can be fully contained in
+  another bin; each alignment is associated with a bin which represents
+  the smallest region containing the entire alignment. The binning
+  scheme is essentially another representation of R-tree. A distinct bin
+  uniquely corresponds to a distinct internal node in a R-tree. Bin A is
+  a child of Bin B if region A is contained in B.
+
+  In BAM, each bin may span 2^29, 2^26, 2^23, 2^20, 2^17 or 2^14 bp. Bin
+  0 spans a 512Mbp region, bins 1-8 span 64Mbp, 9-72 8Mbp, 73-584 1Mbp,
+  585-4680 128Kbp and bins 4681-37449 span 16Kbp regions. If we want to
+  find the alignments overlapped with a region [rbeg,rend), we need to
+  calculate the list of bins that may be overlapped the region and test
+  the alignments in the bins to confirm the overlaps. If the specified
+  region is short, typically only a few alignments in six bins need to
+  be retrieved. The overlapping alignments can be quickly fetched.
+
+  Besides "fn.bai", bam_index_build() writes a sidecar "fn.bmi" holding
+  the same index as flat arrays: per reference, its bins sorted by bin
+  number, each pointing into one array of chunks, and its linear index
+  as a slice of one array of offsets. It is mapped into memory and
+  queried in place, so loading does no parsing, hashing or allocation
+  proportional to the number of references. bam_index_load() prefers it
+  when it was built from the BAM as it is now, having the BAM's size and
+  modification time recorded in its header, and is at least as new as
+  the .bai. Every offset and count in it is checked against the arrays
+  when it is loaded; one that is malformed is passed over for the .bai.
+
+ */
+
+#define BAM_MIN_CHUNK_GAP 32768
+// 1<<14 is the size of minimum bin.
+#define BAM_LIDX_SHIFT    14
+
+#define BAM_MAX_BIN 37450 // =(8^6-1)/7+1
+
+#define BGZF_MAX_BLOCK 0x10000 // largest inflated or compressed BGZF block
+
+typedef struct {
+	uint64_t u, v;
+} pair64_t;
+
+#define pair64_lt(a,b) ((a).u < (b).u)
+KSORT_INIT(off, pair64_t, pair64_lt)
+
+typedef struct {
+	uint32_t m, n;
+	pair64_t *list;
+} bam_binlist_t;
+
+typedef struct {
+	int32_t n, m;
+	uint64_t *offset;
+} bam_lidx_t;
+
+KHASH_MAP_INIT_INT(i, bam_binlist_t)
+
+// layout of a .bmi file: bmi_header_t, then the arrays refs[n], bins[n_bin],
+// chunks[n_chunk] and lidx[n_lidx], little-endian
+typedef struct {
+	char magic[4];
+	int32_t n;
+	uint64_t n_no_coor, n_bin, n_chunk, n_lidx;
+	uint64_t bam_size; // the BAM indexed, to tell when the .bmi is stale
+	int64_t bam_mtime; // in nanoseconds
+} bmi_header_t;
+
+typedef struct {
+	uint64_t bin_off, lidx_off; // first bin in bins[], first offset in lidx[]
+	uint32_t n_bin, n_lidx;
+} bmi_ref_t;
+
+typedef struct {
+	uint32_t bin, n_chunk;
+	uint64_t chunk_off; // first chunk in chunks[]
+} bmi_bin_t;
+
+struct __bam_index_t {
+	int32_t n;
+	uint64_t n_no_coor; // unmapped reads without coordinate
+	khash_t(i) **index;
+	bam_lidx_t *index2;
+	// set instead of index and index2 when loaded from a .bmi
+	void *map;
+	size_t map_size;
+	const bmi_ref_t *mref;
+	const bmi_bin_t *mbin;
+	const pair64_t *mchunk;
+	const uint64_t *mlidx;
+};
+
+// chunks of one bin, or NULL if the bin is empty
+static const pair64_t *get_bin(const bam_index_t *idx, int tid, uint32_t bin, int *n)
+{
+	*n = 0;
+	if (idx->map) {
+		const bmi_ref_t *r = &idx->mref[tid];
+		const bmi_bin_t *b = idx->mbin + r->bin_off;
+		int lo = 0, hi = (int)r->n_bin - 1, mid;
+		while (lo <= hi) {
+			mid = (lo + hi) / 2;
+			if (b[mid].bin < bin) lo = mid + 1;
+			else if (b[mid].bin > bin) hi = mid - 1;
+			else {
+				*n = b[mid].n_chunk;
+				return idx->mchunk + b[mid].chunk_off;
+			}
+		}
+	} else {
+		khash_t(i) *index = idx->index[tid];
+		khint_t k = kh_get(i, index, bin);
+		if (k != kh_end(index)) {
+			*n = kh_value(index, k).n;
+			return kh_value(index, k).list;
+		}
+	}
+	return 0;
+}
+
+// linear index of one reference; returns its length
+static int get_lidx(const bam_index_t *idx, int tid, const uint64_t **offset)
+{
+	if (idx->map) {
+		*offset = idx->mlidx + idx->mref[tid].lidx_off;
+		return idx->mref[tid].n_lidx;
+	}
+	*offset = idx->index2[tid].offset;
+	return idx->index2[tid].n;
+}
+
+// requirement: len <= LEN_MASK
+static inline void insert_offset(khash_t(i) *h, int bin, uint64_t beg, uint64_t end)
+{
+	khint_t k;
+	bam_binlist_t *l;
+	int ret;
+	k = kh_put(i, h, bin, &ret);
+	l = &kh_value(h, k);
+	if (ret) { // not present
+		l->m = 1; l->n = 0;
+		l->list = (pair64_t*)calloc(l->m, 16);
+	}
+	if (l->n == l->m) {
+		l->m <<= 1;
+		l->list = (pair64_t*)realloc(l->list, l->m * 16);
+	}
+	l->list[l->n].u = beg; l->list[l->n++].v = end;
+}
+
+static inline void insert_offset2(bam_lidx_t *index2, bam1_t *b, uint64_t offset)
+{
+	int i, beg, end;
+	beg = b->core.pos >> BAM_LIDX_SHIFT;
+	end = (bam_calend(&b->core, bam1_cigar(b)) - 1) >> BAM_LIDX_SHIFT;
+	if (index2->m < end + 1) {
+		int old_m = index2->m;
+		index2->m = end + 1;
+		kroundup32(index2->m);
+		index2->offset = (uint64_t*)realloc(index2->offset, index2->m * 8);
+		memset(index2->offset + old_m, 0, 8 * (index2->m - old_m));
+	}
+	if (beg == end) {
+		if (index2->offset[beg] == 0) index2->offset[beg] = offset;
+	} else {
+		for (i = beg; i <= end; ++i)
+			if (index2->offset[i] == 0) index2->offset[i] = offset;
+	}
+	index2->n = end + 1;
+}
+
+static void merge_chunks(bam_index_t *idx)
+{
+#if defined(BAM_TRUE_OFFSET) || defined(BAM_VIRTUAL_OFFSET16)
+	khash_t(i) *index;
+	int i, l, m;
+	khint_t k;
+	for (i = 0; i < idx->n; ++i) {
+		index = idx->index[i];
+		for (k = kh_begin(index); k != kh_end(index); ++k) {
+			bam_binlist_t *p;
+			if (!kh_exist(index, k) || kh_key(index, k) == BAM_MAX_BIN) continue;
+			p = &kh_value(index, k);
+			m = 0;
+			for (l = 1; l < p->n; ++l) {
+#ifdef BAM_TRUE_OFFSET
+				if (p->list[m].v + BAM_MIN_CHUNK_GAP > p->list[l].u) p->list[m].v = p->list[l].v;
+#else
+				if (p->list[m].v>>16 == p->list[l].u>>16) p->list[m].v = p->list[l].v;
+#endif
+				else p->list[++m] = p->list[l];
+			} // ~for(l)
+			p->n = m + 1;
+		} // ~for(k)
+	} // ~for(i)
+#endif // defined(BAM_TRUE_OFFSET) || defined(BAM_BGZF)
+}
+
+static void fill_missing(bam_index_t *idx)
+{
+	int i, j;
+	for (i = 0; i < idx->n; ++i) {
+		bam_lidx_t *idx2 = &idx->index2[i];
+		for (j = 1; j < idx2->n; ++j)
+			if (idx2->offset[j] == 0)
+				idx2->offset[j] = idx2->offset[j-1];
+	}
+}
+
+/*
+ * Building an index in parallel. The file is cut into segments at BGZF
+ * block boundaries and each segment is read on its own thread. A segment
+ * holds the records that start in its blocks; since a record may start in
+ * the previous segment's blocks and run into this one, the thread scans
+ * its first blocks for something that parses as a chain of records. The
+ * guess is checked afterwards against where the previous segment actually
+ * stopped reading, and a segment that guessed wrong is read again.
+ *
+ * Threads do not build bins themselves. They record runs of consecutive
+ * records sharing a reference and a bin, plus a linear index per segment,
+ * and index_replay() feeds the runs through the same steps the serial scan
+ * takes, so chunks are inserted into the hash tables in the same order
+ * and the index written is byte-identical.
+ */
+
+typedef struct {
+	int32_t tid;
+	uint32_t bin;
+	uint64_t beg, end; // virtual offsets of the first record and past the last one
+	uint64_t n_mapped, n_unmapped;
+} idx_run_t;
+
+typedef struct {
+	const char *fn;
+	int32_t n; // number of references
+	int64_t start, limit; // first block, and first block of the next segment
+	// set by index_segment()
+	int found; // whether a record starting in the segment was found
+	uint64_t beg; // virtual offset of the first record
+	uint64_t stop; // where reading stopped: the next segment's first record, or EOF
+	int eof, ret; // reached the end of the file; the last bam_read1() return
+	int no_coor; // a record without coordinate was read; the rest are just counted
+	int n_runs, m_runs;
+	idx_run_t *runs;
+	bam_lidx_t *index2;
+	int32_t first_tid, first_pos, last_tid, last_pos;
+	char *first_qname;
+	char *error; // message for a fatal error at the end of the runs
+} idx_seg_t;
+
+static void seg_reset(idx_seg_t *s)
+{
+	int i;
+	if (s->index2)
+		for (i = 0; i < s->n; ++i) free(s->index2[i].offset);
+	free(s->index2); free(s->runs); free(s->first_qname); free(s->error);
+	s->index2 = 0; s->runs = 0; s->first_qname = s->error = 0;
+	s->found = s->eof = s->ret = s->no_coor = s->n_runs = s->m_runs = 0;
+}
+
+// Scan the records of a segment from bam_tell(fp), which is s->beg.
+static void index_segment(bamFile fp, idx_seg_t *s)
+{
+	bam1_t *b;
+	bam1_core_t *c;
+	idx_run_t *r = 0;
+	uint64_t last_off;
+	int32_t last_tid, last_coor;
+	int ret = 0;
+	char msg[512];
+
+	b = (bam1_t*)calloc(1, sizeof(bam1_t));
+	c = &b->core;
+	s->index2 = (bam_lidx_t*)calloc(s->n, sizeof(bam_lidx_t));
+	last_off = s->beg;
+	last_tid = last_coor = 0xffffffffu;
+	while ((int64_t)(last_off >> 16) < s->limit && (ret = bam_read1(fp, b)) >= 0) {
+		if (s->no_coor) { // everything after it counts as no coordinate
+			++r->n_unmapped;
+			last_off = bam_tell(fp);
+			continue;
+		}
+		if (s->n_runs == 0) {
+			s->first_tid = c->tid; s->first_pos = c->pos;
+			s->first_qname = strdup(bam1_qname(b));
+		} else if (last_tid == c->tid && last_coor > c->pos) {
+			sprintf(msg, "[bam_index_core] the alignment is not sorted (%s): %u > %u in %d-th chr\n",
+					bam1_qname(b), last_coor, c->pos, c->tid+1);
+			s->error = strdup(msg);
+			break;
+		}
+		if (c->tid >= 0) insert_offset2(&s->index2[c->tid], b, last_off);
+		if (r == 0 || r->tid != c->tid || r->bin != c->bin) {
+			if (s->n_runs == s->m_runs) {
+				s->m_runs = s->m_runs? s->m_runs<<1 : 256;
+				s->runs = (idx_run_t*)realloc(s->runs, s->m_runs * sizeof(idx_run_t));
+			}
+			r = &s->runs[s->n_runs++];
+			r->tid = c->tid; r->bin = c->bin;
+			r->beg = last_off;
+			r->n_mapped = r->n_unmapped = 0;
+		}
+		if (c->tid < 0) s->no_coor = 1;
+		if (bam_tell(fp) <= last_off) {
+			sprintf(msg, "[bam_index_core] bug in BGZF/RAZF: %llx < %llx\n",
+					(unsigned long long)bam_tell(fp), (unsigned long long)last_off);
+			s->error = strdup(msg);
+			break;
+		}
+		if (c->flag & BAM_FUNMAP) ++r->n_unmapped;
+		else ++r->n_mapped;
+		last_off = r->end = bam_tell(fp);
+		last_tid = c->tid; last_coor = c->pos;
+	}
+	s->found = s->n_runs > 0 || s->error;
+	s->last_tid = last_tid; s->last_pos = last_coor;
+	if (ret < 0) {
+		s->eof = 1; s->ret = ret;
+		s->stop = bam_tell(fp);
+	} else s->stop = last_off;
+	free(b->data); free(b);
+}
+
+// Build the binning index from the runs of consecutive segments, exactly
+// as bam_index_core() used to from the records themselves.
+static void index_replay(bam_index_t *idx, idx_seg_t *segs, int n_segs)
+{
+	int i, j, k, stopped = 0;
+	uint32_t last_bin, save_bin;
+	int32_t last_tid, save_tid, last_coor;
+	uint64_t save_off, last_off, n_mapped, n_unmapped, off_beg, off_end, n_no_coor;
+	idx_seg_t *s = 0;
+
+	save_bin = save_tid = last_tid = last_bin = 0xffffffffu;
+	save_off = last_off = off_beg = off_end = segs[0].beg;
+	last_coor = 0xffffffffu;
+	n_mapped = n_unmapped = n_no_coor = 0;
+	for (i = 0; i < n_segs; ++i) {
+		s = &segs[i];
+		if (!s->found) continue;
+		if (stopped) { // after the first record without coordinate
+			for (j = 0; j < s->n_runs; ++j)
+				n_no_coor += s->runs[j].n_mapped + s->runs[j].n_unmapped;
+			continue;
+		}
+		if (s->n_runs > 0 && last_tid == s->first_tid && last_coor > s->first_pos) {
+			fprintf(stderr, "[bam_index_core] the alignment is not sorted (%s): %u > %u in %d-th chr\n",
+					s->first_qname, last_coor, s->first_pos, s->first_tid+1);
+			exit(1);
+		}
+		for (j = 0; j < s->n_runs && !stopped; ++j) {
+			const idx_run_t *r = &s->runs[j];
+			if (last_tid != r->tid) { // change of chromosomes
+				last_tid = r->tid;
+				last_bin = 0xffffffffu;
+			}
+			if (r->bin != last_bin) { // then possibly write the binning index
+				if (save_bin != 0xffffffffu) // save_bin==0xffffffffu only happens to the first record
+					insert_offset(idx->index[save_tid], save_bin, save_off, last_off);
+				if (last_bin == 0xffffffffu && save_tid != 0xffffffffu) { // write the meta element
+					off_end = last_off;
+					insert_offset(idx->index[save_tid], BAM_MAX_BIN, off_beg, off_end);
+					insert_offset(idx->index[save_tid], BAM_MAX_BIN, n_mapped, n_unmapped);
+					n_mapped = n_unmapped = 0;
+					off_beg = off_end;
+				}
+				save_off = last_off;
+				save_bin = last_bin = r->bin;
+				save_tid = r->tid;
+				if (save_tid < 0) { // the rest of the file is counted, not indexed
+					for (; j < s->n_runs; ++j)
+						n_no_coor += s->runs[j].n_mapped + s->runs[j].n_unmapped;
+					stopped = 1;
+					break;
+				}
+			}
+			n_mapped += r->n_mapped;
+			n_unmapped += r->n_unmapped;
+			last_off = r->end;
+		}
+		if (s->error) {
+			fputs(s->error, stderr);
+			exit(1);
+		}
+		for (k = 0; k < idx->n; ++k) { // the first offset seen for a window wins
+			bam_lidx_t *p = &idx->index2[k], *q = &s->index2[k];
+			if (q->n == 0) continue;
+			if (p->m < q->m) {
+				p->offset = (uint64_t*)realloc(p->offset, q->m * 8);
+				memset(p->offset + p->m, 0, 8 * (q->m - p->m));
+				p->m = q->m;
+			}
+			for (j = 0; j < q->m; ++j)
+				if (p->offset[j] == 0) p->offset[j] = q->offset[j];
+			p->n = q->n;
+		}
+		last_tid = s->last_tid; last_coor = s->last_pos;
+	}
+	if (save_tid >= 0) {
+		insert_offset(idx->index[save_tid], save_bin, save_off, s->stop);
+		off_end = s->stop;
+		insert_offset(idx->index[save_tid], BAM_MAX_BIN, off_beg, off_end);
+		insert_offset(idx->index[save_tid], BAM_MAX_BIN, n_mapped, n_unmapped);
+	}
+	merge_chunks(idx);
+	fill_missing(idx);
+	if (s->ret < -1) fprintf(stderr, "[bam_index_core] truncated file? Continue anyway. (%d)\n", s->ret);
+	idx->n_no_coor = n_no_coor;
+}
+
+static bam_index_t *index_init(int32_t n)
+{
+	int i;
+	bam_index_t *idx = (bam_index_t*)calloc(1, sizeof(bam_index_t));
+	idx->n = n;
+	idx->index = (khash_t(i)**)calloc(idx->n, sizeof(void*));
+	for (i = 0; i < idx->n; ++i) idx->index[i] = kh_init(i);
+	idx->index2 = (bam_lidx_t*)calloc(idx->n, sizeof(bam_lidx_t));
+	return idx;
+}
+
+bam_index_t *bam_index_core(bamFile fp)
+{
+	bam_header_t *h;
+	bam_index_t *idx;
+	idx_seg_t s;
+
+	h = bam_header_read(fp);
+	idx = index_init(h->n_targets);
+	bam_header_destroy(h);
+	memset(&s, 0, sizeof(idx_seg_t));
+	s.n = idx->n;
+	s.beg = bam_tell(fp);
+	s.start = s.beg >> 16; s.limit = INT64_MAX;
+	index_segment(fp, &s);
+	index_replay(idx, &s, 1);
+	seg_reset(&s);
+	return idx;
+}
+
+// Whether a BAM record plausibly starts at p in buf, and the next depth
+// records after it as far as buf goes.
+static int is_record(const uint8_t *buf, int64_t p, int len, int32_t n, int depth)
+{
+	int32_t x[9], i;
+	int64_t fixed;
+	if (p + 36 > len) return 1; // nothing left to contradict it
+	memcpy(x, buf + p, 36);
+	// block_size, refID, pos, bin_mq_nl, flag_nc, l_seq, next_refID, next_pos, tlen
+	if (x[1] < -1 || x[1] >= n || x[6] < -1 || x[6] >= n) return 0;
+	if (x[2] < -1 || x[7] < -1 || x[5] < 0) return 0;
+	if ((x[3]&0xff) == 0 || (uint32_t)x[3]>>16 > BAM_MAX_BIN) return 0;
+	fixed = 32 + (x[3]&0xff) + 4 * (int64_t)(x[4]&0xffff) + (x[5]+1)/2 + (int64_t)x[5];
+	if (x[0] < fixed) return 0;
+	for (i = 0; i < (x[3]&0xff) - 1 && p + 36 + i < len; ++i)
+		if (!isgraph(buf[p + 36 + i])) return 0;
+	if (p + 36 + i < len && buf[p + 36 + i] != 0) return 0;
+	return depth == 0 || is_record(buf, p + 4 + x[0], len, n, depth - 1);
+}
+
+// Find the first record starting in blocks [s->start, s->limit).
+static int find_first_record(bamFile fp, idx_seg_t *s)
+{
+	uint8_t *buf;
+	int len0, len1, p, found = 0;
+	int64_t addr0, addr1;
+
+	buf = (uint8_t*)malloc(2 * BGZF_MAX_BLOCK);
+	if (bgzf_seek(fp, s->start << 16, SEEK_SET) < 0 || bgzf_read_block(fp) < 0) goto end;
+	addr0 = fp->block_address; len0 = fp->block_length;
+	memcpy(buf, fp->uncompressed_block, len0);
+	while (len0 > 0 && addr0 < s->limit) {
+		len1 = bgzf_read_block(fp) < 0? 0 : fp->block_length; // look into the next block
+		addr1 = fp->block_address;
+		memcpy(buf + len0, fp->uncompressed_block, len1);
+		for (p = 0; p < len0; ++p) {
+			if (is_record(buf, p, len0 + len1, s->n, 2)) {
+				s->beg = (uint64_t)addr0 << 16 | p;
+				found = 1;
+				goto end;
+			}
+		}
+		memmove(buf, buf + len0, len1);
+		addr0 = addr1; len0 = len1;
+	}
+end:
+	free(buf);
+	return found;
+}
+
+static void *index_worker(void *data)
+{
+	idx_seg_t *s = (idx_seg_t*)data;
+	bamFile fp;
+	if ((fp = bam_open(s->fn, "r")) == 0) return 0;
+	if (find_first_record(fp, s) && bam_seek(fp, s->beg, SEEK_SET) >= 0)
+		index_segment(fp, s);
+	bam_close(fp);
+	return 0;
+}
+
+static int is_block_header(const uint8_t *p)
+{
+	static const uint8_t magic[4] = { 31, 139, 8, 4 }, extra[6] = { 6, 0, 'B', 'C', 2, 0 };
+	return memcmp(p, magic, 4) == 0 && memcmp(p + 10, extra, 6) == 0;
+}
+
+// Offset of the first BGZF block at or after off, or -1 if there is none.
+// A candidate counts when the block after it starts where it says, too.
+static int64_t next_block(int fd, int64_t off, int64_t size)
+{
+	uint8_t *buf = (uint8_t*)malloc(3 * BGZF_MAX_BLOCK);
+	int64_t ret = -1;
+	int i, len, bsize;
+	for (; off < size; off += BGZF_MAX_BLOCK) {
+		if ((len = pread(fd, buf, 3 * BGZF_MAX_BLOCK, off)) < 18) break;
+		for (i = 0; i < BGZF_MAX_BLOCK && i + 18 <= len; ++i) {
+			if (!is_block_header(buf + i)) continue;
+			bsize = (buf[i+16] | buf[i+17]<<8) + 1;
+			if (off + i + bsize == size || (i + bsize + 18 <= len && is_block_header(buf + i + bsize))) {
+				ret = off + i;
+				goto end;
+			}
+		}
+	}
+end:
+	free(buf);
+	return ret;
+}
+
+static bam_index_t *bam_index_core_mt(const char *fn, int n_threads)
+{
+	bamFile fp;
+	bam_header_t *h;
+	bam_index_t *idx;
+	idx_seg_t *segs;
+	pthread_t *tid;
+	struct stat st;
+	int i, n, fd;
+	int64_t off;
+	uint64_t cur;
+
+	if ((fp = bam_open(fn, "r")) == 0) return 0;
+	if (n_threads <= 1 || bam_is_be || stat(fn, &st) != 0 || !S_ISREG(st.st_mode)
+		|| st.st_size < (int64_t)n_threads * 16 * BGZF_MAX_BLOCK || (fd = open(fn, O_RDONLY)) < 0)
+	{
+		idx = bam_index_core(fp);
+		bam_close(fp);
+		return idx;
+	}
+	h = bam_header_read(fp);
+	idx = index_init(h->n_targets);
+	bam_header_destroy(h);
+
+	segs = (idx_seg_t*)calloc(n_threads, sizeof(idx_seg_t));
+	segs[0].beg = bam_tell(fp);
+	segs[0].start = segs[0].beg >> 16;
+	for (i = 1, n = 1; i < n_threads; ++i) {
+		off = next_block(fd, st.st_size / n_threads * i, st.st_size);
+		if (off <= segs[n-1].start) continue;
+		segs[n++].start = off;
+	}
+	close(fd);
+	for (i = 0; i < n; ++i) {
+		segs[i].fn = fn;
+		segs[i].n = idx->n;
+		segs[i].limit = i + 1 < n? segs[i+1].start : INT64_MAX;
+	}
+
+	// the first segment starts right after the header, so needs no guessing
+	tid = (pthread_t*)calloc(n, sizeof(pthread_t));
+	for (i = 1; i < n; ++i) pthread_create(&tid[i], 0, index_worker, &segs[i]);
+	index_segment(fp, &segs[0]);
+	for (i = 1; i < n; ++i) pthread_join(tid[i], 0);
+	free(tid);
+
+	// check each guess against where the previous segment stopped
+	for (i = 1, cur = segs[0].stop; i < n; ++i) {
+		idx_seg_t *s = &segs[i];
+		if (segs[i-1].error) break; // index_replay() stops there
+		if (segs[i-1].eof || (int64_t)(cur >> 16) >= s->limit) { // nothing starts in it
+			seg_reset(s);
+			s->stop = cur;
+			s->eof = segs[i-1].eof; s->ret = segs[i-1].ret;
+			continue;
+		}
+		if (!s->found || s->beg != cur) {
+			seg_reset(s);
+			s->beg = cur;
+			bam_seek(fp, cur, SEEK_SET);
+			index_segment(fp, s);
+		}
+		cur = s->stop;
+	}
+	bam_close(fp);
+
+	index_replay(idx, segs, n);
+	for (i = 0; i < n; ++i) seg_reset(&segs[i]);
+	free(segs);
+	return idx;
+}
+
+void bam_index_destroy(bam_index_t *idx)
+{
+	khint_t k;
+	int i;
+	if (idx == 0) return;
+	if (idx->map) {
+		munmap(idx->map, idx->map_size);
+		free(idx);
+		return;
+	}
+	for (i = 0; i < idx->n; ++i) {
+		khash_t(i) *index = idx->index[i];
+		bam_lidx_t *index2 = idx->index2 + i;
+		for (k = kh_begin(index); k != kh_end(index); ++k) {
+			if (kh_exist(index, k))
+				free(kh_value(index, k).list);
+		}
+		kh_destroy(i, index);
+		free(index2->offset);
+	}
+	free(idx->index); free(idx->index2);
+	free(idx);
+}
+
+void bam_index_save(const bam_index_t *idx, FILE *fp)
+{
+	int32_t i, size;
+	khint_t k;
+	if (idx->map) {
+		fprintf(stderr, "[bam_index_save] cannot save an index loaded from a .bmi.\n");
+		return;
+	}
+	fwrite("BAI\1", 1, 4, fp);
+	if (bam_is_be) {
+		uint32_t x = idx->n;
+		fwrite(bam_swap_endian_4p(&x), 4, 1, fp);
+	} else fwrite(&idx->n, 4, 1, fp);
+	for (i = 0; i < idx->n; ++i) {
+		khash_t(i) *index = idx->index[i];
+		bam_lidx_t *index2 = idx->index2 + i;
+		// write binning index
+		size = kh_size(index);
+		if (bam_is_be) { // big endian
+			uint32_t x = size;
+			fwrite(bam_swap_endian_4p(&x), 4, 1, fp);
+		} else fwrite(&size, 4, 1, fp);
+		for (k = kh_begin(index); k != kh_end(index); ++k) {
+			if (kh_exist(index, k)) {
+				bam_binlist_t *p = &kh_value(index, k);
+				if (bam_is_be) { // big endian
+					uint32_t x;
+					x = kh_key(index, k); fwrite(bam_swap_endian_4p(&x), 4, 1, fp);
+					x = p->n; fwrite(bam_swap_endian_4p(&x), 4, 1, fp);
+					for (x = 0; (int)x < p->n; ++x) {
+						bam_swap_endian_8p(&p->list[x].u);
+						bam_swap_endian_8p(&p->list[x].v);
+					}
+					fwrite(p->list, 16, p->n, fp);
+					for (x = 0; (int)x < p->n; ++x) {
+						bam_swap_endian_8p(&p->list[x].u);
+						bam_swap_endian_8p(&p->list[x].v);
+					}
+				} else {
+					fwrite(&kh_key(index, k), 4, 1, fp);
+					fwrite(&p->n, 4, 1, fp);
+					fwrite(p->list, 16, p->n, fp);
+				}
+			}
+		}
+		// write linear index (index2)
+		if (bam_is_be) {
+			int x = index2->n;
+			fwrite(bam_swap_endian_4p(&x), 4, 1, fp);
+		} else fwrite(&index2->n, 4, 1, fp);
+		if (bam_is_be) { // big endian
+			int x;
+			for (x = 0; (int)x < index2->n; ++x)
+				bam_swap_endian_8p(&index2->offset[x]);
+			fwrite(index2->offset, 8, index2->n, fp);
+			for (x = 0; (int)x < index2->n; ++x)
+				bam_swap_endian_8p(&index2->offset[x]);
+		} else fwrite(index2->offset, 8, index2->n, fp);
+	}
+	{ // write the number of reads coor-less records.
+		uint64_t x = idx->n_no_coor;
+		if (bam_is_be) bam_swap_endian_8p(&x);
+		fwrite(&x, 8, 1, fp);
+	}
+	fflush(fp);
+}
+
+static bam_index_t *bam_index_load_core(FILE *fp)
+{
+	int i;
+	char magic[4];
+	bam_index_t *idx;
+	if (fp == 0) {
+		fprintf(stderr, "[bam_index_load_core] fail to load index.\n");
+		return 0;
+	}
+	fread(magic, 1, 4, fp);
+	if (strncmp(magic, "BAI\1", 4)) {
+		fprintf(stderr, "[bam_index_load] wrong magic number.\n");
+		fclose(fp);
+		return 0;
+	}
+	idx = (bam_index_t*)calloc(1, sizeof(bam_index_t));	
+	fread(&idx->n, 4, 1, fp);
+	if (bam_is_be) bam_swap_endian_4p(&idx->n);
+	idx->index = (khash_t(i)**)calloc(idx->n, sizeof(void*));
+	idx->index2 = (bam_lidx_t*)calloc(idx->n, sizeof(bam_lidx_t));
+	for (i = 0; i < idx->n; ++i) {
+		khash_t(i) *index;
+		bam_lidx_t *index2 = idx->index2 + i;
+		uint32_t key, size;
+		khint_t k;
+		int j, ret;
+		bam_binlist_t *p;
+		index = idx->index[i] = kh_init(i);
+		// load binning index
+		fread(&size, 4, 1, fp);
+		if (bam_is_be) bam_swap_endian_4p(&size);
+		for (j = 0; j < (int)size; ++j) {
+			fread(&key, 4, 1, fp);
+			if (bam_is_be) bam_swap_endian_4p(&key);
+			k = kh_put(i, index, key, &ret);
+			p = &kh_value(index, k);
+			fread(&p->n, 4, 1, fp);
+			if (bam_is_be) bam_swap_endian_4p(&p->n);
+			p->m = p->n;
+			p->list = (pair64_t*)malloc(p->m * 16);
+			fread(p->list, 16, p->n, fp);
+			if (bam_is_be) {
+				int x;
+				for (x = 0; x < p->n; ++x) {
+					bam_swap_endian_8p(&p->list[x].u);
+					bam_swap_endian_8p(&p->list[x].v);
+				}
+			}
+		}
+		// load linear index
+		fread(&index2->n, 4, 1, fp);
+		if (bam_is_be) bam_swap_endian_4p(&index2->n);
+		index2->m = index2->n;
+		index2->offset = (uint64_t*)calloc(index2->m, 8);
+		fread(index2->offset, index2->n, 8, fp);
+		if (bam_is_be)
+			for (j = 0; j < index2->n; ++j) bam_swap_endian_8p(&index2->offset[j]);
+	}
+	if (fread(&idx->n_no_coor, 8, 1, fp) == 0) idx->n_no_coor = 0;
+	if (bam_is_be) bam_swap_endian_8p(&idx->n_no_coor);
+	return idx;
+}
+
+static int bin_cmp(const void *a, const void *b)
+{
+	uint32_t x = ((const bmi_bin_t*)a)->bin, y = ((const bmi_bin_t*)b)->bin;
+	return x < y? -1 : x > y;
+}
+
+// size and modification time, in nanoseconds, of a file
+static int file_stamp(const char *fn, uint64_t *size, int64_t *mtime)
+{
+	struct stat st;
+	if (stat(fn, &st) != 0) return -1;
+	*size = st.st_size;
+	*mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	return 0;
+}
+
+int bam_index_save_mmap(const bam_index_t *idx, const char *fn, FILE *fp)
+{
+	bmi_header_t h;
+	bmi_ref_t *refs;
+	bmi_bin_t *bins;
+	int32_t i;
+	uint64_t j;
+	khint_t k;
+	if (idx->map) {
+		fprintf(stderr, "[bam_index_save_mmap] the index is already a .bmi.\n");
+		return -1;
+	}
+	if (bam_is_be) {
+		fprintf(stderr, "[bam_index_save_mmap] .bmi files are only supported on little-endian machines.\n");
+		return -1;
+	}
+	memset(&h, 0, sizeof(bmi_header_t));
+	memcpy(h.magic, "BMI\2", 4);
+	if (file_stamp(fn, &h.bam_size, &h.bam_mtime) != 0) {
+		fprintf(stderr, "[bam_index_save_mmap] fail to stat %s.\n", fn);
+		return -1;
+	}
+	h.n = idx->n; h.n_no_coor = idx->n_no_coor;
+	refs = (bmi_ref_t*)calloc(idx->n > 0? idx->n : 1, sizeof(bmi_ref_t));
+	for (i = 0; i < idx->n; ++i) {
+		refs[i].bin_off = h.n_bin; refs[i].n_bin = kh_size(idx->index[i]);
+		refs[i].lidx_off = h.n_lidx; refs[i].n_lidx = idx->index2[i].n;
+		h.n_bin += refs[i].n_bin; h.n_lidx += refs[i].n_lidx;
+	}
+	bins = (bmi_bin_t*)calloc(h.n_bin > 0? h.n_bin : 1, sizeof(bmi_bin_t));
+	for (i = 0, j = 0; i < idx->n; ++i) {
+		khash_t(i) *index = idx->index[i];
+		for (k = kh_begin(index); k != kh_end(index); ++k)
+			if (kh_exist(index, k)) bins[j++].bin = kh_key(index, k);
+		qsort(bins + refs[i].bin_off, refs[i].n_bin, sizeof(bmi_bin_t), bin_cmp);
+	}
+	for (i = 0; i < idx->n; ++i) {
+		for (j = refs[i].bin_off; j < refs[i].bin_off + refs[i].n_bin; ++j) {
+			k = kh_get(i, idx->index[i], bins[j].bin);
+			bins[j].n_chunk = kh_value(idx->index[i], k).n;
+			bins[j].chunk_off = h.n_chunk;
+			h.n_chunk += bins[j].n_chunk;
+		}
+	}
+	fwrite(&h, sizeof(bmi_header_t), 1, fp);
+	fwrite(refs, sizeof(bmi_ref_t), idx->n, fp);
+	fwrite(bins, sizeof(bmi_bin_t), h.n_bin, fp);
+	for (i = 0; i < idx->n; ++i)
+		for (j = refs[i].bin_off; j < refs[i].bin_off + refs[i].n_bin; ++j) {
+			k = kh_get(i, idx->index[i], bins[j].bin);
+			fwrite(kh_value(idx->index[i], k).list, 16, bins[j].n_chunk, fp);
+		}
+	for (i = 0; i < idx->n; ++i)
+		fwrite(idx->index2[i].offset, 8, idx->index2[i].n, fp);
+	free(refs); free(bins);
+	fflush(fp);
+	return ferror(fp)? -1 : 0;
+}
+
+// every ref's bins and offsets, and every bin's chunks, lie within the arrays
+static int bmi_is_valid(const bmi_header_t *h)
+{
+	const bmi_ref_t *refs = (const bmi_ref_t*)(h + 1);
+	const bmi_bin_t *bins = (const bmi_bin_t*)(refs + h->n);
+	uint64_t j;
+	int32_t i;
+	for (i = 0; i < h->n; ++i)
+		if (refs[i].bin_off > h->n_bin || refs[i].n_bin > h->n_bin - refs[i].bin_off
+				|| refs[i].lidx_off > h->n_lidx || refs[i].n_lidx > h->n_lidx - refs[i].lidx_off)
+			return 0;
+	for (j = 0; j < h->n_bin; ++j)
+		if (bins[j].chunk_off > h->n_chunk || bins[j].n_chunk > h->n_chunk - bins[j].chunk_off)
+			return 0;
+	return 1;
+}
+
+// map the .bmi of fnbam; returns NULL if it is missing, stale or malformed,
+// saying so only if malformed
+static bam_index_t *bam_index_load_mmap(const char *fnbmi, const char *fnbam)
+{
+	struct stat st;
+	const bmi_header_t *h;
+	bam_index_t *idx;
+	void *map;
+	uint64_t size, bam_size;
+	int64_t bam_mtime;
+	int fd;
+	if (bam_is_be || file_stamp(fnbam, &bam_size, &bam_mtime) != 0) return 0;
+	if ((fd = open(fnbmi, O_RDONLY)) < 0) return 0;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(bmi_header_t)) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return 0;
+	h = (const bmi_header_t*)map;
+	if (h->n_bin > (uint64_t)st.st_size || h->n_chunk > (uint64_t)st.st_size || h->n_lidx > (uint64_t)st.st_size)
+		size = 0; // corrupt; keep the sum below from overflowing
+	else size = sizeof(bmi_header_t) + (uint64_t)h->n * sizeof(bmi_ref_t) + h->n_bin * sizeof(bmi_bin_t)
+		+ h->n_chunk * 16 + h->n_lidx * 8;
+	if (memcmp(h->magic, "BMI\2", 4) != 0 || h->n < 0 || size != (uint64_t)st.st_size || !bmi_is_valid(h)) {
+		fprintf(stderr, "[bam_index_load] ignoring malformed index %s.\n", fnbmi);
+		munmap(map, st.st_size);
+		return 0;
+	}
+	if (h->bam_size != bam_size || h->bam_mtime != bam_mtime) { // the BAM has changed since
+		munmap(map, st.st_size);
+		return 0;
+	}
+	idx = (bam_index_t*)calloc(1, sizeof(bam_index_t));
+	idx->n = h->n; idx->n_no_coor = h->n_no_coor;
+	idx->map = map; idx->map_size = st.st_size;
+	idx->mref = (const bmi_ref_t*)(h + 1);
+	idx->mbin = (const bmi_bin_t*)(idx->mref + h->n);
+	idx->mchunk = (const pair64_t*)(idx->mbin + h->n_bin);
+	idx->mlidx = (const uint64_t*)(idx->mchunk + h->n_chunk);
+	return idx;
+}
+
+// non-zero if file a exists and is not older than b, or b does not exist
+static int is_fresh(const char *a, const char *b)
+{
+	struct stat sa, sb;
+	if (stat(a, &sa) != 0) return 0;
+	if (stat(b, &sb) != 0) return 1;
+	return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec
+		|| (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec >= sb.st_mtim.tv_nsec);
+}
+
+bam_index_t *bam_index_load_local(const char *_fn)
+{
+	FILE *fp;
+	char *fnidx, *fn;
+
+	if (strstr(_fn, "ftp://") == _fn || strstr(_fn, "http://") == _fn) {
+		const char *p;
+		int l = strlen(_fn);
+		for (p = _fn + l - 1; p >= _fn; --p)
+			if (*p == '/') break;
+		fn = strdup(p + 1);
+	} else fn = strdup(_fn);
+	fnidx = (char*)calloc(strlen(fn) + 5, 1);
+	strcpy(fnidx, fn); strcat(fnidx, ".bmi");
+	if (strcmp(fn, _fn) == 0) { // local BAM; use its .bmi if up to date
+		bam_index_t *idx = 0;
+		char *fnbai = (char*)calloc(strlen(fn) + 5, 1);
+		strcpy(fnbai, fn); strcat(fnbai, ".bai");
+		if (is_fresh(fnidx, fnbai))
+			idx = bam_index_load_mmap(fnidx, fn);
+		free(fnbai);
+		if (idx) {
+			free(fnidx); free(fn);
+			return idx;
+		}
+	}
+	strcpy(fnidx, fn); strcat(fnidx, ".bai");
+	fp = fopen(fnidx, "rb");
+	if (fp == 0) { // try "{base}.bai"
+		char *s = strstr(fn, "bam");
+		if (s == fn + strlen(fn) - 3) {
+			strcpy(fnidx, fn);
+			fnidx[strlen(fn)-1] = 'i';
+			fp = fopen(fnidx, "rb");
+		}
+	}
+	free(fnidx); free(fn);
+	if (fp) {
+		bam_index_t *idx = bam_index_load_core(fp);
+		fclose(fp);
+		return idx;
+	} else return 0;
+}
+
+#ifdef _USE_KNETFILE
+static void download_from_remote(const char *url)
+{
+	const int buf_size = 1 * 1024 * 1024;
+	char *fn;
+	FILE *fp;
+	uint8_t *buf;
+	knetFile *fp_remote;
+	int l;
+	if (strstr(url, "ftp://") != url && strstr(url, "http://") != url) return;
+	l = strlen(url);
+	for (fn = (char*)url + l - 1; fn >= url; --fn)
+		if (*fn == '/') break;
+	++fn; // fn now points to the file name
+	fp_remote = knet_open(url, "r");
+	if (fp_remote == 0) {
+		fprintf(stderr, "[download_from_remote] fail to open remote file.\n");
+		return;
+	}
+	if ((fp = fopen(fn, "wb")) == 0) {
+		fprintf(stderr, "[download_from_remote] fail to create file in the working directory.\n");
+		knet_close(fp_remote);
+		return;
+	}
+	buf = (uint8_t*)calloc(buf_size, 1);
+	while ((l = knet_read(fp_remote, buf, buf_size)) != 0)
+		fwrite(buf, 1, l, fp);
+	free(buf);
+	fclose(fp);
+	knet_close(fp_remote);
+}
+#else
+static void download_from_remote(const char *url)
+{
+	return;
+}
+#endif
+
+bam_index_t *bam_index_load(const char *fn)
+{
+	bam_index_t *idx;
+	idx = bam_index_load_local(fn);
+	if (idx == 0 && (strstr(fn, "ftp://") == fn || strstr(fn, "http://") == fn)) {
+		char *fnidx = calloc(strlen(fn) + 5, 1);
+		strcat(strcpy(fnidx, fn), ".bai");
+		fprintf(stderr, "[bam_index_load] attempting to download the remote index file.\n");
+		download_from_remote(fnidx);
+		idx = bam_index_load_local(fn);
+	}
+	if (idx == 0) fprintf(stderr, "[bam_index_load] fail to load BAM index.\n");
+	return idx;
+}
+
+static int index_build(const char *fn, const char *_fnidx, int n_threads)
+{
+	char *fnidx;
+	FILE *fpidx;
+	bam_index_t *idx;
+	if ((idx = bam_index_core_mt(fn, n_threads)) == 0) {
+		fprintf(stderr, "[bam_index_build2] fail to open the BAM file.\n");
+		return -1;
+	}
+	if (_fnidx == 0) {
+		fnidx = (char*)calloc(strlen(fn) + 5, 1);
+		strcpy(fnidx, fn); strcat(fnidx, ".bai");
+	} else fnidx = strdup(_fnidx);
+	fpidx = fopen(fnidx, "wb");
+	if (fpidx == 0) {
+		fprintf(stderr, "[bam_index_build2] fail to create the index file.\n");
+		free(fnidx);
+		return -1;
+	}
+	bam_index_save(idx, fpidx);
+	fclose(fpidx);
+	if (_fnidx == 0 && !bam_is_be) { // and the .bmi sidecar next to it
+		strcpy(fnidx, fn); strcat(fnidx, ".bmi");
+		if ((fpidx = fopen(fnidx, "wb")) != 0) {
+			if (bam_index_save_mmap(idx, fn, fpidx) != 0)
+				fprintf(stderr, "[bam_index_build2] fail to write %s.\n", fnidx);
+			fclose(fpidx);
+		}
+	}
+	bam_index_destroy(idx);
+	free(fnidx);
+	return 0;
+}
+
+int bam_index_build2(const char *fn, const char *_fnidx)
+{
+	return index_build(fn, _fnidx, 1);
+}
+
+int bam_index_build_mt(const char *fn, int n_threads)
+{
+	return index_build(fn, 0, n_threads);
+}
+
+int bam_index_build_mmap(const char *fn)
+{
+	bam_index_t *idx;
+	char *fnidx;
+	FILE *fp;
+	int ret;
+	if ((idx = bam_index_load(fn)) == 0) return -1;
+	if (idx->map) { // already up to date
+		bam_index_destroy(idx);
+		return 0;
+	}
+	fnidx = (char*)calloc(strlen(fn) + 5, 1);
+	strcpy(fnidx, fn); strcat(fnidx, ".bmi");
+	if ((fp = fopen(fnidx, "wb")) == 0) {
+		fprintf(stderr, "[bam_index_build_mmap] fail to create the index file.\n");
+		free(fnidx); bam_index_destroy(idx);
+		return -1;
+	}
+	ret = bam_index_save_mmap(idx, fn, fp);
+	fclose(fp);
+	if (ret != 0) unlink(fnidx);
+	free(fnidx);
+	bam_index_destroy(idx);
+	return ret;
+}
+
+int bam_index_build(const char *fn)
+{
+	return bam_index_build2(fn, 0);
+}
+
+int bam_index_linear(const bam_index_t *idx, int tid, const uint64_t **offset)
+{
+	*offset = 0;
+	if (tid < 0 || tid >= idx->n) return 0;
+	return get_lidx(idx, tid, offset);
+}
+
+int bam_index_stats(const bam_index_t *idx, int tid, uint64_t *off_beg, uint64_t *off_end,
+					uint64_t *n_mapped, uint64_t *n_unmapped)
+{
+	const pair64_t *meta;
+	int n;
+	if (tid < 0 || tid >= idx->n) return -1;
+	meta = get_bin(idx, tid, BAM_MAX_BIN, &n);
+	if (n < 2) return -1;
+	*off_beg = meta[0].u; *off_end = meta[0].v;
+	*n_mapped = meta[1].u; *n_unmapped = meta[1].v;
+	return 0;
+}
+
+int bam_index(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: samtools index <in.bam> [out.index]\n");
+		return 1;
+	}
+	if (argc >= 3) bam_index_build2(argv[1], argv[2]);
+	else bam_index_build(argv[1]);
+	return 0;
+}
+
+int bam_idxstats(int argc, char *argv[])
+{
+	bam_index_t *idx;
+	bam_header_t *header;
+	bamFile fp;
+	int i;
+	if (argc < 2) {
+		fprintf(stderr, "Usage: samtools idxstats <in.bam>\n");
+		return 1;
+	}
+	fp = bam_open(argv[1], "r");
+	if (fp == 0) { fprintf(stderr, "[%s] fail to open BAM.\n", __func__); return 1; }
+	header = bam_header_read(fp);
+	bam_close(fp);
+	idx = bam_index_load(argv[1]);
+	if (idx == 0) { fprintf(stderr, "[%s] fail to load the index.\n", __func__); return 1; }
+	for (i = 0; i < idx->n; ++i) {
+		int n;
+		const pair64_t *meta = get_bin(idx, i, BAM_MAX_BIN, &n);
+		printf("%s\t%d", header->target_name[i], header->target_len[i]);
+		if (n >= 2)
+			printf("\t%llu\t%llu", (long long)meta[1].u, (long long)meta[1].v);
+		else printf("\t0\t0");
+		putchar('\n');
+	}
+	printf("*\t0\t0\t%llu\n", (long long)idx->n_no_coor);
+	bam_header_destroy(header);
+	bam_index_destroy(idx);
+	return 0;
+}
+
+static inline int reg2bins(uint32_t beg, uint32_t end, uint16_t list[BAM_MAX_BIN])
+{
+	int i = 0, k;
+	if (beg >= end) return 0;
+	if (end >= 1u<<29) end = 1u<<29;
+	--end;
+	list[i++] = 0;
+	for (k =    1 + (beg>>26); k <=    1 + (end>>26); ++k) list[i++] = k;
+	for (k =    9 + (beg>>23); k <=    9 + (end>>23); ++k) list[i++] = k;
+	for (k =   73 + (beg>>20); k <=   73 + (end>>20); ++k) list[i++] = k;
+	for (k =  585 + (beg>>17); k <=  585 + (end>>17); ++k) list[i++] = k;
+	for (k = 4681 + (beg>>14); k <= 4681 + (end>>14); ++k) list[i++] = k;
+	return i;
+}
+
+static inline int is_overlap(uint32_t beg, uint32_t end, const bam1_t *b)
+{
+	uint32_t rbeg = b->core.pos;
+	uint32_t rend = b->core.n_cigar? bam_calend(&b->core, bam1_cigar(b)) : b->core.pos + 1;
+	return (rend > beg && rbeg < end);
+}
+
+struct __bam_iter_t {
+	int from_first; // read from the first record; no random access
+	int tid, beg, end, n_off, i, finished;
+	uint64_t curr_off;
+	pair64_t *off;
+};
+
+// collect the chunks of all bins that may overlap [beg,end), unsorted
+static pair64_t *get_chunks(const bam_index_t *idx, int tid, int beg, int end, int *cnt_off)
+{
+	uint16_t *bins;
+	int i, n_bins, n_off, n_lidx, n;
+	pair64_t *off;
+	const pair64_t *list;
+	const uint64_t *lidx;
+	uint64_t min_off;
+
+	*cnt_off = 0;
+	bins = (uint16_t*)calloc(BAM_MAX_BIN, 2);
+	n_bins = reg2bins(beg, end, bins);
+	n_lidx = get_lidx(idx, tid, &lidx);
+	if (n_lidx > 0) {
+		min_off = (beg>>BAM_LIDX_SHIFT >= n_lidx)? lidx[n_lidx-1] : lidx[beg>>BAM_LIDX_SHIFT];
+		if (min_off == 0) { // improvement for index files built by tabix prior to 0.1.4
+			n = beg>>BAM_LIDX_SHIFT;
+			if (n > n_lidx) n = n_lidx;
+			for (i = n - 1; i >= 0; --i)
+				if (lidx[i] != 0) break;
+			if (i >= 0) min_off = lidx[i];
+		}
+	} else min_off = 0; // tabix 0.1.2 may produce such index files
+	for (i = n_off = 0; i < n_bins; ++i) {
+		get_bin(idx, tid, bins[i], &n);
+		n_off += n;
+	}
+	if (n_off == 0) {
+		free(bins); return 0;
+	}
+	off = (pair64_t*)calloc(n_off, 16);
+	for (i = n_off = 0; i < n_bins; ++i) {
+		int j;
+		list = get_bin(idx, tid, bins[i], &n);
+		for (j = 0; j < n; ++j)
+			if (list[j].v > min_off) off[n_off++] = list[j];
+	}
+	free(bins);
+	*cnt_off = n_off;
+	return off;
+}
+
+// bam_fetch helper function retrieves 
+bam_iter_t bam_iter_query(const bam_index_t *idx, int tid, int beg, int end)
+{
+	int i, n_off;
+	pair64_t *off;
+	bam_iter_t iter = 0;
+
+	if (beg < 0) beg = 0;
+	if (end < beg) return 0;
+	// initialize iter
+	iter = calloc(1, sizeof(struct __bam_iter_t));
+	iter->tid = tid, iter->beg = beg, iter->end = end; iter->i = -1;
+	//
+	off = get_chunks(idx, tid, beg, end, &n_off);
+	if (n_off == 0) {
+		free(off); return iter;
+	}
+	{
+		bam1_t *b = (bam1_t*)calloc(1, sizeof(bam1_t));
+		int l;
+		ks_introsort(off, n_off, off);
+		// resolve completely contained adjacent blocks
+		for (i = 1, l = 0; i < n_off; ++i)
+			if (off[l].v < off[i].v)
+				off[++l] = off[i];
+		n_off = l + 1;
+		// resolve overlaps between adjacent blocks; this may happen due to the merge in indexing
+		for (i = 1; i < n_off; ++i)
+			if (off[i-1].v >= off[i].u) off[i-1].v = off[i].u;
+		{ // merge adjacent blocks
+#if defined(BAM_TRUE_OFFSET) || defined(BAM_VIRTUAL_OFFSET16)
+			for (i = 1, l = 0; i < n_off; ++i) {
+#ifdef BAM_TRUE_OFFSET
+				if (off[l].v + BAM_MIN_CHUNK_GAP > off[i].u) off[l].v = off[i].v;
+#else
+				if (off[l].v>>16 == off[i].u>>16) off[l].v = off[i].v;
+#endif
+				else off[++l] = off[i];
+			}
+			n_off = l + 1;
+#endif
+		}
+		bam_destroy1(b);
+	}
+	iter->n_off = n_off; iter->off = off;
+	return iter;
+}
+
+pair64_t *get_chunk_coordinates(const bam_index_t *idx, int tid, int beg, int end, int *cnt_off)
+{ // for pysam compatibility
+	bam_iter_t iter;
+	pair64_t *off;
+	iter = bam_iter_query(idx, tid, beg, end);
+	off = iter->off; *cnt_off = iter->n_off;
+	free(iter);
+	return off;
+}
+
+void bam_iter_destroy(bam_iter_t iter)
+{
+	if (iter) { free(iter->off); free(iter); }
+}
+
+int bam_iter_read(bamFile fp, bam_iter_t iter, bam1_t *b)
+{
+	int ret;
+	if (iter && iter->finished) return -1;
+	if (iter == 0 || iter->from_first) {
+		ret = bam_read1(fp, b);
+		if (ret < 0 && iter) iter->finished = 1;
+		return ret;
+	}
+	if (iter->off == 0) return -1;
+	for (;;) {
+		if (iter->curr_off == 0 || iter->curr_off >= iter->off[iter->i].v) { // then jump to the next chunk
+			if (iter->i == iter->n_off - 1) { ret = -1; break; } // no more chunks
+			if (iter->i >= 0) assert(iter->curr_off == iter->off[iter->i].v); // otherwise bug
+			if (iter->i < 0 || iter->off[iter->i].v != iter->off[iter->i+1].u) { // not adjacent chunks; then seek
+				bam_seek(fp, iter->off[iter->i+1].u, SEEK_SET);
+				iter->curr_off = bam_tell(fp);
+			}
+			++iter->i;
+		}
+		if ((ret = bam_read1(fp, b)) >= 0) {
+			iter->curr_off = bam_tell(fp);
+			if (b->core.tid != iter->tid || b->core.pos >= iter->end) { // no need to proceed
+				ret = bam_validate1(NULL, b)? -1 : -5; // determine whether end of region or error
+				break;
+			}
+			else if (is_overlap(iter->beg, iter->end, b)) return ret;
+		} else break; // end of file or error
+	}
+	iter->finished = 1;
+	return ret;
+}
+
+int bam_fetch(bamFile fp, const bam_index_t *idx, int tid, int beg, int end, void *data, bam_fetch_f func)
+{
+	int ret;
+	bam_iter_t iter;
+	bam1_t *b;
+	b = bam_init1();
+	iter = bam_iter_query(idx, tid, beg, end);
+	while ((ret = bam_iter_read(fp, iter, b)) >= 0) func(b, data);
+	bam_destroy1(b);
+	return (ret == -1)? 0 : ret;
+}
+
+/*
+ * Multi-region queries: the chunks of all regions are merged into one
+ * ordered, non-overlapping list, so the file is read front to back and each
+ * block is inflated once, and every record is matched against all the
+ * regions it overlaps.
+ */
+
+typedef struct {
+	int tid, beg, end, i; // i: position of the region in the caller's list
+} region_t;
+
+#define region_lt(a,b) ((a).tid < (b).tid || ((a).tid == (b).tid && (a).beg < (b).beg))
+KSORT_INIT(region, region_t, region_lt)
+
+struct __bam_miter_t {
+	int n_reg, next, n_active, n_hits, n_off, i, finished;
+	region_t *reg;
+	int *active; // regions in reg[0..next) that may still overlap a record
+	int *hits;
+	uint64_t curr_off;
+	pair64_t *off;
+};
+
+bam_miter_t bam_iter_query_multi(const bam_index_t *idx, int n, const bam_region_t *regions)
+{
+	bam_miter_t iter;
+	pair64_t *off = 0;
+	int i, l, n_off = 0, m_off = 0;
+
+	iter = calloc(1, sizeof(struct __bam_miter_t));
+	iter->reg = calloc(n > 0? n : 1, sizeof(region_t));
+	iter->active = calloc(n > 0? n : 1, sizeof(int));
+	iter->hits = calloc(n > 0? n : 1, sizeof(int));
+	iter->i = -1;
+	for (i = 0; i < n; ++i) {
+		const bam_region_t *r = &regions[i];
+		if (r->tid < 0 || r->tid >= idx->n || r->end <= r->beg) continue; // matches nothing
+		iter->reg[iter->n_reg].tid = r->tid;
+		iter->reg[iter->n_reg].beg = r->beg < 0? 0 : r->beg;
+		iter->reg[iter->n_reg].end = r->end;
+		iter->reg[iter->n_reg++].i = i;
+	}
+	ks_introsort(region, iter->n_reg, iter->reg);
+	for (i = 0; i < iter->n_reg; ++i) {
+		region_t *r = &iter->reg[i];
+		int n_r;
+		pair64_t *off_r = get_chunks(idx, r->tid, r->beg, r->end, &n_r);
+		if (n_off + n_r > m_off) {
+			m_off = n_off + n_r;
+			kroundup32(m_off);
+			off = realloc(off, m_off * sizeof(pair64_t));
+		}
+		memcpy(off + n_off, off_r, n_r * sizeof(pair64_t));
+		n_off += n_r;
+		free(off_r);
+	}
+	if (n_off == 0) {
+		free(off);
+		iter->finished = 1;
+		return iter;
+	}
+	ks_introsort(off, n_off, off);
+	// take the union of the chunks; chunks meeting in the same block are
+	// joined too, so that block is not sought to and inflated again
+	for (i = 1, l = 0; i < n_off; ++i) {
+		if (off[i].u <= off[l].v || off[i].u>>16 == off[l].v>>16) {
+			if (off[i].v > off[l].v) off[l].v = off[i].v;
+		} else off[++l] = off[i];
+	}
+	iter->n_off = l + 1; iter->off = off;
+	return iter;
+}
+
+void bam_iter_destroy_multi(bam_miter_t iter)
+{
+	if (iter) {
+		free(iter->reg); free(iter->active); free(iter->hits);
+		free(iter->off); free(iter);
+	}
+}
+
+// find the regions overlapping b; returns -1 if no region can overlap b or any later record
+static int match_regions(bam_miter_t iter, const bam1_t *b)
+{
+	int tid = b->core.tid, i, j;
+	uint32_t pos = b->core.pos;
+	uint32_t rend = b->core.n_cigar? bam_calend(&b->core, bam1_cigar(b)) : b->core.pos + 1;
+	region_t *r;
+	if (tid < 0) return -1; // unplaced reads are at the end
+	// retire regions that end before this record, since records are sorted
+	for (i = j = 0; i < iter->n_active; ++i) {
+		r = &iter->reg[iter->active[i]];
+		if (r->tid == tid && r->end > pos) iter->active[j++] = iter->active[i];
+	}
+	iter->n_active = j;
+	// admit regions starting before the record's end
+	for (; iter->next < iter->n_reg; ++iter->next) {
+		r = &iter->reg[iter->next];
+		if (r->tid > tid || (r->tid == tid && r->beg >= rend)) break;
+		if (r->tid == tid && r->end > pos) iter->active[iter->n_active++] = iter->next;
+	}
+	if (iter->n_active == 0 && iter->next == iter->n_reg) return -1;
+	for (i = iter->n_hits = 0; i < iter->n_active; ++i) {
+		r = &iter->reg[iter->active[i]];
+		if (r->beg < rend) iter->hits[iter->n_hits++] = r->i;
+	}
+	return iter->n_hits;
+}
+
+int bam_iter_read_multi(bamFile fp, bam_miter_t iter, bam1_t *b, const int **hits, int *n_hits)
+{
+	int ret, n;
+	*hits = iter->hits; *n_hits = 0;
+	if (iter->finished) return -1;
+	for (;;) {
+		if (iter->curr_off == 0 || iter->curr_off >= iter->off[iter->i].v) { // then jump to the next chunk
+			if (iter->i == iter->n_off - 1) { ret = -1; break; } // no more chunks
+			bam_seek(fp, iter->off[iter->i+1].u, SEEK_SET);
+			iter->curr_off = bam_tell(fp);
+			++iter->i;
+		}
+		if ((ret = bam_read1(fp, b)) >= 0) {
+			iter->curr_off = bam_tell(fp);
+			if ((n = match_regions(iter, b)) < 0) { // past the last region
+				ret = bam_validate1(NULL, b)? -1 : -5;
+				break;
+			}
+			if (n > 0) {
+				*n_hits = n;
+				return ret;
+			}
+		} else break; // end of file or error
+	}
+	iter->finished = 1;
+	return ret;
+}
+
+int bam_fetch_multi(bamFile fp, const bam_index_t *idx, int n, const bam_region_t *regions, void *data, bam_fetch_multi_f func)
+{
+	int ret, n_hits, i;
+	const int *hits;
+	bam_miter_t iter;
+	bam1_t *b;
+	b = bam_init1();
+	iter = bam_iter_query_multi(idx, n, regions);
+	while ((ret = bam_iter_read_multi(fp, iter, b, &hits, &n_hits)) >= 0)
+		for (i = 0; i < n_hits; ++i) func(b, hits[i], data);
+	bam_iter_destroy_multi(iter);
+	bam_destroy1(b);
+	return (ret == -1)? 0 : ret;
+}
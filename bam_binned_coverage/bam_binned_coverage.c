@@ -7,10 +7,28 @@
  */
 
 #include <stdio.h>
-#include <samtools/sam.h>
-#include <samtools/bam.h>
-
-uint32_t k = 100000;
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "samtools/sam.h"
+#include "samtools/bam.h"
+#include "samtools/bgzf_inflate.h"
+
+/* Reads are counted in bins of k, the greatest common divisor of the bin
+ * sizes asked for, and each size is then added up from those. */
+uint32_t  k = 100000;
+uint32_t* sizes = &k;
+int       n_sizes = 1;
+
+int n_threads = 1;
+int n_jobs = 1;
+int sequential = 0;
+int estimate = 0;
+int n_samples = 0;
 
 
 void usage()
@@ -18,158 +36,820 @@ void usage()
     fprintf( stderr,
              "Usage: bam_binned_coverage [OPTIONS] in1.bam [in2.bam ...]\n\n"
              "Options:\n"
-             "-k K      size of bins (default: %u)\n\n", k );
+             "-k K      size of bins (default: %u), or a comma separated list of\n"
+             "          sizes, all counted in the same pass\n"
+             "-o FILE   write the counts at every size to a binary FILE rather than\n"
+             "          as text\n"
+             "-x FILE   print the counts in a binary FILE as text, at every size or\n"
+             "          at those given with -k; no BAM files are read\n"
+             "-s        count in one sequential pass over each file rather than\n"
+             "          with an index query per reference; no index is needed\n"
+             "-e, --estimate\n"
+             "          estimate the counts from the index alone, without reading\n"
+             "          any records, scaled to the read counts the index keeps\n"
+             "-c, --calibrate N\n"
+             "          with -e, scale to reads per byte measured in N sampled blocks\n"
+             "          rather than to the index's read counts\n"
+             "-j N      count N files at once, each on its own thread (default: 1)\n"
+             "-@ N      use N threads to build missing indexes (default: 1)\n\n"
+             "With several sizes, a fourth column gives the size of each bin.\n\n", k );
 }
 
 
-typedef struct chrom_count_
+static int cmp_size( const void* a, const void* b )
 {
-    char* seqname;
-    int tid;
-    uint32_t n;
-    uint32_t* count;
-    struct chrom_count_* next;
-} chrom_count;
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
 
 
-chrom_count* init_counts( bam_header_t* header )
+/* Parse a comma separated list of bin sizes, smallest first, and set k. */
+void parse_sizes( const char* arg )
+{
+    const char* p;
+    uint32_t a, b, t;
+    int i, j;
+
+    for( n_sizes = 1, p = arg; *p; p++ ) n_sizes += *p == ',';
+    sizes = malloc( n_sizes * sizeof(uint32_t) );
+
+    for( i = 0, p = arg; i < n_sizes; i++ ) {
+        sizes[i] = atoi(p);
+        if( sizes[i] == 0 ) {
+            fprintf( stderr, "Error: invalid bin size in '%s'.\n", arg );
+            exit(1);
+        }
+        if( i + 1 < n_sizes ) p = strchr( p, ',' ) + 1;
+    }
+
+    qsort( sizes, n_sizes, sizeof(uint32_t), cmp_size );
+    for( i = j = 1; i < n_sizes; i++ ) {
+        if( sizes[i] != sizes[j - 1] ) sizes[j++] = sizes[i];
+    }
+    n_sizes = j;
+
+    for( k = sizes[0], i = 1; i < n_sizes; i++ ) {
+        for( a = k, b = sizes[i]; b != 0; t = a % b, a = b, b = t );
+        k = a;
+    }
+}
+
+
+/* The bins of every reference sequence of the first file, in one flat
+ * array: those of reference i are count[offset[i]] to
+ * count[offset[i] + n[i] - 1], far enough for the last bin of every size.
+ * Other files are matched to these references by name, through the hash of
+ * the first header. */
+typedef struct
+{
+    bam_header_t* header;
+    uint32_t*     n;
+    size_t*       offset;
+    size_t        n_bins;
+} bins_t;
+
+bins_t bins;
+
+
+void init_bins( bam_header_t* header )
 {
-    chrom_count* C = NULL;
-    chrom_count* B;
     int32_t i;
+    uint64_t n;
+    int j;
+
+    bins.header = header;
+    bins.n      = malloc( (header->n_targets + 1) * sizeof(uint32_t) );
+    bins.offset = malloc( (header->n_targets + 1) * sizeof(size_t) );
+    bins.n_bins = 0;
+
     for( i = 0; i < header->n_targets; i++ ) {
-        B = C;
-        C = malloc( sizeof(chrom_count) );
-        C->seqname = strdup(header->target_name[i]);
-        C->tid     = i;
-        C->n       = (header->target_len[i]/k)+1;
-        C->count   = malloc( sizeof(uint32_t)*C->n );
-        memset( C->count, 0, sizeof(uint32_t)*C->n );
-        C->next = B;
+        bins.n[i] = 0;
+        for( j = 0; j < n_sizes; j++ ) {
+            n = (uint64_t) (header->target_len[i]/sizes[j] + 1) * (sizes[j]/k);
+            if( n > bins.n[i] ) bins.n[i] = n;
+        }
+
+        bins.offset[i] = bins.n_bins;
+        bins.n_bins   += bins.n[i];
     }
 
-    return C;
+    bam_init_header_hash( header );
+}
+
+
+void destroy_bins()
+{
+    free( bins.n );
+    free( bins.offset );
+    bam_header_destroy( bins.header );
 }
 
-void set_tids( chrom_count* C, bam_header_t* header )
+
+/* the reference of the first file that each of h's is, or -1 */
+int32_t* map_tids( const bam_header_t* h )
 {
-    chrom_count* B;
-    int i;
+    int32_t* slot = malloc( (h->n_targets + 1) * sizeof(int32_t) );
+    int32_t i;
 
-    for( i = 0; i < header->n_targets; i++ ) {
-        for( B = C; B != NULL; B = B->next ) {
-            if( strcmp( B->seqname, header->target_name[i] ) == 0 ) {
-                B->tid = i;
-                break;
+    for( i = 0; i < h->n_targets; i++ ) {
+        slot[i] = bam_get_tid( bins.header, h->target_name[i] );
+    }
+
+    return slot;
+}
+
+
+/* The counts at one size: (length/size)+1 bins for each reference, one
+ * reference after the other in header order. */
+typedef struct
+{
+    uint32_t  size;
+    uint32_t* count;
+} level_t;
+
+
+static inline uint32_t level_n( uint32_t len, uint32_t size )
+{
+    return len/size + 1;
+}
+
+
+level_t make_level( const uint32_t* count, uint32_t size )
+{
+    level_t L;
+    uint32_t r = size/k, m, i, t;
+    uint32_t* c;
+    size_t n = 0;
+    int32_t j;
+
+    for( j = 0; j < bins.header->n_targets; j++ ) {
+        n += level_n( bins.header->target_len[j], size );
+    }
+
+    L.size  = size;
+    L.count = c = calloc( n + 1, sizeof(uint32_t) );
+    if( L.count == NULL ) {
+        fprintf( stderr, "Error: out of memory.\n" );
+        exit(1);
+    }
+
+    for( j = 0; j < bins.header->n_targets; j++ ) {
+        m = level_n( bins.header->target_len[j], size );
+        for( i = 0; i < m; i++ ) {
+            for( t = 0; t < r; t++ ) c[i] += count[bins.offset[j] + i*r + t];
+        }
+        c += m;
+    }
+
+    return L;
+}
+
+
+/* In the order this has always printed them: last reference first. */
+void print_level( char** names, const uint32_t* lens, int32_t n_targets,
+                  const level_t* L, int with_size )
+{
+    size_t* offset = malloc( (n_targets + 1) * sizeof(size_t) );
+    int32_t j;
+    uint32_t i;
+
+    for( offset[0] = 0, j = 0; j < n_targets; j++ ) {
+        offset[j + 1] = offset[j] + level_n( lens[j], L->size );
+    }
+
+    for( j = n_targets - 1; j >= 0; j-- ) {
+        for( i = 0; i < level_n( lens[j], L->size ); i++ ) {
+            if( with_size ) {
+                printf( "%s\t%u\t%u\t%u\n", names[j], i*L->size,
+                        L->count[offset[j] + i], L->size );
+            }
+            else {
+                printf( "%s\t%u\t%u\n", names[j], i*L->size, L->count[offset[j] + i] );
             }
         }
     }
+
+    free(offset);
+}
+
+
+
+/* The binary file, in native byte order, which the magic read as a uint32
+ * tells:
+ *
+ *   uint32  BBC_MAGIC
+ *   uint32  number of references, number of sizes
+ *   for each reference: uint32 length, uint32 length of its name, the name
+ *   for each size: uint32 size
+ *   for each size, smallest first: the counts of that level_t
+ */
+
+#define BBC_MAGIC 0x31434242  /* "BBC1" */
+
+
+void write_levels( const char* fn, const level_t* levels, int n )
+{
+    bam_header_t* h = bins.header;
+    uint32_t x, len;
+    size_t m;
+    int32_t j;
+    int i;
+
+    FILE* f = fopen( fn, "wb" );
+    if( f == NULL ) {
+        fprintf( stderr, "Can't open file '%s'.\n", fn );
+        exit(1);
+    }
+
+    x = BBC_MAGIC;    fwrite( &x, sizeof(uint32_t), 1, f );
+    x = h->n_targets; fwrite( &x, sizeof(uint32_t), 1, f );
+    x = n;            fwrite( &x, sizeof(uint32_t), 1, f );
+
+    for( j = 0; j < h->n_targets; j++ ) {
+        len = strlen( h->target_name[j] );
+        fwrite( &h->target_len[j], sizeof(uint32_t), 1, f );
+        fwrite( &len, sizeof(uint32_t), 1, f );
+        fwrite( h->target_name[j], 1, len, f );
+    }
+
+    for( i = 0; i < n; i++ ) fwrite( &levels[i].size, sizeof(uint32_t), 1, f );
+
+    for( i = 0; i < n; i++ ) {
+        for( m = 0, j = 0; j < h->n_targets; j++ ) m += level_n( h->target_len[j], levels[i].size );
+        fwrite( levels[i].count, sizeof(uint32_t), m, f );
+    }
+
+    if( ferror(f) || fclose(f) != 0 ) {
+        fprintf( stderr, "Error: can't write file '%s'.\n", fn );
+        exit(1);
+    }
 }
 
 
-void destroy_counts( chrom_count** C )
+static void read_or_die( void* x, size_t size, size_t n, FILE* f, const char* fn )
 {
-    chrom_count* B;
-    while( *C ) {
-        B = (*C)->next;
-        free( (*C)->seqname );
-        free( (*C)->count );
-        free( *C );
-        *C = B;
+    if( fread( x, size, n, f ) != n ) {
+        fprintf( stderr, "Error: '%s' is not a binned coverage file, or is truncated.\n", fn );
+        exit(1);
     }
 }
 
-void print_counts( chrom_count* C )
+
+/* Print the levels of a binary file: all of them, or the sizes asked for. */
+void export_levels( const char* fn, int all )
 {
-    uint32_t i;
-    while( C ) {
-        for( i = 0; i < C->n; i++ ) {
-            printf( "%s\t%u\t%u\n",  C->seqname, i*k, C->count[i] );
+    uint32_t magic, n_targets, n_levels, len, i, j;
+    level_t* levels;
+    uint32_t* lens;
+    char** names;
+    size_t m;
+    int s, shown;
+
+    FILE* f = fopen( fn, "rb" );
+    if( f == NULL ) {
+        fprintf( stderr, "Can't open file '%s'.\n", fn );
+        exit(1);
+    }
+
+    read_or_die( &magic, sizeof(uint32_t), 1, f, fn );
+    if( magic != BBC_MAGIC ) {
+        fprintf( stderr, "Error: '%s' is not a binned coverage file.\n", fn );
+        exit(1);
+    }
+    read_or_die( &n_targets, sizeof(uint32_t), 1, f, fn );
+    read_or_die( &n_levels, sizeof(uint32_t), 1, f, fn );
+
+    lens  = malloc( (n_targets + 1) * sizeof(uint32_t) );
+    names = malloc( (n_targets + 1) * sizeof(char*) );
+    for( j = 0; j < n_targets; j++ ) {
+        read_or_die( &lens[j], sizeof(uint32_t), 1, f, fn );
+        read_or_die( &len, sizeof(uint32_t), 1, f, fn );
+        names[j] = malloc( len + 1 );
+        read_or_die( names[j], 1, len, f, fn );
+        names[j][len] = '\0';
+    }
+
+    levels = malloc( (n_levels + 1) * sizeof(level_t) );
+    for( i = 0; i < n_levels; i++ ) {
+        read_or_die( &levels[i].size, sizeof(uint32_t), 1, f, fn );
+        if( levels[i].size == 0 ) {
+            fprintf( stderr, "Error: '%s' is not a binned coverage file.\n", fn );
+            exit(1);
         }
+    }
+    for( i = 0; i < n_levels; i++ ) {
+        for( m = 0, j = 0; j < n_targets; j++ ) m += level_n( lens[j], levels[i].size );
+        levels[i].count = malloc( (m + 1) * sizeof(uint32_t) );
+        read_or_die( levels[i].count, sizeof(uint32_t), m, f, fn );
+    }
+    fclose(f);
 
-        C = C->next;
+    if( all ) {
+        for( i = 0; i < n_levels; i++ ) {
+            print_level( names, lens, n_targets, &levels[i], n_levels > 1 );
+        }
     }
+    else {
+        for( s = 0; s < n_sizes; s++ ) {
+            for( shown = 0, i = 0; i < n_levels && !shown; i++ ) {
+                if( levels[i].size != sizes[s] ) continue;
+                print_level( names, lens, n_targets, &levels[i], n_sizes > 1 );
+                shown = 1;
+            }
+            if( !shown ) {
+                fprintf( stderr, "Error: '%s' has no bins of size %u.\n", fn, sizes[s] );
+                exit(1);
+            }
+        }
+    }
+
+    for( i = 0; i < n_levels; i++ ) free( levels[i].count );
+    for( j = 0; j < n_targets; j++ ) free( names[j] );
+    free(levels);
+    free(names);
+    free(lens);
 }
 
 
 
+typedef struct
+{
+    uint32_t* count;
+    uint32_t  n;
+} tally_t;
+
+
 int tally( const bam1_t *b, void* data )
 {
-    chrom_count* C = (chrom_count*)data;
-    if( b->core.tid != C->tid ) return 0;
-    C->count[ b->core.pos / k ]++;
+    tally_t* T = (tally_t*)data;
+    T->count[ b->core.pos / k ]++;
+
+    return 0;
+}
+
+
+void count_indexed( const char* fn, samfile_t* f, const int32_t* slot, uint32_t* count )
+{
+    bam_index_t* idx;
+    tally_t T;
+    int32_t i;
+
+    idx = bam_index_load( fn );
+
+    if( idx == NULL ) {
+        bam_index_build_mt( fn, n_threads );
+        idx = bam_index_load( fn );
+
+        if( idx == NULL ) {
+            fprintf( stderr, "Error: can't load index for bam file '%s'.\n", fn );
+            exit(1);
+        }
+    }
+
+    for( i = 0; i < f->header->n_targets; i++ ) {
+        if( slot[i] < 0 ) continue;
+        T.count = count + bins.offset[slot[i]];
+        T.n     = bins.n[slot[i]];
+        bam_fetch( f->x.bam, idx, i, 0, T.n*k, (void*)&T, tally );
+    }
+
+    bam_index_destroy(idx);
+}
+
+
+/* The same reads as index queries over [0, n*k) of each reference count. */
+void count_sequential( samfile_t* f, const int32_t* slot, uint32_t* count )
+{
+    bam1_t* b = bam_init1();
+    uint32_t bin;
+    int32_t s;
+
+    while( samread( f, b ) >= 0 ) {
+        if( b->core.tid < 0 || b->core.pos < 0 ) continue;
+
+        s = slot[b->core.tid];
+        if( s < 0 ) continue;
+
+        bin = b->core.pos / k;
+        if( bin < bins.n[s] ) count[bins.offset[s] + bin]++;
+    }
+
+    bam_destroy1(b);
+}
+
+
+/* With -e, reads are not counted but estimated from the index alone. The
+ * linear index gives the file offset of the first read in each 16 kb
+ * window, so the compressed bytes from one window to the next are roughly
+ * proportional to the reads in it. For each reference these are scaled to
+ * the number of reads the index keeps for it or, with -c, to a rate of
+ * reads per compressed byte measured by inflating a few sampled blocks. */
+
+#define LIDX_SHIFT 14
+
+typedef struct
+{
+    int      fd;
+    uint64_t coff;   /* the block last looked at */
+    uint32_t bsize;  /* its compressed and inflated sizes */
+    uint32_t isize;
+} blocks_t;
+
+
+/* Read the sizes of the block at coff from its header and footer. */
+static int block_sizes( blocks_t* B, uint64_t coff )
+{
+    uint8_t h[18], t[4];
+
+    if( coff == B->coff && B->bsize > 0 ) return 0;
+
+    B->coff  = coff;
+    B->bsize = B->isize = 0;
+
+    if( pread( B->fd, h, 18, coff ) != 18 ||
+        h[0] != 31 || h[1] != 139 || h[12] != 'B' || h[13] != 'C' ) return -1;
+
+    B->bsize = (h[16] | h[17] << 8) + 1;
+    if( pread( B->fd, t, 4, coff + B->bsize - 4 ) != 4 ) return -1;
+    B->isize = t[0] | t[1] << 8 | t[2] << 16 | (uint32_t) t[3] << 24;
 
     return 0;
 }
 
 
+/* where a virtual offset falls in the compressed file, in bytes */
+static double file_pos( blocks_t* B, uint64_t voff )
+{
+    uint64_t coff = voff >> 16;
+    uint32_t uoff = voff & 0xffff;
+
+    if( uoff == 0 || block_sizes( B, coff ) != 0 || B->isize == 0 ) return coff;
+    return coff + (double) uoff * B->bsize / B->isize;
+}
+
+
+/* Reads per compressed byte, from the records starting in n blocks taken
+ * evenly from those the linear indexes point to. */
+static double sample_rate( blocks_t* B, const bam_index_t* idx, int32_t n_targets, int n )
+{
+    uint8_t *block = malloc( 0x10000 ), *data = malloc( 0x10000 );
+    const uint64_t* lidx;
+    const char* error;
+    uint64_t* voffs = NULL;
+    size_t n_voffs = 0, i, j;
+    uint64_t reads = 0;
+    double bytes = 0.0;
+    uint32_t p, len;
+    int32_t tid;
+    int m, size;
+
+    for( tid = 0; tid < n_targets; tid++ ) {
+        m = bam_index_linear( idx, tid, &lidx );
+        voffs = realloc( voffs, (n_voffs + m + 1) * sizeof(uint64_t) );
+        for( j = 0; j < (size_t) m; j++ ) {
+            if( lidx[j] == 0 ) continue;
+            if( n_voffs > 0 && voffs[n_voffs - 1] >> 16 == lidx[j] >> 16 ) continue;
+            voffs[n_voffs++] = lidx[j];
+        }
+    }
+
+    for( i = 0; i < (size_t) n && n_voffs > 0; i++ ) {
+        j = (2 * i + 1) * n_voffs / (2 * n);
+        if( i > 0 && j == (2 * (i - 1) + 1) * n_voffs / (2 * n) ) continue;
+
+        if( block_sizes( B, voffs[j] >> 16 ) != 0 ||
+            pread( B->fd, block, B->bsize, B->coff ) != B->bsize ) continue;
+
+        size = bgzf_inflate_block( block, B->bsize, data, 0x10000, &error );
+        if( size <= 0 ) continue;
+
+        /* records from the one the index points to up to the block's end */
+        for( p = voffs[j] & 0xffff, m = 0; p + 4 <= (uint32_t) size; m++ ) {
+            memcpy( &len, data + p, 4 );
+            p += 4 + len;
+        }
+
+        reads += m;
+        bytes += (double) (size - (voffs[j] & 0xffff)) * B->bsize / size;
+    }
+
+    free(voffs);
+    free(block);
+    free(data);
+
+    return bytes > 0.0 ? reads / bytes : 0.0;
+}
+
+
+void estimate_file( const char* fn, samfile_t* f, const int32_t* slot, uint32_t* count )
+{
+    bam_index_t* idx;
+    blocks_t B;
+    const uint64_t* lidx;
+    uint64_t beg, end, n_mapped, n_unmapped;
+    double rate = 0.0, total, bytes, x, carry, *w = NULL, *e = NULL;
+    uint64_t w_beg, w_end, b_beg, b_end, len;
+    uint32_t i, n_bins, bin;
+    int32_t tid, t;
+    int n, m;
+    int samples = n_samples; /* this file's own, as -j runs several at once */
+    struct stat st;
+
+    idx = bam_index_load( fn );
+    if( idx == NULL ) {
+        fprintf( stderr, "Error: estimating needs an index for bam file '%s'.\n", fn );
+        exit(1);
+    }
+
+    B.fd = open( fn, O_RDONLY );
+    B.coff = 0;
+    B.bsize = B.isize = 0;
+    if( B.fd < 0 || fstat( B.fd, &st ) != 0 ) {
+        fprintf( stderr, "Can't open file '%s'.\n", fn );
+        exit(1);
+    }
+
+    if( samples > 0 ) rate = sample_rate( &B, idx, f->header->n_targets, samples );
+
+    for( tid = 0; tid < f->header->n_targets; tid++ ) {
+        if( slot[tid] < 0 ) continue;
+
+        n = bam_index_linear( idx, tid, &lidx );
+        if( n == 0 ) continue;
+
+        if( bam_index_stats( idx, tid, &beg, &end, &n_mapped, &n_unmapped ) != 0 ) {
+            /* an old index: with nothing to count the reads by, sample */
+            for( i = 0; i < (uint32_t) n && lidx[i] == 0; i++ );
+            beg = end = i < (uint32_t) n ? lidx[i] : 0;
+            if( rate == 0.0 && samples == 0 ) {
+                samples = 16;
+                rate = sample_rate( &B, idx, f->header->n_targets, samples );
+            }
+            n_mapped = n_unmapped = 0;
+        }
+
+        /* no end recorded, as in old indexes and for the last reference
+         * of samtools' own: the reads end where the next reference's begin */
+        if( end <= beg ) {
+            end = (uint64_t) st.st_size << 16;
+            for( t = tid + 1; t < f->header->n_targets && end == (uint64_t) st.st_size << 16; t++ ) {
+                const uint64_t* next;
+                m = bam_index_linear( idx, t, &next );
+                for( i = 0; i < (uint32_t) m; i++ ) {
+                    if( next[i] != 0 ) {
+                        end = next[i];
+                        break;
+                    }
+                }
+            }
+        }
+
+        /* compressed bytes of each window */
+        w = realloc( w, n * sizeof(double) );
+        for( bytes = 0.0, i = 0; i < (uint32_t) n; i++ ) {
+            w[i] = file_pos( &B, i + 1 < (uint32_t) n && lidx[i + 1] != 0 ? lidx[i + 1] : end )
+                 - file_pos( &B, lidx[i] != 0 ? lidx[i] : beg );
+            if( i + 1 < (uint32_t) n && lidx[i + 1] == 0 ) w[i] = 0.0;
+            if( w[i] < 0.0 ) w[i] = 0.0;
+            bytes += w[i];
+        }
+
+        total = samples > 0 ? rate * bytes : (double) (n_mapped + n_unmapped);
+        if( bytes == 0.0 ) {
+            for( i = 0; i + 1 < (uint32_t) n && lidx[i] == 0; i++ );
+            w[i] = bytes = 1.0;
+        }
+
+        /* spread each window over the bins it overlaps, the last only
+         * over its part within the reference */
+        n_bins = bins.n[slot[tid]];
+        len    = f->header->target_len[tid];
+        e = realloc( e, n_bins * sizeof(double) );
+        memset( e, 0, n_bins * sizeof(double) );
+
+        for( i = 0; i < (uint32_t) n; i++ ) {
+            if( w[i] == 0.0 ) continue;
+            x = total * w[i] / bytes;
+
+            w_beg = (uint64_t) i << LIDX_SHIFT;
+            w_end = (uint64_t) (i + 1) << LIDX_SHIFT;
+            if( w_end > len ) w_end = len;
+            if( w_beg >= w_end ) continue;
+
+            for( bin = w_beg / k; bin < n_bins && (uint64_t) bin * k < w_end; bin++ ) {
+                b_beg = (uint64_t) bin * k;
+                b_end = b_beg + k;
+                e[bin] += x * ((b_end < w_end ? b_end : w_end) - (b_beg > w_beg ? b_beg : w_beg))
+                            / (w_end - w_beg);
+            }
+        }
+
+        /* round, carrying the remainders along so that sums over
+         * neighbouring bins, as in coarser sizes, stay within one read */
+        for( carry = 0.0, bin = 0; bin < n_bins; bin++ ) {
+            x = e[bin] + carry;
+            i = x > 0.0 ? (uint32_t) (x + 0.5) : 0;
+            carry = x - i;
+            count[bins.offset[slot[tid]] + bin] += i;
+        }
+    }
+
+    free(w);
+    free(e);
+    close( B.fd );
+    bam_index_destroy(idx);
+}
+
+
+
+void count_file( const char* fn, uint32_t* count )
+{
+    samfile_t* f;
+    int32_t* slot;
+
+    f = samopen( fn, "rb", NULL );
+    if( f == NULL ) {
+        fprintf( stderr, "Can't open file '%s'.\n", fn );
+        exit(1);
+    }
+
+    slot = map_tids( f->header );
+
+    if( estimate )        estimate_file( fn, f, slot, count );
+    else if( sequential ) count_sequential( f, slot, count );
+    else                  count_indexed( fn, f, slot, count );
+
+    free(slot);
+    samclose(f);
+}
+
+
+
+/* With -j, each thread counts whole files into counts of its own, which
+ * are added up once all files are done. */
+typedef struct
+{
+    char**          fns;
+    int             n_fns;
+    int             next;
+    pthread_mutex_t lock;
+} jobs_t;
+
+
+void* count_worker( void* arg )
+{
+    jobs_t* J = (jobs_t*)arg;
+    uint32_t* count = calloc( bins.n_bins, sizeof(uint32_t) );
+    int i;
+
+    if( count == NULL ) {
+        fprintf( stderr, "Error: out of memory.\n" );
+        exit(1);
+    }
+
+    while( 1 ) {
+        pthread_mutex_lock( &J->lock );
+        i = J->next++;
+        pthread_mutex_unlock( &J->lock );
+
+        if( i >= J->n_fns ) break;
+        count_file( J->fns[i], count );
+    }
+
+    return count;
+}
+
+
 
 int main( int argc, char* argv[] )
 {
-    const char* optstring = "k:";
+    const char* optstring = "k:@:sj:o:x:ec:";
+    static struct option long_options[] = {
+        {"estimate",  no_argument,       0, 'e'},
+        {"calibrate", required_argument, 0, 'c'},
+        {0,0,0,0} };
+    const char* out_fn = NULL;
+    const char* export_fn = NULL;
+    int all_sizes = 1;
     int c;
 
     do {
-        c = getopt( argc, argv, optstring );
+        c = getopt_long( argc, argv, optstring, long_options, NULL );
         switch( c ) {
             case 'k':
-                k = atoi(optarg);
+                parse_sizes( optarg );
+                all_sizes = 0;
+                break;
+
+            case 'o':
+                out_fn = optarg;
+                break;
+
+            case 'x':
+                export_fn = optarg;
+                break;
+
+            case '@':
+                n_threads = atoi(optarg);
+                break;
+
+            case 's':
+                sequential = 1;
+                break;
+
+            case 'j':
+                n_jobs = atoi(optarg);
+                break;
+
+            case 'e':
+                estimate = 1;
+                break;
+
+            case 'c':
+                n_samples = atoi(optarg);
                 break;
         }
     } while( c != -1 );
 
+    if( export_fn != NULL ) {
+        export_levels( export_fn, all_sizes );
+        return 0;
+    }
+
     if( optind >= argc ) {
         usage();
         fprintf( stderr, "Too few arguments.\n" );
         exit(1);
     }
 
-    samfile_t* f; 
-    bam_index_t* idx;
+    if( n_jobs < 1 ) n_jobs = 1;
+    if( n_jobs > argc - optind ) n_jobs = argc - optind;
 
-    chrom_count* C = NULL;
-    chrom_count* B;
 
-    for( ; optind < argc; optind++ ) {
-        f = samopen( argv[optind], "rb", NULL );
-        if( f == NULL ) {
-            fprintf( stderr, "Can't open file '%s'.\n", argv[optind] );
-            exit(1);
-        }
+    /* the first file decides on the bins */
+    bamFile fp = bam_open( argv[optind], "r" );
+    if( fp == NULL ) {
+        fprintf( stderr, "Can't open file '%s'.\n", argv[optind] );
+        exit(1);
+    }
 
+    bam_header_t* header = bam_header_read( fp );
+    bam_close( fp );
 
-        if( C == NULL ) {
-            if( f->header == NULL ) {
-                fprintf( stderr, "Error: bam file '%s' is missing a header.\n", argv[optind] );
-                exit(1);
-            }
+    if( header == NULL ) {
+        fprintf( stderr, "Error: bam file '%s' is missing a header.\n", argv[optind] );
+        exit(1);
+    }
 
-            C = init_counts( f->header );
-        }
+    init_bins( header );
 
-        set_tids( C, f->header );
 
-        idx = bam_index_load( argv[optind] );
+    jobs_t J;
+    J.fns   = argv + optind;
+    J.n_fns = argc - optind;
+    J.next  = 0;
+    pthread_mutex_init( &J.lock, NULL );
 
-        if( idx == NULL ) {
-            bam_index_build( argv[optind] );
-            idx = bam_index_load( argv[optind] );
+    pthread_t* threads = malloc( n_jobs * sizeof(pthread_t) );
+    uint32_t* count = NULL;
+    uint32_t* part;
+    size_t i;
+    int j;
 
-            if( idx == NULL ) {
-                fprintf( stderr, "Error: can't load index for bam file '%s'.\n", argv[optind] );
-                exit(1);
-            }
+    for( j = 0; j < n_jobs; j++ ) {
+        if( pthread_create( &threads[j], NULL, count_worker, &J ) != 0 ) {
+            fprintf( stderr, "Error: can't start thread.\n" );
+            exit(1);
         }
+    }
 
-        for( B = C; B != NULL; B = B->next ) {
-            bam_fetch( f->x.bam, idx, B->tid, 0, B->n*k, (void*)B, tally );
+    for( j = 0; j < n_jobs; j++ ) {
+        pthread_join( threads[j], (void**)&part );
+        if( count == NULL ) count = part;
+        else {
+            for( i = 0; i < bins.n_bins; i++ ) count[i] += part[i];
+            free(part);
         }
+    }
+
+    pthread_mutex_destroy( &J.lock );
+    free(threads);
 
-        bam_index_destroy(idx);
-        samclose(f);
+    level_t* levels = malloc( n_sizes * sizeof(level_t) );
+    for( j = 0; j < n_sizes; j++ ) levels[j] = make_level( count, sizes[j] );
+
+    if( out_fn != NULL ) write_levels( out_fn, levels, n_sizes );
+    else {
+        for( j = 0; j < n_sizes; j++ ) {
+            print_level( bins.header->target_name, bins.header->target_len,
+                         bins.header->n_targets, &levels[j], n_sizes > 1 );
+        }
     }
 
-    print_counts( C );
+    for( j = 0; j < n_sizes; j++ ) free( levels[j].count );
+    free(levels);
+    free(count);
+    destroy_bins();
 
     return 0;
 }
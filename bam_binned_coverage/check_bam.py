@@ -0,0 +1,99 @@
+#!/usr/bin/env python
+
+'''
+Data for 'make check'.
+
+    check_bam.py out.bam      write a small sorted BAM whose last reference
+                              fits in one 16 kb window of the linear index
+    check_bam.py -s in.bai    end the last reference's pseudo-bin where it
+                              begins, as samtools' own indexes do
+'''
+
+import struct, zlib
+from sys import argv, stderr, exit
+
+
+refs = [ ('scaf1', 200000, 10), ('scaf2', 200000, 10), ('scaf3', 12000, 2) ]
+read_len = 50
+
+
+def reg2bin( beg, end ):
+    end -= 1
+    if beg >> 14 == end >> 14: return ((1 << 15) - 1) // 7 + (beg >> 14)
+    if beg >> 17 == end >> 17: return ((1 << 12) - 1) // 7 + (beg >> 17)
+    if beg >> 20 == end >> 20: return ((1 << 9) - 1) // 7 + (beg >> 20)
+    if beg >> 23 == end >> 23: return ((1 << 6) - 1) // 7 + (beg >> 23)
+    if beg >> 26 == end >> 26: return ((1 << 3) - 1) // 7 + (beg >> 26)
+    return 0
+
+
+def bgzf_block( data ):
+    c = zlib.compressobj( 6, zlib.DEFLATED, -15 )
+    z = c.compress(data) + c.flush()
+    return b'\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0' \
+         + struct.pack( '<H', len(z) + 25 ) + z \
+         + struct.pack( '<II', zlib.crc32(data) & 0xffffffff, len(data) )
+
+
+def record( tid, pos, name, seed ):
+    bases = ''.join( 'ACGT'[(seed * 7 + i * i * 13 + (seed >> 3)) % 4]
+                     for i in range(read_len) )
+    seq = bytes( ( '=ACMGRSVTWYHKDBN'.index(bases[i]) << 4 )
+                 | '=ACMGRSVTWYHKDBN'.index(bases[i + 1])
+                 for i in range(0, read_len, 2) )
+    name = name.encode() + b'\0'
+    core = struct.pack( '<iiIIiiii', tid, pos,
+                        reg2bin(pos, pos + read_len) << 16 | 60 << 8 | len(name),
+                        0 << 16 | 1, read_len, -1, -1, 0 )
+    body = core + name + struct.pack( '<I', read_len << 4 ) + seq + b'\x28' * read_len
+    return struct.pack( '<i', len(body) ) + body
+
+
+def write_bam( fn ):
+    text = ''.join( '@SQ\tSN:%s\tLN:%d\n' % (name, length) for name, length, _ in refs )
+    header = b'BAM\1' + struct.pack( '<i', len(text) ) + text.encode() \
+           + struct.pack( '<i', len(refs) )
+    for name, length, _ in refs:
+        header += struct.pack( '<i', len(name) + 1 ) + name.encode() + b'\0' \
+                + struct.pack( '<i', length )
+
+    out = open( fn, 'wb' )
+    out.write( bgzf_block(header) )
+
+    buf = b''
+    n = 0
+    for tid, (name, length, step) in enumerate(refs):
+        for pos in range(0, length - read_len, step):
+            buf += record( tid, pos, 'r%d' % n, n )
+            n += 1
+            if len(buf) > 60000:
+                out.write( bgzf_block(buf) )
+                buf = b''
+    if buf: out.write( bgzf_block(buf) )
+    out.write( bgzf_block(b'') )
+    out.close()
+
+
+def samtools_index( fn ):
+    d = bytearray( open( fn, 'rb' ).read() )
+    o = 4
+    n, = struct.unpack_from( '<i', d, o ); o += 4
+    for tid in range(n):
+        n_bins, = struct.unpack_from( '<i', d, o ); o += 4
+        for b in range(n_bins):
+            bin, n_chunks = struct.unpack_from( '<Ii', d, o ); o += 8
+            if tid == n - 1 and bin == 37450:
+                beg, = struct.unpack_from( '<Q', d, o )
+                struct.pack_into( '<Q', d, o + 8, beg )
+            o += 16 * n_chunks
+        n_intv, = struct.unpack_from( '<i', d, o ); o += 4 + 8 * n_intv
+    open( fn, 'wb' ).write(d)
+
+
+if len(argv) == 2:
+    write_bam( argv[1] )
+elif len(argv) == 3 and argv[1] == '-s':
+    samtools_index( argv[2] )
+else:
+    stderr.write( __doc__ )
+    exit(1)
@@ -0,0 +1,69 @@
+#ifndef BGZF_INFLATE_H
+#define BGZF_INFLATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Decompression backends for BGZF blocks.
+ *
+ * A BGZF block never inflates to more than 64 KB, so besides zlib's
+ * streaming inflate there is a decoder that works on the whole block in one
+ * call, with no window or resumable state. Backends are:
+ *
+ *   "zlib"          zlib inflate, zlib crc32
+ *   "block"         whole-block decoder, zlib crc32
+ *   "block-pclmul"  whole-block decoder, PCLMULQDQ folding crc32
+ *
+ * The fastest backend this CPU supports is picked on first use. Setting the
+ * BGZF_INFLATER environment variable, or calling bgzf_set_inflater, picks
+ * another one.
+ */
+
+typedef struct {
+	const char *name;
+	/* Non-zero if the backend can run on this machine. */
+	int (*usable)(void);
+	/* Inflate a raw deflate stream; returns the inflated size or -1. */
+	int (*inflate)(const uint8_t *src, int src_len, uint8_t *dst, int dst_size);
+	/* CRC-32 as in gzip, with zlib's crc32() calling convention. */
+	uint32_t (*crc32)(uint32_t crc, const uint8_t *buf, size_t len);
+} bgzf_inflater_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Inflate one BGZF block (block_length bytes, header and footer included)
+ * into dst and check it against the CRC-32 and ISIZE in the footer.
+ * Returns the inflated size, or -1 with *error set. Safe to call from
+ * several threads at once.
+ */
+int bgzf_inflate_block(const uint8_t *block, int block_length,
+                       uint8_t *dst, int dst_size, const char **error);
+
+/* CRC-32 of buf using the active backend's kernel. */
+uint32_t bgzf_crc32(uint32_t crc, const void *buf, size_t len);
+
+/*
+ * Select a backend by name, or the fastest usable one if name is NULL.
+ * Returns zero on success, -1 if the name is unknown or the backend cannot
+ * run here. Must not be called while other threads are inflating.
+ */
+int bgzf_set_inflater(const char *name);
+
+/* The active backend. */
+const bgzf_inflater_t *bgzf_get_inflater(void);
+
+/*
+ * All backends, fastest first, terminated by an entry with a NULL name.
+ * Includes backends that cannot run here; check usable().
+ */
+const bgzf_inflater_t *bgzf_inflaters(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <unistd.h>
 
 
 /* any gap at or above this length is considered a splice junction */
@@ -14,16 +15,26 @@ const int min_splice_length = 50;
 
 int main(int argc, char* argv[])
 {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: bam-summarize reads.bam\n");
+    int c, n_threads = 1;
+    while ((c = getopt(argc, argv, "@:")) != -1) {
+        if (c == '@') n_threads = atoi(optarg);
+        else {
+            fprintf(stderr, "Usage: bam-summarize [-@ threads] reads.bam\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: bam-summarize [-@ threads] reads.bam\n");
         exit(EXIT_FAILURE);
     }
 
-    samfile_t* f = samopen(argv[1], "rb", NULL);
+    samfile_t* f = samopen(argv[optind], "rb", NULL);
     if (f == NULL) {
-        fprintf(stderr, "can't open bam file %s\n", argv[1]);
+        fprintf(stderr, "can't open bam file %s\n", argv[optind]);
         exit(1);
     }
+    samthreads(f, n_threads, 0);
 
     bam1_t* b = bam_init1();
 
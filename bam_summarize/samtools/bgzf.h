@@ -53,9 +53,10 @@ typedef struct {
     int64_t block_address;
     int block_length;
     int block_offset;
-	int cache_size;
+	int cache_size; // zero if this handle bypasses the block cache
     const char* error;
-	void *cache; // a pointer to a hash table
+	uint64_t cache_id; // identifies the file in the block cache
+	void *mt; // multi-threaded state; NULL if single-threaded
 } BGZF;
 
 #ifdef __cplusplus
@@ -122,9 +123,46 @@ int64_t bgzf_seek(BGZF* fp, int64_t pos, int where);
  * Set the cache size. Zero to disable. By default, caching is
  * disabled. The recommended cache size for frequent random access is
  * about 8M bytes.
+ *
+ * The cache is shared by all handles (see bgzf_cache_set_size). A
+ * non-zero size grows it to at least cache_size bytes; zero makes this
+ * handle bypass it.
  */
 void bgzf_set_cache_size(BGZF *fp, int cache_size);
 
+/*
+ * Inflated blocks are cached in a process-wide LRU shared by every open
+ * handle, so handles on the same file reuse each other's blocks. Set its
+ * capacity in bytes; zero, the default, disables it. Thread-safe.
+ */
+void bgzf_cache_set_size(size_t size);
+
+typedef struct {
+	uint64_t hits, misses, evictions;
+	size_t size, capacity; // bytes in use, and allowed
+} bgzf_cache_stats_t;
+
+/* Counters of the block cache since start or the last reset. */
+void bgzf_cache_stats(bgzf_cache_stats_t *stats);
+void bgzf_cache_reset_stats(void);
+
+/*
+ * Inflate or deflate blocks on a pool of n_threads worker threads, keeping
+ * up to n_sub_blks blocks per thread in flight. In read mode the workers read
+ * compressed blocks ahead of the caller and blocks are handed back in file
+ * order, so bgzf_read, bgzf_seek and bgzf_tell behave exactly as before. In
+ * write mode full blocks are deflated in parallel and written in order;
+ * bgzf_flush waits until every queued block is written. Zero or negative
+ * n_sub_blks selects a default.
+ * Returns zero on success, -1 on error.
+ */
+int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks);
+
+/*
+ * Return the file offset of the compressed block following the current one.
+ */
+int64_t bgzf_htell(BGZF *fp);
+
 int bgzf_check_EOF(BGZF *fp);
 int bgzf_read_block(BGZF* fp);
 int bgzf_flush(BGZF* fp);
@@ -143,11 +181,7 @@ static inline int bgzf_getc(BGZF *fp)
 	}
 	c = ((unsigned char*)fp->uncompressed_block)[fp->block_offset++];
     if (fp->block_offset == fp->block_length) {
-#ifdef _USE_KNETFILE
-        fp->block_address = knet_tell(fp->x.fpr);
-#else
-        fp->block_address = ftello(fp->file);
-#endif
+        fp->block_address = bgzf_htell(fp);
         fp->block_offset = 0;
         fp->block_length = 0;
     }
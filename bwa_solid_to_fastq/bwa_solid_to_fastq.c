@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include "colorspace.h"
 
 
 
@@ -63,22 +64,12 @@ int get_quals( char* in, int* out )
 
 void double_encode( int n, char* read_seq, char* qual_seq, int* quals )
 {
-    /* convert read sequence */
-    char* s = read_seq+2;
-    int i = 0;
-
-    while( *s ) {
-        switch( *s ) {
-            case '0' : read_seq[i++] = 'A'; break;
-            case '1' : read_seq[i++] = 'C'; break;
-            case '2' : read_seq[i++] = 'G'; break;
-            case '3' : read_seq[i++] = 'T'; break;
-            case '.' : read_seq[i++] = 'N'; break;
-            default: break;
-        };
-        s++;
-    }
-    read_seq[i] = '\0';
+    /* convert read sequence, less the primer and first color */
+    size_t len = strcspn( read_seq, "\r\n" );
+    int i;
+
+    if( len < 2 ) read_seq[0] = '\0';
+    else          cs_double_encode( read_seq + 2, len - 2, read_seq );
 
     /* convert quality sequence */
     for( i = 1; i < n; i++ ) {
@@ -0,0 +1,29 @@
+
+#ifndef COLORSPACE
+#define COLORSPACE
+
+#include <stdlib.h>
+
+
+/* SOLiD colorspace reads: a primer base, then a color 0-3 for each pair of
+ * adjacent bases, or '.' where it was not called. With A, C, G, T as 0-3,
+ * each base is the last one xor the color between them, so decoding is a
+ * prefix xor over the colors, which is done 16 at a time where SSE2 is
+ * available, and one at a time otherwise.
+ *
+ * The same code is copied into every tool that reads colorspace. */
+
+
+/* Decode the n characters of cs, primer included, into n bases in out,
+ * which may be cs. The primer is copied as it is, and every base from the
+ * first color that is not 0-3, or all of them if the primer is not a base,
+ * is N. Returns n. */
+size_t cs_decode( const char* cs, size_t n, char* out );
+
+/* BWA's double encoding: each of n colors written as a base, A, C, G, T for
+ * 0-3 and N for anything else, into out, which may be cs. Returns n. */
+size_t cs_double_encode( const char* cs, size_t n, char* out );
+
+
+#endif
+
@@ -0,0 +1,30 @@
+from libc.stdlib cimport malloc, free
+
+
+cdef extern from 'colorspace.h':
+    size_t cs_decode( const char* cs, size_t n, char* out )
+
+
+
+def decode(bytes cs):
+    '''
+    decode(cs) -> seq
+
+    Decode a colorspace read, given with its primer base, into nucleotides,
+    the primer left off. Every base after a color that is not 0-3 is N.
+    '''
+
+    cdef size_t n = len(cs)
+    if n == 0:
+        return b''
+
+    cdef bytes out
+    cdef char* c_out = <char*>malloc((n + 1) * sizeof(char))
+
+    cs_decode(cs, n, c_out)
+
+    out = c_out[1:n]
+    free(c_out)
+
+    return out
+
@@ -0,0 +1,19 @@
+#!/usr/bin/env python
+
+
+from distutils.core import setup
+from distutils.extension import Extension
+from Cython.Distutils import build_ext
+
+
+ext_modules = [Extension(name         = 'colorspace',
+                         sources      = ['colorspace.pyx', 'colorspace/colorspace.c'],
+                         include_dirs = ['colorspace'])]
+
+
+setup(
+        name = 'colorspace',
+        cmdclass = {'build_ext': build_ext},
+        ext_modules = ext_modules
+)
+
@@ -91,6 +91,15 @@ extern "C" {
 
 	char *samfaipath(const char *fn_ref);
 
+	/*!
+	  @abstract     Decompress or compress a BAM file on several threads
+	  @param  fp    file handler opened with "rb" or "wb"
+	  @param  n_threads  number of worker threads; 1 or less is a no-op
+	  @param  n_sub_blks blocks kept in flight per thread; 0 for default
+	  @return       0 on success; -1 if fp is not a BAM file
+	 */
+	int samthreads(samfile_t *fp, int n_threads, int n_sub_blks);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,6 +12,7 @@ samtools_src = \
     samtools/bam_index.c
     samtools/bam_pileup.c
     samtools/bgzf.c
+    samtools/bgzf_inflate.c
     samtools/faidx.c
     samtools/knetfile.c
     samtools/kstring.c
@@ -23,6 +24,7 @@ samtools_src = \
 ext_modules = [Extension(name          = 'faidx',
                          sources       = ['faidx.pyx'] + samtools_src,
                          include_dirs  = ['samtoools'],
+                         libraries     = ['z', 'pthread'],
                          define_macros = [('_USE_KNETFILE', None),
                                           ('_FILE_OFFSET_BITS', '64')])]
 
@@ -17,8 +17,10 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <samtools/sam.h>
 #include "hash.h"
+#include "fastq_reader.h"
 
 
 
@@ -31,44 +33,8 @@ void usage()
                      "Options:\n"
                      "-v         invert, i.e. keep only unaligned reads from in.fastq\n"
                      "-S         filter is in SAM format\n"
-                     "-b         filter is in BAM format (default)\n\n" );
-}
-
-
-
-void double_encode( int n, char* read_seq, char* qual_seq, int* quals )
-{
-    /* convert read sequence */
-    char* s = read_seq+2;
-    int i = 0;
-
-    while( *s ) {
-        switch( *s ) {
-            case '0' : read_seq[i++] = 'A'; break;
-            case '1' : read_seq[i++] = 'C'; break;
-            case '2' : read_seq[i++] = 'G'; break;
-            case '3' : read_seq[i++] = 'T'; break;
-            case '.' : read_seq[i++] = 'N'; break;
-            default: break;
-        };
-        s++;
-    }
-    read_seq[i] = '\0';
-
-    /* convert quality sequence */
-    for( i = 1; i < n; i++ ) {
-        if( quals[i] == -1 ) quals[i] = 0;
-        qual_seq[i-1] = (char)(quals[i]+33);
-    }
-    qual_seq[i-1] = '\0';
-}
-
-char* fgets_noncomment( char* buf, size_t buf_size, FILE* f )
-{
-    char* r;
-    while( (r = fgets( buf, buf_size, f)) && r[0] == '#' );
-
-    return r;
+                     "-b         filter is in BAM format (default)\n"
+                     "-@ N       with N > 1, decompress in.fastq on a thread of its own\n\n" );
 }
 
 
@@ -107,9 +73,9 @@ int main( int argc, char* argv[] )
 {
     bool input_bam = true;
     bool invert    = false;
-    bool using_stdin = false;
+    int  n_threads = 1;
 
-    const char* optstring = "vbS";
+    const char* optstring = "vbS@:";
     int opt;
 
     do {
@@ -124,6 +90,9 @@ int main( int argc, char* argv[] )
             case 'S':
                 input_bam = false;
                 break;
+            case '@':
+                n_threads = atoi(optarg);
+                break;
         }
     } while( opt != -1 );
 
@@ -136,19 +105,17 @@ int main( int argc, char* argv[] )
 
     const char* filter_fn = argv[optind++];
 
-    FILE* input_f;
+    int input_fd;
     if( optind >= argc ) {
-        input_f = stdin;
-        using_stdin = true;
+        input_fd = STDIN_FILENO;
     }
     else {
         const char* input_fn  = argv[optind++];
-        input_f  = fopen( input_fn, "r" );
-        if( input_f == NULL ) {
+        input_fd = open( input_fn, O_RDONLY );
+        if( input_fd < 0 ) {
             fprintf( stderr, "Can't open fastq file '%s'.\n", input_fn );
             exit(1);
         }
-        using_stdin = false;
     }
 
 
@@ -165,38 +132,25 @@ int main( int argc, char* argv[] )
     fprintf( stderr, "done. (%zd hashed)\n", T->m );
 
 
-    const size_t buf_size = 4096;
-
-    char* buf = malloc( 4*buf_size );
-
-
-    char* read_name = buf + 0*buf_size;
-    char* read_seq  = buf + 1*buf_size;
-    char* qual_name = buf + 2*buf_size;
-    char* qual_seq  = buf + 3*buf_size;
+    fastq_reader_t* input_f = fastq_reader_open( input_fd, n_threads > 1 );
+    fastq_record_t  rec;
 
     size_t n = 0;
 
     fprintf( stderr, "filtering ... " );
 
-    /* iterate over groups of four lines */
-    while( fgets_noncomment( read_name, buf_size, input_f ) &&
-           fgets_noncomment( read_seq,  buf_size, input_f ) &&
-           fgets_noncomment( qual_name, buf_size, input_f ) &&
-           fgets_noncomment( qual_seq,  buf_size, input_f ) )
+    while( fastq_reader_next( input_f, &rec ) )
     {
-        n++;        
-        read_name[strlen(read_name)-1] = '\0';
-        if( invert == table_member( T, read_name+1 ) ) continue;
+        n++;
+        if( invert == table_member( T, rec.id1.s ) ) continue;
 
-        printf( "%s\n%s%s%s", read_name, read_seq, qual_name, qual_seq );
+        fastq_record_print( stdout, &rec );
     }
 
     fprintf( stderr, "done. (%zd reads processed)\n", n );
 
 
-    if( !using_stdin ) fclose( input_f );
-    free(buf);
+    fastq_reader_close( input_f );
     table_destroy(T);
     free(T);
 
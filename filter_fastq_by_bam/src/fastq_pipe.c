@@ -0,0 +1,217 @@
+/*
+ * fastq_pipe :
+ * FASTQ read and parsed ahead of its consumer.
+ *
+ */
+
+#include "fastq_pipe.h"
+#include "common.h"
+#include "samtools/bgzf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+
+#define PIPE_QUEUE   4
+#define BATCH_RECS   4096
+
+/* offsets stand in for pointers while the batch buffer may move */
+#define NO_LINE ((size_t) -1)
+
+
+struct fastq_pipe_
+{
+    fastq_reader_t* reader;
+    BGZF* bgzf;  /* or NULL, if the reader inflates */
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    fastq_batch_t batch[PIPE_QUEUE];
+    size_t head, tail;  /* batches [head, tail) are full */
+    bool   held;        /* the head batch is with the consumer */
+    bool   stop;
+};
+
+
+static int bgzf_source_read(void* source, char* buf, size_t size)
+{
+    return bgzf_read((BGZF*) source, buf, size);
+}
+
+
+static size_t batch_line(fastq_batch_t* b, const fastq_view_t* v)
+{
+    size_t off = b->buf_n;
+
+    if (v->s == NULL) return NO_LINE;
+
+    while (b->buf_size < b->buf_n + v->n + 1) {
+        b->buf_size *= 2;
+        b->buf = realloc_or_die(b->buf, b->buf_size);
+    }
+
+    memcpy(b->buf + b->buf_n, v->s, v->n + 1);
+    b->buf_n += v->n + 1;
+
+    return off;
+}
+
+
+static void set_line(fastq_batch_t* b, fastq_view_t* v)
+{
+    size_t off = (size_t) v->s;
+    v->s = off == NO_LINE ? NULL : b->buf + off;
+}
+
+
+/* Copy up to BATCH_RECS records out of the reader's buffer. */
+static void fill_batch(fastq_reader_t* reader, fastq_batch_t* b)
+{
+    fastq_record_t rec, *r;
+    size_t i;
+
+    b->n = b->buf_n = 0;
+
+    while (b->n < BATCH_RECS && fastq_reader_next(reader, &rec)) {
+        r = &b->recs[b->n++];
+        r->id1.s  = (char*) batch_line(b, &rec.id1);  r->id1.n  = rec.id1.n;
+        r->seq.s  = (char*) batch_line(b, &rec.seq);  r->seq.n  = rec.seq.n;
+        r->id2.s  = (char*) batch_line(b, &rec.id2);  r->id2.n  = rec.id2.n;
+        r->qual.s = (char*) batch_line(b, &rec.qual); r->qual.n = rec.qual.n;
+    }
+
+    for (i = 0; i < b->n; i++) {
+        set_line(b, &b->recs[i].id1);
+        set_line(b, &b->recs[i].seq);
+        set_line(b, &b->recs[i].id2);
+        set_line(b, &b->recs[i].qual);
+    }
+}
+
+
+static void* pipe_thread(void* arg)
+{
+    fastq_pipe_t* p = arg;
+    fastq_batch_t* b;
+
+    while (1) {
+        pthread_mutex_lock(&p->lock);
+        while (!p->stop && p->tail - p->head == PIPE_QUEUE) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        if (p->stop) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        b = &p->batch[p->tail % PIPE_QUEUE];
+        pthread_mutex_unlock(&p->lock);
+
+        /* the batch is not seen by the consumer until tail moves past it */
+        fill_batch(p->reader, b);
+
+        pthread_mutex_lock(&p->lock);
+        p->tail++;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+
+        /* an empty batch marks the end */
+        if (b->n == 0) break;
+    }
+
+    return NULL;
+}
+
+
+fastq_pipe_t* fastq_pipe_open(const char* fn, int n_threads)
+{
+    fastq_pipe_t* p = malloc_or_die(sizeof(fastq_pipe_t));
+    size_t i;
+    int fd;
+
+    if (n_threads > 1 && bgzf_check_bgzf(fn) == 1) {
+        if ((p->bgzf = bgzf_open(fn, "r")) == NULL) {
+            fprintf(stderr, "Can't open FASTQ file %s.\n", fn);
+            exit(EXIT_FAILURE);
+        }
+        bgzf_mt(p->bgzf, n_threads, 0);
+        p->reader = fastq_reader_open_source(bgzf_source_read, p->bgzf);
+    }
+    else {
+        if ((fd = open(fn, O_RDONLY)) < 0) {
+            fprintf(stderr, "Can't open FASTQ file %s.\n", fn);
+            exit(EXIT_FAILURE);
+        }
+        p->bgzf   = NULL;
+        p->reader = fastq_reader_open(fd, true);
+    }
+
+    for (i = 0; i < PIPE_QUEUE; i++) {
+        p->batch[i].recs     = malloc_or_die(BATCH_RECS * sizeof(fastq_record_t));
+        p->batch[i].buf_size = 1 << 20;
+        p->batch[i].buf      = malloc_or_die(p->batch[i].buf_size);
+        p->batch[i].n = p->batch[i].buf_n = 0;
+    }
+
+    p->head = p->tail = 0;
+    p->held = false;
+    p->stop = false;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    pthread_create(&p->thread, NULL, pipe_thread, p);
+
+    return p;
+}
+
+
+void fastq_pipe_close(fastq_pipe_t* p)
+{
+    size_t i;
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+
+    fastq_reader_close(p->reader);
+    if (p->bgzf) bgzf_close(p->bgzf);
+
+    for (i = 0; i < PIPE_QUEUE; i++) {
+        free(p->batch[i].recs);
+        free(p->batch[i].buf);
+    }
+
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+
+const fastq_batch_t* fastq_pipe_next(fastq_pipe_t* p)
+{
+    fastq_batch_t* b;
+
+    pthread_mutex_lock(&p->lock);
+
+    /* hand back the last batch */
+    if (p->held) {
+        p->head++;
+        p->held = false;
+        pthread_cond_broadcast(&p->cond);
+    }
+
+    while (p->head == p->tail) pthread_cond_wait(&p->cond, &p->lock);
+    b = &p->batch[p->head % PIPE_QUEUE];
+
+    /* the end is kept, for any later calls */
+    if (b->n > 0) p->held = true;
+
+    pthread_mutex_unlock(&p->lock);
+
+    return b->n > 0 ? b : NULL;
+}
+
@@ -0,0 +1,43 @@
+/*
+ * fastq_pipe :
+ * FASTQ read and parsed ahead of its consumer.
+ *
+ * A thread parses records from the file into batches, handed over through
+ * a bounded ring, so that a pair of mate files are each read, inflated and
+ * parsed concurrently with the other and with the filtering. Input that is
+ * BGZF, as written by bgzip, is inflated in parallel on a pool of threads,
+ * having its block boundaries in its headers; other gzip input has an
+ * inflating thread of its own.
+ *
+ */
+
+#ifndef FASTQ_PIPE_H
+#define FASTQ_PIPE_H
+
+#include "fastq_reader.h"
+
+
+typedef struct
+{
+    fastq_record_t* recs;
+    size_t n;        /* records */
+
+    char*  buf;      /* which the records point into */
+    size_t buf_n, buf_size;
+} fastq_batch_t;
+
+
+typedef struct fastq_pipe_ fastq_pipe_t;
+
+
+/* Open fn for reading ahead, inflating BGZF on n_threads threads. */
+fastq_pipe_t* fastq_pipe_open(const char* fn, int n_threads);
+void fastq_pipe_close(fastq_pipe_t*);
+
+/* The next batch of records, valid until the next call, or NULL at the
+ * end of input. Batches hold the same number of records, but the last. */
+const fastq_batch_t* fastq_pipe_next(fastq_pipe_t*);
+
+
+#endif
+
@@ -0,0 +1,367 @@
+/*
+ * fastq_reader :
+ * A FASTQ parser over large buffers.
+ *
+ */
+
+#include "fastq_reader.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+static const size_t fastq_buf_size = 1 << 20;
+
+#define INFLATE_CHUNK (1 << 20)
+#define INFLATE_QUEUE 4
+
+
+static void* malloc_or_exit(size_t n)
+{
+    void* p = malloc(n);
+    if (p == NULL) {
+        fprintf(stderr, "Can not allocate %zu bytes.\n", n);
+        exit(1);
+    }
+    return p;
+}
+
+
+static void io_error(gzFile file)
+{
+    int errnum;
+    fprintf(stderr, "I/O error: %s\n", gzerror(file, &errnum));
+    exit(1);
+}
+
+
+
+/* Decompression ahead of the parser: the thread fills a ring of chunks,
+ * and the reader copies out of them into its buffer. */
+struct fastq_inflater_
+{
+    gzFile file;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    char* chunk[INFLATE_QUEUE];
+    int   n[INFLATE_QUEUE];  /* bytes in each, 0 at the end, -1 on error */
+
+    size_t head, tail;  /* chunks [head, tail) are full */
+    size_t off;         /* bytes taken from the head chunk */
+    bool   stop;
+};
+
+
+static void* inflater_thread(void* arg)
+{
+    fastq_inflater_t* z = arg;
+    size_t i;
+    int n;
+
+    while (1) {
+        pthread_mutex_lock(&z->lock);
+        while (!z->stop && z->tail - z->head == INFLATE_QUEUE) {
+            pthread_cond_wait(&z->cond, &z->lock);
+        }
+        if (z->stop) {
+            pthread_mutex_unlock(&z->lock);
+            break;
+        }
+        i = z->tail % INFLATE_QUEUE;
+        pthread_mutex_unlock(&z->lock);
+
+        /* the chunk is not visible to the reader until tail moves past it */
+        n = gzread(z->file, z->chunk[i], INFLATE_CHUNK);
+
+        pthread_mutex_lock(&z->lock);
+        z->n[i] = n;
+        z->tail++;
+        pthread_cond_broadcast(&z->cond);
+        pthread_mutex_unlock(&z->lock);
+
+        if (n <= 0) break;
+    }
+
+    return NULL;
+}
+
+
+static fastq_inflater_t* inflater_start(gzFile file)
+{
+    fastq_inflater_t* z = malloc_or_exit(sizeof(fastq_inflater_t));
+    size_t i;
+
+    z->file = file;
+    for (i = 0; i < INFLATE_QUEUE; i++) {
+        z->chunk[i] = malloc_or_exit(INFLATE_CHUNK);
+    }
+    z->head = z->tail = z->off = 0;
+    z->stop = false;
+
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->cond, NULL);
+    pthread_create(&z->thread, NULL, inflater_thread, z);
+
+    return z;
+}
+
+
+static void inflater_stop(fastq_inflater_t* z)
+{
+    size_t i;
+
+    pthread_mutex_lock(&z->lock);
+    z->stop = true;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+    pthread_join(z->thread, NULL);
+
+    pthread_cond_destroy(&z->cond);
+    pthread_mutex_destroy(&z->lock);
+    for (i = 0; i < INFLATE_QUEUE; i++) free(z->chunk[i]);
+    free(z);
+}
+
+
+/* Copy up to size bytes out of the full chunks, waiting for one if there
+ * are none. Returns 0 at the end of input. */
+static size_t inflater_read(fastq_inflater_t* z, char* dest, size_t size)
+{
+    size_t i, k, m = 0;
+
+    pthread_mutex_lock(&z->lock);
+    while (z->head == z->tail) pthread_cond_wait(&z->cond, &z->lock);
+
+    while (m < size && z->head < z->tail) {
+        i = z->head % INFLATE_QUEUE;
+        if (z->n[i] < 0) io_error(z->file);
+        if (z->n[i] == 0) break;
+
+        k = z->n[i] - z->off;
+        if (k > size - m) k = size - m;
+
+        /* the chunk is not touched by the thread while it is full */
+        memcpy(dest + m, z->chunk[i] + z->off, k);
+        m += k;
+        z->off += k;
+
+        if (z->off == (size_t) z->n[i]) {
+            z->off = 0;
+            z->head++;
+            pthread_cond_broadcast(&z->cond);
+        }
+    }
+
+    pthread_mutex_unlock(&z->lock);
+    return m;
+}
+
+
+
+fastq_reader_t* fastq_reader_open(int fd, bool threaded)
+{
+    fastq_reader_t* r = malloc_or_exit(sizeof(fastq_reader_t));
+
+    if ((r->file = gzdopen(fd, "rb")) == NULL) {
+        fputs("Can not open gzip file.\n", stderr);
+        exit(1);
+    }
+    gzbuffer(r->file, 256 * 1024);
+
+    r->inflater = threaded ? inflater_start(r->file) : NULL;
+    r->read   = NULL;
+    r->source = NULL;
+
+    r->size = fastq_buf_size;
+    r->buf  = malloc_or_exit(r->size);
+    r->pos = r->end = 0;
+    r->eof = false;
+
+    return r;
+}
+
+
+fastq_reader_t* fastq_reader_open_source(fastq_read_t read, void* source)
+{
+    fastq_reader_t* r = malloc_or_exit(sizeof(fastq_reader_t));
+
+    r->file     = NULL;
+    r->inflater = NULL;
+    r->read     = read;
+    r->source   = source;
+
+    r->size = fastq_buf_size;
+    r->buf  = malloc_or_exit(r->size);
+    r->pos = r->end = 0;
+    r->eof = false;
+
+    return r;
+}
+
+
+void fastq_reader_close(fastq_reader_t* r)
+{
+    if (r->inflater) inflater_stop(r->inflater);
+    if (r->file) gzclose(r->file);
+    free(r->buf);
+    free(r);
+}
+
+
+/* Move what is left to the front, growing the buffer if that is all of it,
+ * and read more after it. */
+static void fastq_refill(fastq_reader_t* r)
+{
+    int n;
+
+    if (r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, r->end - r->pos);
+        r->end -= r->pos;
+        r->pos = 0;
+    }
+    else if (r->end + 1 >= r->size) {
+        r->size *= 2;
+        if ((r->buf = realloc(r->buf, r->size)) == NULL) {
+            fprintf(stderr, "Can not allocate %zu bytes.\n", r->size);
+            exit(1);
+        }
+    }
+
+    /* a byte is kept spare, to terminate a last line with no newline */
+    if (r->read) {
+        n = r->read(r->source, r->buf + r->end, r->size - r->end - 1);
+        if (n < 0) {
+            fputs("I/O error while reading FASTQ.\n", stderr);
+            exit(1);
+        }
+    }
+    else if (r->inflater) {
+        n = inflater_read(r->inflater, r->buf + r->end, r->size - r->end - 1);
+    }
+    else {
+        n = gzread(r->file, r->buf + r->end, r->size - r->end - 1);
+        if (n < 0) io_error(r->file);
+    }
+
+    if (n == 0) r->eof = true;
+    r->end += n;
+}
+
+
+/* Where the line beginning at i ends, or NO_LINE if that is not yet read.
+ * At the end of input, the last line need not end in a newline. */
+#define NO_LINE ((size_t) -1)
+
+static size_t line_end(fastq_reader_t* r, size_t i)
+{
+    char* e;
+
+    if (i > r->end || (i == r->end && !r->eof)) return NO_LINE;
+    if ((e = memchr(r->buf + i, '\n', r->end - i)) != NULL) return e - r->buf;
+    return r->eof ? r->end : NO_LINE;
+}
+
+
+/* Terminate the line from i to j, dropping any carriage return. */
+static void set_view(fastq_reader_t* r, fastq_view_t* v, size_t i, size_t j)
+{
+    if (j > i && r->buf[j - 1] == '\r') j--;
+    r->buf[j] = '\0';
+    v->s = r->buf + i;
+    v->n = j - i;
+}
+
+
+int fastq_reader_next(fastq_reader_t* r, fastq_record_t* rec)
+{
+    size_t e1, e2, e3, e4;
+    char c;
+
+    while (1) {
+        /* skip blank and comment lines */
+        while (r->pos < r->end) {
+            c = r->buf[r->pos];
+            if (c == '\n' || c == '\r') r->pos++;
+            else if (c == '#' && (e1 = line_end(r, r->pos)) != NO_LINE) r->pos = e1 + 1;
+            else break;
+        }
+
+        if (r->pos >= r->end || r->buf[r->pos] == '#') {
+            if (r->eof) return 0;
+            fastq_refill(r);
+            continue;
+        }
+
+        c = r->buf[r->pos];
+        if (c != '@' && c != '>') {
+            fprintf(stderr,
+                    "Malformed FASTQ file: expecting an '@' or '>', saw a '%c'\n",
+                    c);
+            exit(1);
+        }
+
+        /* the whole record must be in the buffer before any of it is
+         * terminated, lest a refill lose the newlines */
+        e1 = line_end(r, r->pos);
+        e2 = e1 == NO_LINE ? NO_LINE : line_end(r, e1 + 1);
+
+        /* FASTQ */
+        if (e2 != NO_LINE && e2 + 1 < r->end && r->buf[e2 + 1] == '+') {
+            e3 = line_end(r, e2 + 1);
+            e4 = e3 == NO_LINE ? NO_LINE : line_end(r, e3 + 1);
+
+            /* input ending where a sequence's quality line should start */
+            if (e4 != NO_LINE && e3 + 1 >= r->end && e2 > e1 + 1) e4 = NO_LINE;
+
+            if (e4 != NO_LINE) {
+                set_view(r, &rec->id1,  r->pos + 1, e1);
+                set_view(r, &rec->seq,  e1 + 1, e2);
+                set_view(r, &rec->id2,  e2 + 2, e3);
+                set_view(r, &rec->qual, e3 + 1, e4);
+                r->pos = e4 < r->end ? e4 + 1 : e4;
+                return 1;
+            }
+        }
+
+        /* fasta style entry, once it is known what follows */
+        else if (e2 != NO_LINE && (e2 + 1 < r->end || r->eof)) {
+            set_view(r, &rec->id1, r->pos + 1, e1);
+            set_view(r, &rec->seq, e1 + 1, e2);
+            rec->id2.s = rec->qual.s = NULL;
+            rec->id2.n = rec->qual.n = 0;
+            r->pos = e2 < r->end ? e2 + 1 : e2;
+            return 1;
+        }
+
+        /* a record cut short by the end of input */
+        if (r->eof) {
+            fprintf(stderr, "Malformed FASTQ file: truncated FASTQ record\n");
+            exit(1);
+        }
+
+        fastq_refill(r);
+    }
+}
+
+
+void fastq_record_print(FILE* fout, const fastq_record_t* rec)
+{
+    /* FASTQ */
+    if (rec->qual.s != NULL) {
+        fprintf(fout, "@%s\n%s\n+%s\n%s\n",
+                      rec->id1.s,
+                      rec->seq.s,
+                      rec->id2.s,
+                      rec->qual.s);
+    }
+
+    /* FASTA */
+    else {
+        fprintf(fout, ">%s\n%s\n",
+                      rec->id1.s,
+                      rec->seq.s);
+    }
+}
+
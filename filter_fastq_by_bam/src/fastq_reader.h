@@ -0,0 +1,84 @@
+/*
+ * fastq_reader :
+ * A FASTQ parser over large buffers.
+ *
+ * Input, gzipped or not, is read a megabyte at a time, newlines found with
+ * memchr, and records handed out as views into the buffer, each line
+ * null-terminated in place, so nothing is copied and lines may be any
+ * length. A record left incomplete at the end of the buffer is moved to
+ * the front before the next read, and the buffer grown if it is that one
+ * record.
+ *
+ * Optionally, a second thread decompresses ahead of the parser, or input
+ * can come from any other source through a read function.
+ *
+ * The same code is copied into every tool that reads FASTQ.
+ *
+ */
+
+#ifndef FASTQ_READER_H
+#define FASTQ_READER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+
+typedef struct
+{
+    char*  s;    /* null-terminated, within the reader's buffer */
+    size_t n;    /* length of s */
+} fastq_view_t;
+
+
+/* Valid until the next call to fastq_reader_next. A FASTA entry has no
+ * id2 or qual, their s being NULL. */
+typedef struct
+{
+    fastq_view_t id1;   /* without the '@' or '>' */
+    fastq_view_t seq;
+    fastq_view_t id2;   /* without the '+' */
+    fastq_view_t qual;
+} fastq_record_t;
+
+
+typedef struct fastq_inflater_ fastq_inflater_t;
+
+/* Fill up to size bytes of buf from source, returning how many, 0 at the
+ * end of input, or -1 on error. */
+typedef int (*fastq_read_t)(void* source, char* buf, size_t size);
+
+typedef struct
+{
+    gzFile file;
+    fastq_inflater_t* inflater; /* or NULL, reading on this thread */
+
+    fastq_read_t read;          /* used instead of file, if set */
+    void* source;
+
+    char*  buf;
+    size_t size;  /* bytes allocated for buf */
+    size_t pos;   /* where the next record begins */
+    size_t end;   /* where the input read so far ends */
+    bool   eof;
+} fastq_reader_t;
+
+
+/* Read from fd, which is closed with the reader, decompressing on another
+ * thread if threaded is set. */
+fastq_reader_t* fastq_reader_open(int fd, bool threaded);
+
+/* Read through read, from source, which is left open. */
+fastq_reader_t* fastq_reader_open_source(fastq_read_t read, void* source);
+
+void fastq_reader_close(fastq_reader_t*);
+
+/* Parse the next record, returning 0 at the end of input. Blank lines, and
+ * lines beginning with '#', are skipped between records. */
+int fastq_reader_next(fastq_reader_t*, fastq_record_t*);
+
+void fastq_record_print(FILE* fout, const fastq_record_t*);
+
+
+#endif
+
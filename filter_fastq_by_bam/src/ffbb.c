@@ -1,21 +1,96 @@
 
-#include "parse.h"
+#include "fastq_reader.h"
+#include "fastq_pipe.h"
 #include "hat-trie/hat-trie.h"
 #include "samtools/sam.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 
 void print_usage(FILE* fout)
 {
     fprintf(fout,
-           "Usage: ffbb output_prefix alignments1.bam[,alignments2.bam,...] reads2.fastq [reads2.fastq]\n");
+           "Usage: ffbb [-@ threads] output_prefix alignments1.bam[,alignments2.bam,...] reads2.fastq [reads2.fastq]\n\n"
+           "With -@ N, N > 1, BAM input is decompressed on N threads, and each FASTQ\n"
+           "file is read and parsed ahead of the filtering on a thread of its own,\n"
+           "decompressed on another, or on N if it is BGZF.\n");
+}
+
+
+/* Records come straight from a reader, or with threads to spare, in
+ * batches from a pipe reading ahead. */
+typedef struct
+{
+    fastq_reader_t* reader;
+    fastq_pipe_t*   pipe;
+    const fastq_batch_t* batch;
+    size_t i;
+    fastq_record_t rec;
+} input_t;
+
+
+void input_open(input_t* in, const char* fn, int n_threads)
+{
+    int fd;
+
+    in->reader = NULL;
+    in->pipe   = NULL;
+    in->batch  = NULL;
+    in->i      = 0;
+
+    if (n_threads > 1) {
+        in->pipe = fastq_pipe_open(fn, n_threads);
+    }
+    else {
+        if ((fd = open(fn, O_RDONLY)) < 0) {
+            fprintf(stderr, "Can't open FASTQ file %s.\n", fn);
+            exit(EXIT_FAILURE);
+        }
+        in->reader = fastq_reader_open(fd, false);
+    }
+}
+
+
+void input_close(input_t* in)
+{
+    if (in->pipe) fastq_pipe_close(in->pipe);
+    else          fastq_reader_close(in->reader);
+}
+
+
+const fastq_record_t* input_next(input_t* in)
+{
+    if (in->reader) {
+        return fastq_reader_next(in->reader, &in->rec) ? &in->rec : NULL;
+    }
+
+    if (in->batch == NULL || in->i == in->batch->n) {
+        if ((in->batch = fastq_pipe_next(in->pipe)) == NULL) return NULL;
+        in->i = 0;
+    }
+
+    return &in->batch->recs[in->i++];
 }
 
 
 int main(int argc, char* argv[])
 {
+    int c, n_threads = 1;
+    while ((c = getopt(argc, argv, "@:")) != -1) {
+        if (c == '@') n_threads = atoi(optarg);
+        else {
+            print_usage(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* the remaining arguments are positional */
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc < 4) {
         print_usage(stderr);
         exit(EXIT_FAILURE);
@@ -48,6 +123,7 @@ int main(int argc, char* argv[])
             fprintf(stderr, "Can't open BAM file %s.\n", bam_fn);
             continue;
         }
+        samthreads(sf, n_threads, 0);
 
         while (samread(sf, read) > 0) {
             if (read->core.flag & BAM_FUNMAP) continue;
@@ -70,13 +146,9 @@ int main(int argc, char* argv[])
 
 
     /* filter fastq files */
-    FILE* f1 = fopen(reads1_fn, "r");
-    if (f1 == NULL) {
-        fprintf(stderr, "Can't open FASTQ file %s.\n", reads1_fn);
-        exit(EXIT_FAILURE);
-    }
-    fastq_t* fq1 = fastq_open(f1);
-    seq_t* read1 = fastq_alloc_seq();
+    input_t fq1;
+    input_open(&fq1, reads1_fn, n_threads);
+    const fastq_record_t* read1;
 
     char fn[256];
 
@@ -90,19 +162,12 @@ int main(int argc, char* argv[])
     }
 
 
-    FILE* f2 = NULL;
-    fastq_t* fq2 = NULL;
-    seq_t* read2 = NULL;
+    input_t fq2;
+    const fastq_record_t* read2;
     FILE* fout2 = NULL;
 
     if (reads2_fn != NULL) {
-        f2 = fopen(reads2_fn, "r");
-        if (f2 == NULL) {
-            fprintf(stderr, "Can't open FASTQ file %s.\n", reads2_fn);
-            exit(EXIT_FAILURE);
-        }
-        fq2 = fastq_open(f2);
-        read2 = fastq_alloc_seq();
+        input_open(&fq2, reads2_fn, n_threads);
 
         snprintf(fn, sizeof(fn), "%s_2.fastq", prefix);
         fout2 = fopen(fn, "w");
@@ -125,7 +190,7 @@ int main(int argc, char* argv[])
     size_t idlen;
 
     if (reads2_fn) {
-        while (fastq_next(fq1, read1) && fastq_next(fq2, read2)) {
+        while ((read1 = input_next(&fq1)) && (read2 = input_next(&fq2))) {
             s = strchr(read1->id1.s, '/');
             t = strchr(read1->id1.s, ' ');
             if (s && t) idlen = (s < t ? s : t) - read1->id1.s;
@@ -136,16 +201,16 @@ int main(int argc, char* argv[])
 
             if (hattrie_tryget(ids, read1->id1.s, idlen) == 0) {
                 if (++count % 100000 == 0) printf("\t%zu reads.\n", count);
-                fastq_print(fout1, read1);
-                fastq_print(fout2, read2);
+                fastq_record_print(fout1, read1);
+                fastq_record_print(fout2, read2);
             }
         }
     }
     else {
-        while (fastq_next(fq1, read1)) {
+        while ((read1 = input_next(&fq1))) {
             if (hattrie_tryget(ids, read1->id1.s, read1->id1.n) == 0) {
                 if (++count % 100000 == 0) printf("\t%zu reads.\n", count);
-                fastq_print(fout1, read1);
+                fastq_record_print(fout1, read1);
             }
         }
     }
@@ -155,13 +220,11 @@ int main(int argc, char* argv[])
 
 
     fclose(fout1);
-    fastq_close(fq1);
-    fastq_free_seq(read1);
+    input_close(&fq1);
 
     if (reads2_fn != NULL) {
         fclose(fout2);
-        fastq_close(fq2);
-        fastq_free_seq(read2);
+        input_close(&fq2);
     }
 
     hattrie_free(ids);
@@ -22,6 +22,9 @@
 */
 
 /*
+  block CRCs are checked; inflating goes through bgzf_inflate.c.
+  multi-threaded read-ahead: inflate blocks on a worker pool (bgzf_mt).
+  block cache shared by all handles, with LRU eviction (bgzf_cache_set_size).
   2009-06-29 by lh3: cache recent uncompressed blocks.
   2009-06-25 by lh3: optionally use my knetfile library to access file on a FTP.
   2009-06-12 by lh3: support a mode string like "wu" where 'u' for uncompressed output */
@@ -33,15 +36,11 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include "bgzf.h"
+#include "bgzf_inflate.h"
 
 #include "khash.h"
-typedef struct {
-	int size;
-	uint8_t *block;
-	int64_t end_offset;
-} cache_t;
-KHASH_MAP_INIT_INT64(cache, cache_t)
 
 #if defined(_WIN32) || defined(_MSC_VER)
 #define ftello(fp) ftell(fp)
@@ -72,6 +71,8 @@ static const int BGZF_XLEN = 6; // BGZF_LEN+4
 static const int GZIP_WINDOW_BITS = -15; // no zlib header
 static const int Z_DEFAULT_MEM_LEVEL = 8;
 
+static const int DEFAULT_MT_SUB_BLKS = 8;
+
 
 inline
 void
@@ -137,6 +138,8 @@ int bgzf_check_bgzf(const char *fn)
     return 0;
 }
 
+static uint64_t cache_file_id(int fd);
+
 static BGZF *bgzf_read_init()
 {
 	BGZF *fp;
@@ -145,8 +148,7 @@ static BGZF *bgzf_read_init()
     fp->uncompressed_block = malloc(MAX_BLOCK_SIZE);
     fp->compressed_block_size = MAX_BLOCK_SIZE;
     fp->compressed_block = malloc(MAX_BLOCK_SIZE);
-	fp->cache_size = 0;
-	fp->cache = kh_init(cache);
+	fp->cache_size = 1;
 	return fp;
 }
 
@@ -169,6 +171,7 @@ open_read(int fd)
 #else
     fp->file = file;
 #endif
+    fp->cache_id = cache_file_id(fd);
     return fp;
 }
 
@@ -198,6 +201,7 @@ open_write(int fd, int compress_level) // compress_level==-1 for the default lev
     fp->block_offset = 0;
     fp->block_length = 0;
     fp->error = NULL;
+    fp->mt = NULL;
     return fp;
 }
 
@@ -213,6 +217,7 @@ bgzf_open(const char* __restrict path, const char* __restrict mode)
 		fp->file_descriptor = -1;
 		fp->open_mode = 'r';
 		fp->x.fpr = file;
+		fp->cache_id = cache_file_id(file->type == KNF_TYPE_LOCAL? file->fd : -1);
 #else
 		int fd, oflag = O_RDONLY;
 #ifdef _WIN32
@@ -262,13 +267,14 @@ bgzf_fdopen(int fd, const char * __restrict mode)
 
 static
 int
-deflate_block(BGZF* fp, int block_length)
+deflate_buffer(void* uncompressed_block, int* block_length,
+               bgzf_byte_t* buffer, int buffer_size,
+               int compress_level, const char** error)
 {
-    // Deflate the block in fp->uncompressed_block into fp->compressed_block.
-    // Also adds an extra field that stores the compressed block length.
-
-    bgzf_byte_t* buffer = fp->compressed_block;
-    int buffer_size = fp->compressed_block_size;
+    // Deflate up to *block_length bytes of uncompressed_block into buffer,
+    // setting *block_length to the number of bytes consumed. Also adds an
+    // extra field that stores the compressed block length. This touches no
+    // BGZF state, so worker threads may call it concurrently.
 
     // Init gzip header
     buffer[0] = GZIP_ID1;
@@ -291,21 +297,21 @@ deflate_block(BGZF* fp, int block_length)
     buffer[17] = 0;
 
     // loop to retry for blocks that do not compress enough
-    int input_length = block_length;
+    int input_length = *block_length;
     int compressed_length = 0;
     while (1) {
         z_stream zs;
         zs.zalloc = NULL;
         zs.zfree = NULL;
-        zs.next_in = fp->uncompressed_block;
+        zs.next_in = uncompressed_block;
         zs.avail_in = input_length;
         zs.next_out = (void*)&buffer[BLOCK_HEADER_LENGTH];
         zs.avail_out = buffer_size - BLOCK_HEADER_LENGTH - BLOCK_FOOTER_LENGTH;
 
-        int status = deflateInit2(&zs, fp->compress_level, Z_DEFLATED,
+        int status = deflateInit2(&zs, compress_level, Z_DEFLATED,
                                   GZIP_WINDOW_BITS, Z_DEFAULT_MEM_LEVEL, Z_DEFAULT_STRATEGY);
         if (status != Z_OK) {
-            report_error(fp, "deflate init failed");
+            *error = "deflate init failed";
             return -1;
         }
         status = deflate(&zs, Z_FINISH);
@@ -318,35 +324,62 @@ deflate_block(BGZF* fp, int block_length)
                 input_length -= 1024;
                 if (input_length <= 0) {
                     // should never happen
-                    report_error(fp, "input reduction failed");
+                    *error = "input reduction failed";
                     return -1;
                 }
                 continue;
             }
-            report_error(fp, "deflate failed");
+            *error = "deflate failed";
             return -1;
         }
         status = deflateEnd(&zs);
         if (status != Z_OK) {
-            report_error(fp, "deflate end failed");
+            *error = "deflate end failed";
             return -1;
         }
         compressed_length = zs.total_out;
         compressed_length += BLOCK_HEADER_LENGTH + BLOCK_FOOTER_LENGTH;
         if (compressed_length > MAX_BLOCK_SIZE) {
             // should never happen
-            report_error(fp, "deflate overflow");
+            *error = "deflate overflow";
             return -1;
         }
         break;
     }
 
     packInt16((uint8_t*)&buffer[16], compressed_length-1);
-    uint32_t crc = crc32(0L, NULL, 0L);
-    crc = crc32(crc, fp->uncompressed_block, input_length);
+    uint32_t crc = bgzf_crc32(0, uncompressed_block, input_length);
     packInt32((uint8_t*)&buffer[compressed_length-8], crc);
     packInt32((uint8_t*)&buffer[compressed_length-4], input_length);
 
+    *block_length = input_length;
+    return compressed_length;
+}
+
+static
+int
+compress_level(BGZF* fp)
+{
+    return fp->compress_level;
+}
+
+static
+int
+deflate_block(BGZF* fp, int block_length)
+{
+    // Deflate the block in fp->uncompressed_block into fp->compressed_block.
+    // Input that does not fit is moved to the front of fp->uncompressed_block.
+
+    const char* error = NULL;
+    int input_length = block_length;
+    int compressed_length = deflate_buffer(fp->uncompressed_block, &input_length,
+                                           fp->compressed_block, fp->compressed_block_size,
+                                           compress_level(fp), &error);
+    if (compressed_length < 0) {
+        report_error(fp, error);
+        return -1;
+    }
+
     int remaining = block_length - input_length;
     if (remaining > 0) {
         if (remaining > input_length) {
@@ -362,38 +395,30 @@ deflate_block(BGZF* fp, int block_length)
     return compressed_length;
 }
 
+static
+int
+inflate_buffer(void* compressed_block, int block_length,
+               void* uncompressed_block, int uncompressed_block_size,
+               const char** error)
+{
+    // Inflate one compressed block into uncompressed_block and check its
+    // CRC. This touches no BGZF state, so worker threads may call it
+    // concurrently.
+    return bgzf_inflate_block((const uint8_t*)compressed_block, block_length,
+                              (uint8_t*)uncompressed_block, uncompressed_block_size, error);
+}
+
 static
 int
 inflate_block(BGZF* fp, int block_length)
 {
     // Inflate the block in fp->compressed_block into fp->uncompressed_block
-
-    z_stream zs;
-	int status;
-    zs.zalloc = NULL;
-    zs.zfree = NULL;
-    zs.next_in = fp->compressed_block + 18;
-    zs.avail_in = block_length - 16;
-    zs.next_out = fp->uncompressed_block;
-    zs.avail_out = fp->uncompressed_block_size;
-
-    status = inflateInit2(&zs, GZIP_WINDOW_BITS);
-    if (status != Z_OK) {
-        report_error(fp, "inflate init failed");
-        return -1;
-    }
-    status = inflate(&zs, Z_FINISH);
-    if (status != Z_STREAM_END) {
-        inflateEnd(&zs);
-        report_error(fp, "inflate failed");
-        return -1;
-    }
-    status = inflateEnd(&zs);
-    if (status != Z_OK) {
-        report_error(fp, "inflate failed");
-        return -1;
-    }
-    return zs.total_out;
+    const char* error = NULL;
+    int count = inflate_buffer(fp->compressed_block, block_length,
+                               fp->uncompressed_block, fp->uncompressed_block_size,
+                               &error);
+    if (count < 0) report_error(fp, error);
+    return count;
 }
 
 static
@@ -410,92 +435,232 @@ check_header(const bgzf_byte_t* header)
             unpackInt16((uint8_t*)&header[14]) == BGZF_LEN);
 }
 
-static void free_cache(BGZF *fp)
+/*
+ * Block cache.
+ *
+ * Inflated blocks are kept in one LRU shared by every handle in the
+ * process. Entries are keyed by file and compressed offset; a file is
+ * identified by device, inode, size and modification time, so handles
+ * opened separately on the same file share blocks, and a file replaced
+ * under the same name does not. Remote files get an id of their own per
+ * handle. One mutex guards the table, the LRU list and the counters.
+ */
+
+typedef struct cache_entry_s {
+	uint64_t file_id;
+	int64_t address, end_offset;
+	int size;
+	uint8_t *block;
+	struct cache_entry_s *prev, *next; // LRU list, most recent first
+} cache_entry_t;
+
+typedef struct {
+	uint64_t file_id;
+	int64_t address;
+} cache_key_t;
+
+#define cache_key_hash(k) kh_int64_hash_func((k).file_id << 48 ^ (uint64_t)(k).address)
+#define cache_key_eq(a, b) ((a).file_id == (b).file_id && (a).address == (b).address)
+KHASH_INIT(cache, cache_key_t, cache_entry_t*, 1, cache_key_hash, cache_key_eq)
+
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+} file_key_t;
+
+static struct {
+	pthread_mutex_t lock;
+	khash_t(cache) *h;
+	cache_entry_t *head, *tail;
+	size_t size, capacity;
+	uint64_t hits, misses, evictions;
+	file_key_t *files; // files[i] has id i + 1
+	int n_files, m_files;
+	uint64_t next_id; // for files that cannot be identified
+} cache = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1ULL << 32 };
+
+static size_t entry_size(const cache_entry_t *e)
 {
-	khint_t k;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
-	if (fp->open_mode != 'r') return;
-	for (k = kh_begin(h); k < kh_end(h); ++k)
-		if (kh_exist(h, k)) free(kh_val(h, k).block);
-	kh_destroy(cache, h);
+	return sizeof(cache_entry_t) + e->size;
+}
+
+static void lru_unlink(cache_entry_t *e)
+{
+	if (e->prev) e->prev->next = e->next; else cache.head = e->next;
+	if (e->next) e->next->prev = e->prev; else cache.tail = e->prev;
+}
+
+static void lru_push(cache_entry_t *e)
+{
+	e->prev = 0; e->next = cache.head;
+	if (cache.head) cache.head->prev = e; else cache.tail = e;
+	cache.head = e;
+}
+
+// evict least recently used blocks until the cache fits; call locked
+static void cache_shrink(size_t capacity)
+{
+	while (cache.tail && cache.size > capacity) {
+		cache_entry_t *e = cache.tail;
+		cache_key_t key;
+		key.file_id = e->file_id; key.address = e->address;
+		kh_del(cache, cache.h, kh_get(cache, cache.h, key));
+		lru_unlink(e);
+		cache.size -= entry_size(e);
+		++cache.evictions;
+		free(e->block); free(e);
+	}
+}
+
+// Id of the file behind fd, shared with every other descriptor of the same file.
+static uint64_t cache_file_id(int fd)
+{
+	struct stat st;
+	file_key_t key;
+	uint64_t id;
+	int i;
+	pthread_mutex_lock(&cache.lock);
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		id = cache.next_id++;
+		pthread_mutex_unlock(&cache.lock);
+		return id;
+	}
+	memset(&key, 0, sizeof(file_key_t));
+	key.dev = st.st_dev; key.ino = st.st_ino;
+	key.size = st.st_size; key.mtime = st.st_mtime;
+	for (i = 0; i < cache.n_files; ++i)
+		if (memcmp(&cache.files[i], &key, sizeof(file_key_t)) == 0) break;
+	if (i == cache.n_files) {
+		if (cache.n_files == cache.m_files) {
+			cache.m_files = cache.m_files? cache.m_files<<1 : 16;
+			cache.files = realloc(cache.files, cache.m_files * sizeof(file_key_t));
+		}
+		cache.files[cache.n_files++] = key;
+	}
+	pthread_mutex_unlock(&cache.lock);
+	return i + 1;
 }
 
 static int load_block_from_cache(BGZF *fp, int64_t block_address)
 {
 	khint_t k;
-	cache_t *p;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
-	k = kh_get(cache, h, block_address);
-	if (k == kh_end(h)) return 0;
-	p = &kh_val(h, k);
+	cache_key_t key;
+	cache_entry_t *e;
+	int64_t end_offset;
+	if (fp->cache_size == 0) return 0;
+	key.file_id = fp->cache_id; key.address = block_address;
+	pthread_mutex_lock(&cache.lock);
+	if (cache.capacity == 0) {
+		pthread_mutex_unlock(&cache.lock);
+		return 0;
+	}
+	k = cache.h? kh_get(cache, cache.h, key) : 0;
+	if (cache.h == 0 || k == kh_end(cache.h)) {
+		++cache.misses;
+		pthread_mutex_unlock(&cache.lock);
+		return 0;
+	}
+	e = kh_val(cache.h, k);
+	lru_unlink(e); lru_push(e);
+	++cache.hits;
+	memcpy(fp->uncompressed_block, e->block, e->size);
 	if (fp->block_length != 0) fp->block_offset = 0;
 	fp->block_address = block_address;
-	fp->block_length = p->size;
-	memcpy(fp->uncompressed_block, p->block, MAX_BLOCK_SIZE);
+	fp->block_length = e->size;
+	end_offset = e->end_offset;
+	pthread_mutex_unlock(&cache.lock);
 #ifdef _USE_KNETFILE
-	knet_seek(fp->x.fpr, p->end_offset, SEEK_SET);
+	knet_seek(fp->x.fpr, end_offset, SEEK_SET);
 #else
-	fseeko(fp->file, p->end_offset, SEEK_SET);
+	fseeko(fp->file, end_offset, SEEK_SET);
 #endif
-	return p->size;
+	return fp->block_length;
 }
 
 static void cache_block(BGZF *fp, int size)
 {
 	int ret;
 	khint_t k;
-	cache_t *p;
-	khash_t(cache) *h = (khash_t(cache)*)fp->cache;
-	if (MAX_BLOCK_SIZE >= fp->cache_size) return;
-	if ((kh_size(h) + 1) * MAX_BLOCK_SIZE > fp->cache_size) {
-		/* A better way would be to remove the oldest block in the
-		 * cache, but here we remove a random one for simplicity. This
-		 * should not have a big impact on performance. */
-		for (k = kh_begin(h); k < kh_end(h); ++k)
-			if (kh_exist(h, k)) break;
-		if (k < kh_end(h)) {
-			free(kh_val(h, k).block);
-			kh_del(cache, h, k);
-		}
+	cache_key_t key;
+	cache_entry_t *e;
+	if (fp->cache_size == 0 || fp->block_length == 0) return;
+	key.file_id = fp->cache_id; key.address = fp->block_address;
+	pthread_mutex_lock(&cache.lock);
+	if (cache.capacity == 0) {
+		pthread_mutex_unlock(&cache.lock);
+		return;
+	}
+	if (cache.h == 0) cache.h = kh_init(cache);
+	k = kh_put(cache, cache.h, key, &ret);
+	if (ret == 0) { // another handle got here first
+		pthread_mutex_unlock(&cache.lock);
+		return;
 	}
-	k = kh_put(cache, h, fp->block_address, &ret);
-	if (ret == 0) return; // if this happens, a bug!
-	p = &kh_val(h, k);
-	p->size = fp->block_length;
-	p->end_offset = fp->block_address + size;
-	p->block = malloc(MAX_BLOCK_SIZE);
-	memcpy(kh_val(h, k).block, fp->uncompressed_block, MAX_BLOCK_SIZE);
+	e = malloc(sizeof(cache_entry_t));
+	e->file_id = key.file_id; e->address = key.address;
+	e->end_offset = fp->block_address + size;
+	e->size = fp->block_length;
+	e->block = malloc(e->size);
+	memcpy(e->block, fp->uncompressed_block, e->size);
+	kh_val(cache.h, k) = e;
+	lru_push(e);
+	cache.size += entry_size(e);
+	cache_shrink(cache.capacity);
+	pthread_mutex_unlock(&cache.lock);
 }
 
+void bgzf_cache_set_size(size_t size)
+{
+	pthread_mutex_lock(&cache.lock);
+	cache.capacity = size;
+	cache_shrink(size);
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void bgzf_cache_stats(bgzf_cache_stats_t *stats)
+{
+	pthread_mutex_lock(&cache.lock);
+	stats->hits = cache.hits;
+	stats->misses = cache.misses;
+	stats->evictions = cache.evictions;
+	stats->size = cache.size;
+	stats->capacity = cache.capacity;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void bgzf_cache_reset_stats(void)
+{
+	pthread_mutex_lock(&cache.lock);
+	cache.hits = cache.misses = cache.evictions = 0;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* Read the compressed block at the current file position into
+ * compressed_block. Returns the block length, zero at end of file, or -1 on
+ * error. */
+static
 int
-bgzf_read_block(BGZF* fp)
+read_raw_block(BGZF* fp, bgzf_byte_t* compressed_block, const char** error)
 {
     bgzf_byte_t header[BLOCK_HEADER_LENGTH];
-	int count, size = 0, block_length, remaining;
+	int count, block_length, remaining;
 #ifdef _USE_KNETFILE
-    int64_t block_address = knet_tell(fp->x.fpr);
-	if (load_block_from_cache(fp, block_address)) return 0;
     count = knet_read(fp->x.fpr, header, sizeof(header));
 #else
-    int64_t block_address = ftello(fp->file);
-	if (load_block_from_cache(fp, block_address)) return 0;
     count = fread(header, 1, sizeof(header), fp->file);
 #endif
-    if (count == 0) {
-        fp->block_length = 0;
-        return 0;
-    }
-	size = count;
+    if (count == 0) return 0;
     if (count != sizeof(header)) {
-        report_error(fp, "read failed");
+        *error = "read failed";
         return -1;
     }
     if (!check_header(header)) {
-        report_error(fp, "invalid block header");
+        *error = "invalid block header";
         return -1;
     }
     block_length = unpackInt16((uint8_t*)&header[16]) + 1;
-    bgzf_byte_t* compressed_block = (bgzf_byte_t*) fp->compressed_block;
     memcpy(compressed_block, header, BLOCK_HEADER_LENGTH);
     remaining = block_length - BLOCK_HEADER_LENGTH;
 #ifdef _USE_KNETFILE
@@ -504,11 +669,373 @@ bgzf_read_block(BGZF* fp)
     count = fread(&compressed_block[BLOCK_HEADER_LENGTH], 1, remaining, fp->file);
 #endif
     if (count != remaining) {
-        report_error(fp, "read failed");
+        *error = "read failed";
         return -1;
     }
-	size += count;
-    count = inflate_block(fp, block_length);
+    return block_length;
+}
+
+/*
+ * Multi-threaded reading and writing.
+ *
+ * Block number i always goes to slot i % n_blks, and blocks enter and leave
+ * the pipeline strictly in order, so output order never depends on which
+ * worker finishes first.
+ *
+ * Reading: workers take turns reading the next compressed block from the
+ * file (under the lock, so reads stay sequential), then inflate it outside
+ * the lock; the caller takes inflated blocks in order.
+ *
+ * Writing: the caller queues each full uncompressed block, workers deflate
+ * queued blocks in any order, and the caller writes finished blocks to the
+ * file in order.
+ */
+
+enum { MT_EMPTY, MT_BUSY, MT_DONE };
+
+typedef struct {
+	int state;
+	int64_t address; // file offset of the compressed block (reading only)
+	int block_length; // reading: compressed size, 0 at end of file; writing: uncompressed size
+	int size; // reading: inflated size; writing: compressed size; -1 on error
+	const char *error;
+	bgzf_byte_t *compressed_block;
+	int compressed_size; // bytes allocated for compressed_block
+	void *uncompressed_block;
+} mt_block_t;
+
+typedef struct {
+	BGZF *fp;
+	int n_threads, n_blks;
+	pthread_t *tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+	mt_block_t *blks;
+	int64_t next_fill; // number of the next block to be read from the file, or queued by the caller
+	int64_t next_drain; // number of the next block to be handed to the caller, or written to the file
+	int64_t next_job; // number of the next queued block to be deflated (writing only)
+	int64_t address; // file offset of block next_fill
+	int64_t block_end; // file offset following the caller's current block
+	int compress_level;
+	int n_busy, eof, stop;
+} mt_aux_t;
+
+static void *mt_inflate_worker(void *data)
+{
+	mt_aux_t *mt = (mt_aux_t*)data;
+	mt_block_t *p;
+	pthread_mutex_lock(&mt->lock);
+	for (;;) {
+		while (!mt->stop && (mt->eof || mt->blks[mt->next_fill % mt->n_blks].state != MT_EMPTY))
+			pthread_cond_wait(&mt->cv, &mt->lock);
+		if (mt->stop) break;
+		p = &mt->blks[mt->next_fill++ % mt->n_blks];
+		p->state = MT_BUSY;
+		p->address = mt->address;
+		p->error = NULL;
+		p->block_length = read_raw_block(mt->fp, p->compressed_block, &p->error);
+		if (p->block_length <= 0) { // end of file or error; stop reading ahead
+			p->size = p->block_length;
+			p->block_length = 0;
+			p->state = MT_DONE;
+			mt->eof = 1;
+			pthread_cond_broadcast(&mt->cv);
+			continue;
+		}
+		mt->address += p->block_length;
+		++mt->n_busy;
+		pthread_mutex_unlock(&mt->lock);
+		p->size = inflate_buffer(p->compressed_block, p->block_length,
+				p->uncompressed_block, MAX_BLOCK_SIZE, &p->error);
+		pthread_mutex_lock(&mt->lock);
+		p->state = MT_DONE;
+		--mt->n_busy;
+		pthread_cond_broadcast(&mt->cv);
+	}
+	pthread_mutex_unlock(&mt->lock);
+	return 0;
+}
+
+static void *mt_deflate_worker(void *data)
+{
+	mt_aux_t *mt = (mt_aux_t*)data;
+	mt_block_t *p;
+	int input_length, compressed_length, in;
+	pthread_mutex_lock(&mt->lock);
+	for (;;) {
+		while (!mt->stop && mt->next_job == mt->next_fill)
+			pthread_cond_wait(&mt->cv, &mt->lock);
+		if (mt->stop) break;
+		p = &mt->blks[mt->next_job++ % mt->n_blks];
+		pthread_mutex_unlock(&mt->lock);
+		// a block that does not compress enough is split exactly as
+		// bgzf_flush splits it with deflate_block: each piece takes what fits
+		// in MAX_BLOCK_SIZE, and the rest starts the next
+		p->error = NULL;
+		p->size = in = 0;
+		while (in < p->block_length) {
+			if (p->compressed_size - p->size < MAX_BLOCK_SIZE) {
+				p->compressed_size *= 2;
+				p->compressed_block = realloc(p->compressed_block, p->compressed_size);
+			}
+			input_length = p->block_length - in;
+			compressed_length = deflate_buffer((bgzf_byte_t*)p->uncompressed_block + in, &input_length,
+					p->compressed_block + p->size, MAX_BLOCK_SIZE,
+					mt->compress_level, &p->error);
+			if (compressed_length >= 0 && p->block_length - in - input_length > input_length) {
+				p->error = "remainder too large"; // as deflate_block
+				compressed_length = -1;
+			}
+			if (compressed_length < 0) {
+				p->size = -1;
+				break;
+			}
+			in += input_length;
+			p->size += compressed_length;
+		}
+		pthread_mutex_lock(&mt->lock);
+		p->state = MT_DONE;
+		pthread_cond_broadcast(&mt->cv);
+	}
+	pthread_mutex_unlock(&mt->lock);
+	return 0;
+}
+
+int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks)
+{
+	mt_aux_t *mt;
+	int i;
+	if (fp->mt || n_threads <= 1) return 0;
+	if (n_sub_blks <= 0) n_sub_blks = DEFAULT_MT_SUB_BLKS;
+	mt = (mt_aux_t*)calloc(1, sizeof(mt_aux_t));
+	mt->fp = fp;
+	mt->n_threads = n_threads;
+	mt->n_blks = n_threads * n_sub_blks;
+	mt->blks = (mt_block_t*)calloc(mt->n_blks, sizeof(mt_block_t));
+	for (i = 0; i < mt->n_blks; ++i) {
+		mt->blks[i].compressed_size = fp->open_mode == 'w'? 2 * MAX_BLOCK_SIZE : MAX_BLOCK_SIZE;
+		mt->blks[i].compressed_block = malloc(mt->blks[i].compressed_size);
+		mt->blks[i].uncompressed_block = malloc(MAX_BLOCK_SIZE);
+	}
+	if (fp->open_mode == 'r') { // pick up where the single-threaded reader left off
+#ifdef _USE_KNETFILE
+		mt->address = mt->block_end = knet_tell(fp->x.fpr);
+#else
+		mt->address = mt->block_end = ftello(fp->file);
+#endif
+	} else mt->compress_level = compress_level(fp);
+	pthread_mutex_init(&mt->lock, 0);
+	pthread_cond_init(&mt->cv, 0);
+	fp->mt = mt;
+	mt->tid = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+	for (i = 0; i < n_threads; ++i)
+		pthread_create(&mt->tid[i], 0, fp->open_mode == 'w'? mt_deflate_worker : mt_inflate_worker, mt);
+	return 0;
+}
+
+static void mt_destroy(BGZF *fp)
+{
+	mt_aux_t *mt = (mt_aux_t*)fp->mt;
+	int i;
+	if (mt == 0) return;
+	pthread_mutex_lock(&mt->lock);
+	mt->stop = 1;
+	pthread_cond_broadcast(&mt->cv);
+	pthread_mutex_unlock(&mt->lock);
+	for (i = 0; i < mt->n_threads; ++i) pthread_join(mt->tid[i], 0);
+	for (i = 0; i < mt->n_blks; ++i) {
+		free(mt->blks[i].compressed_block);
+		free(mt->blks[i].uncompressed_block);
+	}
+	pthread_mutex_destroy(&mt->lock);
+	pthread_cond_destroy(&mt->cv);
+	free(mt->blks); free(mt->tid); free(mt);
+	fp->mt = 0;
+}
+
+static void mt_lock(BGZF *fp)
+{
+	if (fp->mt) pthread_mutex_lock(&((mt_aux_t*)fp->mt)->lock);
+}
+
+static void mt_unlock(BGZF *fp)
+{
+	if (fp->mt) pthread_mutex_unlock(&((mt_aux_t*)fp->mt)->lock);
+}
+
+static int mt_read_block(BGZF *fp)
+{
+	mt_aux_t *mt = (mt_aux_t*)fp->mt;
+	mt_block_t *p;
+	void *tmp;
+	pthread_mutex_lock(&mt->lock);
+	for (;;) {
+		p = &mt->blks[mt->next_drain % mt->n_blks];
+		if (mt->next_drain < mt->next_fill && p->state == MT_DONE) break;
+		if (mt->next_drain == mt->next_fill && mt->eof) { // nothing left to hand out
+			pthread_mutex_unlock(&mt->lock);
+			fp->block_length = 0;
+			return 0;
+		}
+		pthread_cond_wait(&mt->cv, &mt->lock);
+	}
+	pthread_mutex_unlock(&mt->lock);
+	if (p->size < 0) {
+		report_error(fp, p->error);
+		return -1;
+	}
+	// swap buffers rather than copy; the slot gets ours for its next block
+	tmp = fp->uncompressed_block;
+	fp->uncompressed_block = p->uncompressed_block;
+	p->uncompressed_block = tmp;
+	if (fp->block_length != 0) {
+		// Do not reset offset if this read follows a seek.
+		fp->block_offset = 0;
+	}
+	if (p->block_length) fp->block_address = p->address;
+	fp->block_length = p->size;
+	mt->block_end = p->address + p->block_length;
+	pthread_mutex_lock(&mt->lock);
+	if (p->block_length) { // leave the end-of-file marker in place
+		p->state = MT_EMPTY;
+		++mt->next_drain;
+	}
+	pthread_cond_broadcast(&mt->cv);
+	pthread_mutex_unlock(&mt->lock);
+	return 0;
+}
+
+/* Reposition the read-ahead pipeline at block_address. Blocks already read
+ * ahead from that address on are kept. */
+static int mt_seek(BGZF *fp, int64_t block_address)
+{
+	mt_aux_t *mt = (mt_aux_t*)fp->mt;
+	int64_t i;
+	int ret = 0;
+	pthread_mutex_lock(&mt->lock);
+	while (mt->n_busy > 0) pthread_cond_wait(&mt->cv, &mt->lock);
+	for (i = mt->next_drain; i < mt->next_fill; ++i)
+		if (mt->blks[i % mt->n_blks].address == block_address
+				&& mt->blks[i % mt->n_blks].block_length > 0) break;
+	if (i < mt->next_fill) { // already read ahead; drop the blocks before it
+		for (; mt->next_drain < i; ++mt->next_drain)
+			mt->blks[mt->next_drain % mt->n_blks].state = MT_EMPTY;
+	} else {
+		for (i = mt->next_drain; i < mt->next_fill; ++i)
+			mt->blks[i % mt->n_blks].state = MT_EMPTY;
+		mt->next_drain = mt->next_fill = 0;
+		mt->eof = 0;
+		mt->address = block_address;
+#ifdef _USE_KNETFILE
+		ret = knet_seek(fp->x.fpr, block_address, SEEK_SET);
+#else
+		ret = fseeko(fp->file, block_address, SEEK_SET);
+#endif
+	}
+	mt->block_end = block_address;
+	pthread_cond_broadcast(&mt->cv);
+	pthread_mutex_unlock(&mt->lock);
+	return ret == 0? 0 : -1;
+}
+
+/* Write finished blocks to the file in order, waiting for unfinished ones if
+ * wait is set. Called with the lock held. */
+static int mt_write_blocks(BGZF *fp, int wait)
+{
+	mt_aux_t *mt = (mt_aux_t*)fp->mt;
+	mt_block_t *p;
+	int count;
+	while (mt->next_drain < mt->next_fill) {
+		p = &mt->blks[mt->next_drain % mt->n_blks];
+		if (p->state != MT_DONE) {
+			if (!wait) break;
+			pthread_cond_wait(&mt->cv, &mt->lock);
+			continue;
+		}
+		if (p->size < 0) {
+			report_error(fp, p->error);
+			return -1;
+		}
+		// only the caller drains, so the slot is safe to use unlocked
+		pthread_mutex_unlock(&mt->lock);
+#ifdef _USE_KNETFILE
+		count = fwrite(p->compressed_block, 1, p->size, fp->x.fpw);
+#else
+		count = fwrite(p->compressed_block, 1, p->size, fp->file);
+#endif
+		pthread_mutex_lock(&mt->lock);
+		if (count != p->size) {
+			report_error(fp, "write failed");
+			return -1;
+		}
+		fp->block_address += p->size;
+		p->state = MT_EMPTY;
+		++mt->next_drain;
+		pthread_cond_broadcast(&mt->cv);
+	}
+	return 0;
+}
+
+/* Hand the contents of fp->uncompressed_block to the deflate workers. */
+static int mt_queue_block(BGZF *fp)
+{
+	mt_aux_t *mt = (mt_aux_t*)fp->mt;
+	mt_block_t *p;
+	void *tmp;
+	int ret = 0;
+	pthread_mutex_lock(&mt->lock);
+	while (mt->next_fill - mt->next_drain == mt->n_blks) { // all slots in use
+		if (mt->blks[mt->next_drain % mt->n_blks].state == MT_DONE) {
+			if ((ret = mt_write_blocks(fp, 0)) != 0) break;
+		} else pthread_cond_wait(&mt->cv, &mt->lock);
+	}
+	if (ret == 0) {
+		p = &mt->blks[mt->next_fill++ % mt->n_blks];
+		tmp = p->uncompressed_block;
+		p->uncompressed_block = fp->uncompressed_block;
+		fp->uncompressed_block = tmp;
+		p->block_length = fp->block_offset;
+		p->state = MT_BUSY;
+		fp->block_offset = 0;
+		pthread_cond_broadcast(&mt->cv);
+		ret = mt_write_blocks(fp, 0);
+	}
+	pthread_mutex_unlock(&mt->lock);
+	return ret;
+}
+
+int64_t bgzf_htell(BGZF *fp)
+{
+	if (fp->mt) return ((mt_aux_t*)fp->mt)->block_end;
+#ifdef _USE_KNETFILE
+	return knet_tell(fp->x.fpr);
+#else
+	return ftello(fp->file);
+#endif
+}
+
+int
+bgzf_read_block(BGZF* fp)
+{
+	int count, size;
+	const char* error = NULL;
+	if (fp->mt) return mt_read_block(fp);
+#ifdef _USE_KNETFILE
+    int64_t block_address = knet_tell(fp->x.fpr);
+#else
+    int64_t block_address = ftello(fp->file);
+#endif
+	if (load_block_from_cache(fp, block_address)) return 0;
+	size = read_raw_block(fp, fp->compressed_block, &error);
+    if (size == 0) {
+        fp->block_length = 0;
+        return 0;
+    }
+    if (size < 0) {
+        report_error(fp, error);
+        return -1;
+    }
+    count = inflate_block(fp, size);
     if (count < 0) return -1;
     if (fp->block_length != 0) {
         // Do not reset offset if this read follows a seek.
@@ -553,11 +1080,7 @@ bgzf_read(BGZF* fp, void* data, int length)
         bytes_read += copy_length;
     }
     if (fp->block_offset == fp->block_length) {
-#ifdef _USE_KNETFILE
-        fp->block_address = knet_tell(fp->x.fpr);
-#else
-        fp->block_address = ftello(fp->file);
-#endif
+        fp->block_address = bgzf_htell(fp);
         fp->block_offset = 0;
         fp->block_length = 0;
     }
@@ -566,6 +1089,16 @@ bgzf_read(BGZF* fp, void* data, int length)
 
 int bgzf_flush(BGZF* fp)
 {
+    if (fp->mt) {
+        int ret = 0;
+        if (fp->block_offset > 0) ret = mt_queue_block(fp);
+        if (ret == 0) {
+            mt_lock(fp);
+            ret = mt_write_blocks(fp, 1);
+            mt_unlock(fp);
+        }
+        return ret;
+    }
     while (fp->block_offset > 0) {
         int count, block_length;
 		block_length = deflate_block(fp, fp->block_offset);
@@ -584,10 +1117,18 @@ int bgzf_flush(BGZF* fp)
     return 0;
 }
 
+/* Compress the current block, without waiting for queued blocks to be
+ * written when multi-threaded. */
+static int flush_block(BGZF *fp)
+{
+	if (fp->mt) return mt_queue_block(fp);
+	return bgzf_flush(fp);
+}
+
 int bgzf_flush_try(BGZF *fp, int size)
 {
 	if (fp->block_offset + size > fp->uncompressed_block_size)
-		return bgzf_flush(fp);
+		return flush_block(fp);
 	return -1;
 }
 
@@ -614,7 +1155,7 @@ int bgzf_write(BGZF* fp, const void* data, int length)
         input += copy_length;
         bytes_written += copy_length;
         if (fp->block_offset == block_length) {
-            if (bgzf_flush(fp) != 0) {
+            if (flush_block(fp) != 0) {
                 break;
             }
         }
@@ -624,8 +1165,20 @@ int bgzf_write(BGZF* fp, const void* data, int length)
 
 int bgzf_close(BGZF* fp)
 {
+    int ret = 0;
+    // Stop the workers before anything else: read-ahead workers may be
+    // reading from the file. Blocks already queued for writing go out first;
+    // the last partial block is then flushed on this thread.
+    if (fp->mt) {
+        if (fp->open_mode == 'w') {
+            mt_lock(fp);
+            ret = mt_write_blocks(fp, 1);
+            mt_unlock(fp);
+        }
+        mt_destroy(fp);
+    }
     if (fp->open_mode == 'w') {
-        if (bgzf_flush(fp) != 0) return -1;
+        if (ret != 0 || bgzf_flush(fp) != 0) return -1;
 		{ // add an empty block
 			int count, block_length = deflate_block(fp, 0);
 #ifdef _USE_KNETFILE
@@ -655,14 +1208,17 @@ int bgzf_close(BGZF* fp)
     }
     free(fp->uncompressed_block);
     free(fp->compressed_block);
-	free_cache(fp);
     free(fp);
     return 0;
 }
 
 void bgzf_set_cache_size(BGZF *fp, int cache_size)
 {
-	if (fp) fp->cache_size = cache_size;
+	if (fp == 0) return;
+	fp->cache_size = cache_size;
+	pthread_mutex_lock(&cache.lock);
+	if (cache_size > 0 && (size_t)cache_size > cache.capacity) cache.capacity = cache_size;
+	pthread_mutex_unlock(&cache.lock);
 }
 
 int bgzf_check_EOF(BGZF *fp)
@@ -671,16 +1227,27 @@ int bgzf_check_EOF(BGZF *fp)
 	uint8_t buf[28];
 	off_t offset;
 #ifdef _USE_KNETFILE
+	int ret = 0;
+	mt_lock(fp);
 	offset = knet_tell(fp->x.fpr);
-	if (knet_seek(fp->x.fpr, -28, SEEK_END) != 0) return -1;
-	knet_read(fp->x.fpr, buf, 28);
-	knet_seek(fp->x.fpr, offset, SEEK_SET);
+	if (knet_seek(fp->x.fpr, -28, SEEK_END) != 0) ret = -1;
+	else {
+		knet_read(fp->x.fpr, buf, 28);
+		knet_seek(fp->x.fpr, offset, SEEK_SET);
+	}
+	mt_unlock(fp);
 #else
+	int ret = 0;
+	mt_lock(fp);
 	offset = ftello(fp->file);
-	if (fseeko(fp->file, -28, SEEK_END) != 0) return -1;
-	fread(buf, 1, 28, fp->file);
-	fseeko(fp->file, offset, SEEK_SET);
+	if (fseeko(fp->file, -28, SEEK_END) != 0) ret = -1;
+	else {
+		fread(buf, 1, 28, fp->file);
+		fseeko(fp->file, offset, SEEK_SET);
+	}
+	mt_unlock(fp);
 #endif
+	if (ret != 0) return ret;
 	return (memcmp(magic, buf, 28) == 0)? 1 : 0;
 }
 
@@ -699,6 +1266,16 @@ int64_t bgzf_seek(BGZF* fp, int64_t pos, int where)
     }
     block_offset = pos & 0xFFFF;
     block_address = (pos >> 16) & 0xFFFFFFFFFFFFLL;
+    if (fp->mt) {
+        if (mt_seek(fp, block_address) != 0) {
+            report_error(fp, "seek failed");
+            return -1;
+        }
+        fp->block_length = 0;
+        fp->block_address = block_address;
+        fp->block_offset = block_offset;
+        return 0;
+    }
 #ifdef _USE_KNETFILE
     if (knet_seek(fp->x.fpr, block_address, SEEK_SET) != 0) {
 #else
@@ -177,3 +177,9 @@ char *samfaipath(const char *fn_ref)
 	}
 	return fn_list;
 }
+
+int samthreads(samfile_t *fp, int n_threads, int n_sub_blks)
+{
+	if (fp == 0 || !(fp->type & TYPE_BAM)) return -1;
+	return bgzf_mt(fp->x.bam, n_threads, n_sub_blks);
+}
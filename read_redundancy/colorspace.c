@@ -0,0 +1,135 @@
+
+#include "colorspace.h"
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+
+static const char base[4] = { 'A', 'C', 'G', 'T' };
+
+
+static inline int base_code( char c )
+{
+    switch( c ) {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default:            return -1;
+    }
+}
+
+
+
+#ifdef __SSE2__
+
+/* Sixteen 2-bit codes to bases. */
+static inline __m128i to_bases( __m128i x )
+{
+#ifdef __SSSE3__
+    return _mm_shuffle_epi8( _mm_setr_epi8( 'A', 'C', 'G', 'T', 0, 0, 0, 0,
+                                            0, 0, 0, 0, 0, 0, 0, 0 ), x );
+#else
+    /* without a byte shuffle, a table of four is three compares:
+     * C = A + 2, G = C + 4, T = G + 13 */
+    __m128i y = _mm_set1_epi8( 'A' );
+    y = _mm_add_epi8( y, _mm_and_si128( _mm_cmpgt_epi8( x, _mm_set1_epi8(0) ), _mm_set1_epi8(2) ) );
+    y = _mm_add_epi8( y, _mm_and_si128( _mm_cmpgt_epi8( x, _mm_set1_epi8(1) ), _mm_set1_epi8(4) ) );
+    y = _mm_add_epi8( y, _mm_and_si128( _mm_cmpeq_epi8( x, _mm_set1_epi8(3) ), _mm_set1_epi8(13) ) );
+    return y;
+#endif
+}
+
+
+/* Sixteen colors to 2-bit codes, with all bits set in ok where they are
+ * 0-3. */
+static inline __m128i to_codes( const char* cs, __m128i* ok )
+{
+    __m128i x = _mm_sub_epi8( _mm_loadu_si128( (const __m128i*) cs ), _mm_set1_epi8('0') );
+    *ok = _mm_cmpeq_epi8( _mm_and_si128( x, _mm_set1_epi8(0xfc) ), _mm_setzero_si128() );
+    return x;
+}
+
+#endif
+
+
+
+size_t cs_decode( const char* cs, size_t n, char* out )
+{
+    size_t i = 1;
+    int b, c;
+
+    if( n == 0 ) {
+        out[0] = '\0';
+        return 0;
+    }
+
+    b = base_code( cs[0] );
+    out[0] = cs[0];
+    if( b < 0 ) goto unknown;
+
+#ifdef __SSE2__
+    __m128i x, ok;
+
+    for( ; i + 16 <= n; i += 16 ) {
+        x = to_codes( cs + i, &ok );
+        if( _mm_movemask_epi8( ok ) != 0xffff ) break;
+
+        /* prefix xor in four steps, then xor in the base before */
+        x = _mm_xor_si128( x, _mm_slli_si128( x, 1 ) );
+        x = _mm_xor_si128( x, _mm_slli_si128( x, 2 ) );
+        x = _mm_xor_si128( x, _mm_slli_si128( x, 4 ) );
+        x = _mm_xor_si128( x, _mm_slli_si128( x, 8 ) );
+        x = _mm_xor_si128( x, _mm_set1_epi8( b ) );
+
+        b = _mm_extract_epi16( x, 7 ) >> 8;
+        _mm_storeu_si128( (__m128i*) (out + i), to_bases( x ) );
+    }
+#endif
+
+    for( ; i < n; i++ ) {
+        c = cs[i] - '0';
+        if( c < 0 || c > 3 ) break;
+        b ^= c;
+        out[i] = base[b];
+    }
+
+unknown:
+    for( ; i < n; i++ ) out[i] = 'N';
+    out[n] = '\0';
+
+    return n;
+}
+
+
+
+size_t cs_double_encode( const char* cs, size_t n, char* out )
+{
+    size_t i = 0;
+    int c;
+
+#ifdef __SSE2__
+    __m128i x, y, ok;
+
+    for( ; i + 16 <= n; i += 16 ) {
+        x = to_codes( cs + i, &ok );
+        y = _mm_or_si128( _mm_and_si128( ok, to_bases( _mm_and_si128( x, _mm_set1_epi8(3) ) ) ),
+                          _mm_andnot_si128( ok, _mm_set1_epi8('N') ) );
+        _mm_storeu_si128( (__m128i*) (out + i), y );
+    }
+#endif
+
+    for( ; i < n; i++ ) {
+        c = cs[i] - '0';
+        out[i] = c < 0 || c > 3 ? 'N' : base[c];
+    }
+    out[n] = '\0';
+
+    return n;
+}
+
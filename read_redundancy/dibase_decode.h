@@ -1,10 +0,0 @@
-
-#ifndef DIBASE_DECODE
-#define DIBASE_DECODE
-
-
-void dibase_decode( char* seq_in, char* seq_out );
-
-#endif
-
-
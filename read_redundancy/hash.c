@@ -1,5 +1,6 @@
 
 
+#include <string.h>
 #include "hash.h"
 #include "superfasthash.h"
 
@@ -9,36 +10,6 @@
 #define MIN_LOAD 0.05 /* make sure this is less than MAX_LOAD/2 */
 
 
-/* Test string equality. (Slightly faster than memcmp, since we don't care about
- * ordering. Note: n is in nibbles! */
-bool memeq( const void* x, const void* y, size_t n )
-{
-    uint8_t* a = (uint8_t*)x;
-    uint8_t* b = (uint8_t*)y;
-
-    if( a == b ) return true;
-
-    while( n >= 2*sizeof(uint32_t) ) {
-        if( *((uint32_t*)a) != *((uint32_t*)b) ) return false;
-        a += sizeof(uint32_t);
-        b += sizeof(uint32_t);
-        n -= 2*sizeof(uint32_t);
-    }
-
-    while( n ) {
-        if( (*a & 0xf) != (*b & 0xf) )   return false;
-        if( --n == 0 ) break;
-        if( (*a & 0xf0) != (*b & 0xf0) ) return false;
-
-        a++;
-        b++;
-        n--;
-    }
-
-    return true;
-}
-
-
 void rehash( struct table* T, size_t new_n );
 
 
@@ -66,7 +37,6 @@ void table_clear( struct table* T )
     for( i = 0; i < T->n; i++ ) {
         while( T->A[i] ){
             u = T->A[i]->next;
-            free(T->A[i]->seq);
             free(T->A[i]);
             T->A[i] = u;
         }
@@ -87,14 +57,19 @@ void table_destroy( struct table* T )
 
 void table_inc( struct table* T, char* seq )
 {
-    if( T->m == T->max_m ) rehash( T, T->n*2 );
+    size_t len = strlen(seq);
+    table_inc_hashed( T, seq, len, hash(seq, len) );
+}
 
-    uint32_t h = hash(seq, T->read_bytes) % T->n;
 
-    struct hashed_value* u = T->A[h];
+void table_inc_hashed( struct table* T, const char* seq, size_t len, uint32_t h )
+{
+    if( T->m == T->max_m ) rehash( T, T->n*2 );
+
+    struct hashed_value* u = T->A[h % T->n];
 
     while(u) {
-        if( memeq( u->seq, seq, T->read_bytes ) ) {
+        if( u->h == h && strcmp( u->seq, seq ) == 0 ) {
             u->count++;
             return;
         }
@@ -102,24 +77,27 @@ void table_inc( struct table* T, char* seq )
         u = u->next;
     }
 
-    u = malloc(sizeof(struct hashed_value));
-    u->seq = strdup(seq);
+    /* the sequence is kept in the same allocation, just past the node */
+    u = malloc(sizeof(struct hashed_value) + len + 1);
+    u->seq = (char*)(u + 1);
+    memcpy( u->seq, seq, len + 1 );
 
     u->count = 1;
+    u->h = h;
 
-    u->next = T->A[h];
-    T->A[h] = u;
+    u->next = T->A[h % T->n];
+    T->A[h % T->n] = u;
 
     T->m++;
 }
 
 uint64_t table_get( struct table* T, char* seq )
 {
-    uint32_t h = hash(seq, T->read_bytes) % T->n;
+    uint32_t h = hash(seq, strlen(seq));
 
-    struct hashed_value* u = T->A[h];
+    struct hashed_value* u = T->A[h % T->n];
     while(u) {
-        if( memeq( u->seq, seq, T->read_bytes ) ) {
+        if( u->h == h && strcmp( u->seq, seq ) == 0 ) {
             return u->count;
         }
 
@@ -131,36 +109,11 @@ uint64_t table_get( struct table* T, char* seq )
 
 
 
-/* Insert existing entries without copying sequences. Used for rehashing. */
-bool table_insert_without_copy( struct table* T, struct hashed_value* V )
-{
-    if( T->m == T->max_m ) rehash( T, T->n*2 );
-
-    uint32_t h = hash(V->seq,T->read_bytes) % T->n;
-
-    V->next = T->A[h];
-    T->A[h] = V;
-
-    T->m++;
-
-    return true;
-}
-
-
-/* Rezise the table T to new_n. */
+/* Rezise the table T to new_n, relinking the nodes by their kept hash. */
 void rehash( struct table* T, size_t new_n )
 {
-    fprintf( stderr, "\t(rehashing)\n" );
-    struct table U;
-    U.n = new_n;
-    U.m = 0;
-    U.max_m = U.n*MAX_LOAD;
-    U.min_m = U.n*MIN_LOAD;
-    U.A = malloc( sizeof(struct hashed_value*) * U.n );
-    U.read_len   = T->read_len;
-    U.read_bytes = T->read_bytes;
-    memset( U.A, 0, sizeof(struct hashed_value*) * U.n );
-
+    struct hashed_value** A = malloc( sizeof(struct hashed_value*) * new_n );
+    memset( A, 0, sizeof(struct hashed_value*) * new_n );
 
     struct hashed_value *j,*k;
     size_t i;
@@ -168,15 +121,15 @@ void rehash( struct table* T, size_t new_n )
         j = T->A[i];
         while( j ) {
             k = j->next;
-            table_insert_without_copy( &U, j );
+            j->next = A[j->h % new_n];
+            A[j->h % new_n] = j;
             j = k;
         }
-        T->A[i] = NULL;
     }
 
     free(T->A);
-    T->A = U.A;
-    T->n = U.n;
+    T->A = A;
+    T->n = new_n;
     T->max_m = T->n*MAX_LOAD;
     T->min_m = T->n*MIN_LOAD;
 }
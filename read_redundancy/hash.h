@@ -7,12 +7,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <samtools/sam.h>
+#include "samtools/sam.h"
 
 struct hashed_value
 {
     char*    seq;
     uint32_t count;
+    uint32_t h;      /* hash of seq, kept for rehashing */
 
     struct hashed_value* next;
 };
@@ -37,6 +38,10 @@ void table_destroy( struct table* T );
 void     table_inc( struct table*, char* seq );
 uint64_t table_get( struct table*, char* seq );
 
+/* As table_inc, for a sequence already hashed with hash() over its len
+ * characters. */
+void     table_inc_hashed( struct table*, const char* seq, size_t len, uint32_t h );
+
 void sort_by_count( struct table* T,
                     struct hashed_value*** S );
 
@@ -2,26 +2,41 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <zlib.h>
-#include <samtools/sam.h>
+#include <pthread.h>
+#include "samtools/sam.h"
 #include "hash.h"
-#include "dibase_decode.h"
+#include "superfasthash.h"
+#include "colorspace.h"
+#include "fastq_reader.h"
+#include "sketch.h"
 
 const size_t MAX_LINE_WIDTH=4096;
 bool ignore_N = true;
 bool decode_colorspace = false;
+int  n_threads = 1;
+int  n_jobs = 1;
+size_t sketch_mem = 0;
+size_t sketch_top = 100;
 
 typedef union {
-    gzFile     rawf;
-    samfile_t* samf;
+    gzFile          rawf;
+    samfile_t*      samf;
+    fastq_reader_t* fq;
 } READ_FILE;
 
 
-typedef size_t (*readget)( READ_FILE* f, char* read );
+/* Each returns the length of the read, which may be 0, or -1 at the end of
+ * the input. An empty read, or one with an N under -n, is left as "". */
+typedef ssize_t (*readget)( READ_FILE* f, char* read );
 
-size_t csfasta_getread( READ_FILE* f, char* read );
-size_t fastq_getread  ( READ_FILE* f, char* read );
-size_t sam_getread    ( READ_FILE* f, char* read );
+ssize_t csfasta_getread( READ_FILE* f, char* read );
+ssize_t fastq_getread  ( READ_FILE* f, char* read );
+ssize_t sam_getread    ( READ_FILE* f, char* read );
 
 
 struct table* hash_reads( READ_FILE* f, readget getread, size_t* num_ignored )
@@ -29,11 +44,12 @@ struct table* hash_reads( READ_FILE* f, readget getread, size_t* num_ignored )
     fprintf( stderr, "hashing reads ...\n" );
 
     char* read = malloc(MAX_LINE_WIDTH*sizeof(char*));
-    size_t n, m;
+    size_t n;
+    ssize_t m;
     *num_ignored = 0;
 
     /* get one read to guess the read length */
-    if( (m = getread( f, read )) == 0 ) return NULL;
+    if( (m = getread( f, read )) < 0 ) return NULL;
 
     /* create table */
     struct table* T = malloc(sizeof(struct table));
@@ -51,7 +67,7 @@ struct table* hash_reads( READ_FILE* f, readget getread, size_t* num_ignored )
         table_inc( T, read );
         if( n % 100000 == 0 ) fprintf( stderr, "\t%zu reads (%zu unique, %zu ignored).\n",
                                        n, T->m, *num_ignored );
-    } while( getread( f, read ) );
+    } while( getread( f, read ) >= 0 );
 
 
     free(read);
@@ -63,6 +79,376 @@ struct table* hash_reads( READ_FILE* f, readget getread, size_t* num_ignored )
 }
 
 
+/* With -j N, reading and hashing are pipelined: this thread reads, hashes
+ * each read and sorts it into batches by hash, one per shard, and N worker
+ * threads each own a shard table, taking batches from their own queue, so
+ * that no table is ever shared. */
+
+#define BATCH_BYTES (256*1024)
+#define QUEUE_LEN   4
+
+typedef struct batch_
+{
+    char*     data;    /* reads, one after the other, each ending in '\0' */
+    size_t    len;
+    uint32_t* h;       /* their hashes and lengths */
+    uint32_t* l;
+    size_t    n, size;
+    struct batch_* next;
+} batch_t;
+
+
+typedef struct
+{
+    struct table T;
+
+    batch_t* head;     /* queue of batches waiting to be counted */
+    batch_t* tail;
+    size_t   queued;
+    bool     done;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_t       thread;
+} shard_t;
+
+
+/* counted batches, for the reader to fill again */
+static batch_t*        free_batches = NULL;
+static pthread_mutex_t free_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static batch_t* get_batch()
+{
+    pthread_mutex_lock( &free_lock );
+    batch_t* b = free_batches;
+    if( b ) free_batches = b->next;
+    pthread_mutex_unlock( &free_lock );
+
+    if( b == NULL ) {
+        b = malloc( sizeof(batch_t) );
+        b->data = malloc( BATCH_BYTES + MAX_LINE_WIDTH );
+        b->size = BATCH_BYTES / 16;
+        b->h = malloc( b->size * sizeof(uint32_t) );
+        b->l = malloc( b->size * sizeof(uint32_t) );
+    }
+
+    b->len = b->n = 0;
+    b->next = NULL;
+    return b;
+}
+
+
+static void put_batch( batch_t* b )
+{
+    pthread_mutex_lock( &free_lock );
+    b->next = free_batches;
+    free_batches = b;
+    pthread_mutex_unlock( &free_lock );
+}
+
+
+static void free_batches_all()
+{
+    batch_t* b;
+    while( (b = free_batches) ) {
+        free_batches = b->next;
+        free(b->data);
+        free(b->h);
+        free(b->l);
+        free(b);
+    }
+}
+
+
+static void push_batch( shard_t* S, batch_t* b )
+{
+    pthread_mutex_lock( &S->lock );
+    while( S->queued == QUEUE_LEN ) pthread_cond_wait( &S->cond, &S->lock );
+
+    if( S->tail ) S->tail->next = b;
+    else          S->head = b;
+    S->tail = b;
+    S->queued++;
+
+    pthread_cond_signal( &S->cond );
+    pthread_mutex_unlock( &S->lock );
+}
+
+
+static void* shard_worker( void* arg )
+{
+    shard_t* S = arg;
+    batch_t* b;
+    char* seq;
+    size_t i;
+
+    while( true ) {
+        pthread_mutex_lock( &S->lock );
+        while( S->queued == 0 && !S->done ) pthread_cond_wait( &S->cond, &S->lock );
+        if( S->queued == 0 ) {
+            pthread_mutex_unlock( &S->lock );
+            break;
+        }
+
+        b = S->head;
+        S->head = b->next;
+        if( S->head == NULL ) S->tail = NULL;
+        S->queued--;
+
+        pthread_cond_signal( &S->cond );
+        pthread_mutex_unlock( &S->lock );
+
+        for( i = 0, seq = b->data; i < b->n; seq += b->l[i] + 1, i++ ) {
+            table_inc_hashed( &S->T, seq, b->l[i], b->h[i] );
+        }
+
+        put_batch( b );
+    }
+
+    return NULL;
+}
+
+
+struct table** hash_reads_sharded( READ_FILE* f, readget getread, size_t* num_ignored,
+                                   int n_shards )
+{
+    fprintf( stderr, "hashing reads on %d threads ...\n", n_shards );
+
+    char* read = malloc(MAX_LINE_WIDTH*sizeof(char*));
+    size_t n, len;
+    ssize_t m;
+    uint32_t h;
+    int s;
+    *num_ignored = 0;
+
+    /* get one read to guess the read length */
+    if( (m = getread( f, read )) < 0 ) return NULL;
+
+    shard_t*  S   = malloc( n_shards * sizeof(shard_t) );
+    batch_t** cur = malloc( n_shards * sizeof(batch_t*) );
+
+    for( s = 0; s < n_shards; s++ ) {
+        table_create( &S[s].T, m );
+        S[s].head = S[s].tail = NULL;
+        S[s].queued = 0;
+        S[s].done = false;
+        pthread_mutex_init( &S[s].lock, NULL );
+        pthread_cond_init( &S[s].cond, NULL );
+        pthread_create( &S[s].thread, NULL, shard_worker, &S[s] );
+        cur[s] = get_batch();
+    }
+
+    n = 0;
+
+    do {
+        if( read[0] == '\0' ) {
+            (*num_ignored)++;
+            continue;
+        }
+        n++;
+
+        /* the top bits of the hash pick the shard, the low bits the slot */
+        len = strlen(read);
+        h = hash( read, len );
+        s = ((uint64_t)h * n_shards) >> 32;
+
+        batch_t* b = cur[s];
+        memcpy( b->data + b->len, read, len + 1 );
+        b->len += len + 1;
+        b->h[b->n] = h;
+        b->l[b->n] = len;
+        b->n++;
+
+        if( b->len >= BATCH_BYTES || b->n == b->size ) {
+            push_batch( &S[s], b );
+            cur[s] = get_batch();
+        }
+
+        if( n % 100000 == 0 ) fprintf( stderr, "\t%zu reads (%zu ignored).\n",
+                                       n, *num_ignored );
+    } while( getread( f, read ) >= 0 );
+
+    struct table** T = malloc( n_shards * sizeof(struct table*) );
+    size_t unique = 0;
+
+    for( s = 0; s < n_shards; s++ ) {
+        if( cur[s]->n > 0 ) push_batch( &S[s], cur[s] );
+        else                put_batch( cur[s] );
+
+        pthread_mutex_lock( &S[s].lock );
+        S[s].done = true;
+        pthread_cond_signal( &S[s].cond );
+        pthread_mutex_unlock( &S[s].lock );
+    }
+
+    for( s = 0; s < n_shards; s++ ) {
+        pthread_join( S[s].thread, NULL );
+        pthread_mutex_destroy( &S[s].lock );
+        pthread_cond_destroy( &S[s].cond );
+
+        T[s] = malloc(sizeof(struct table));
+        *T[s] = S[s].T;
+        unique += T[s]->m;
+    }
+
+    free_batches_all();
+    free(cur);
+    free(S);
+    free(read);
+
+    fprintf( stderr, "done. (%zu reads hashed, %zu are unique, %zu were ignored)\n",
+                      n, unique, *num_ignored );
+
+    return T;
+}
+
+
+
+typedef struct
+{
+    struct table*         T;
+    struct hashed_value** S;
+    pthread_t             thread;
+} sort_job_t;
+
+
+static void* sort_worker( void* arg )
+{
+    sort_job_t* J = arg;
+    sort_by_count( J->T, &J->S );
+    return NULL;
+}
+
+
+/* Print the reads of every table, by decreasing count: each table is
+ * sorted on its own thread, and the sorted runs merged. */
+void print_by_count( struct table** T, int n_tables )
+{
+    sort_job_t* J = malloc( n_tables * sizeof(sort_job_t) );
+    size_t* next = malloc( n_tables * sizeof(size_t) );
+    int t, best;
+
+    fprintf( stderr, "sorting ... " );
+    for( t = 0; t < n_tables; t++ ) {
+        J[t].T = T[t];
+        if( n_tables > 1 ) pthread_create( &J[t].thread, NULL, sort_worker, &J[t] );
+        else               sort_worker( &J[t] );
+    }
+    for( t = 0; n_tables > 1 && t < n_tables; t++ ) {
+        pthread_join( J[t].thread, NULL );
+    }
+    fprintf( stderr, "done.\n" );
+
+    fprintf( stderr, "printing ... " );
+    memset( next, 0, n_tables * sizeof(size_t) );
+    while( true ) {
+        best = -1;
+        for( t = 0; t < n_tables; t++ ) {
+            if( next[t] == T[t]->m ) continue;
+            if( best < 0 || J[t].S[next[t]]->count > J[best].S[next[best]]->count ) best = t;
+        }
+        if( best < 0 ) break;
+
+        fprintf( stdout, "%s\t%d\n", J[best].S[next[best]]->seq, J[best].S[next[best]]->count );
+        next[best]++;
+    }
+
+    for( t = 0; t < n_tables; t++ ) free(J[t].S);
+    free(next);
+    free(J);
+}
+
+
+
+/* Hash on one thread, or sharded over several. */
+struct table** hash_reads_any( READ_FILE* f, readget getread, size_t* num_ignored,
+                               int n_tables )
+{
+    if( n_tables > 1 ) return hash_reads_sharded( f, getread, num_ignored, n_tables );
+
+    struct table** T = malloc( sizeof(struct table*) );
+    if( (T[0] = hash_reads( f, getread, num_ignored )) == NULL ) {
+        free(T);
+        return NULL;
+    }
+    return T;
+}
+
+
+/* With --sketch, nothing is kept per read: counts come from a sketch of
+ * fixed size, good for files with too many distinct reads to hash. */
+void sketch_reads( READ_FILE* f, readget getread, struct sketch* S, size_t* num_ignored )
+{
+    fprintf( stderr, "sketching reads ...\n" );
+
+    char* read = malloc(MAX_LINE_WIDTH*sizeof(char*));
+    *num_ignored = 0;
+
+    sketch_create( S, sketch_mem, sketch_top );
+
+    while( getread( f, read ) >= 0 ) {
+        if( read[0] == '\0' ) {
+            (*num_ignored)++;
+            continue;
+        }
+        sketch_add( S, read, strlen(read) );
+        if( S->n % 1000000 == 0 ) fprintf( stderr, "\t%zu reads (%zu ignored).\n",
+                                           (size_t)S->n, *num_ignored );
+    }
+
+    free(read);
+
+    fprintf( stderr, "done. (%zu reads sketched, %zu were ignored)\n",
+                      (size_t)S->n, *num_ignored );
+}
+
+
+/* The heaviest reads, then the estimates, each with its error bound. */
+void print_sketch( struct sketch* S )
+{
+    double distinct, distinct_err, prob;
+    uint64_t count_err;
+    size_t i;
+
+    sketch_sort( S );
+    for( i = 0; i < S->n_heap; i++ ) {
+        fprintf( stdout, "%s\t%llu\n", S->heap[i].seq, (unsigned long long)S->heap[i].count );
+    }
+
+    distinct  = sketch_distinct( S, &distinct_err );
+    count_err = sketch_count_error( S, &prob );
+
+    if( distinct > S->n ) distinct = S->n;
+
+    fprintf( stdout, "reads\t%llu\n", (unsigned long long)S->n );
+    fprintf( stdout, "distinct\t%.0f\t%.0f\n", distinct, distinct_err );
+    fprintf( stdout, "duplication\t%.4f\t%.4f\n",
+             S->n ? 1.0 - distinct / S->n : 0.0,
+             S->n ? distinct_err / S->n : 0.0 );
+    fprintf( stdout, "count_error\t%llu\t%.3f\n", (unsigned long long)count_err, prob );
+}
+
+
+size_t parse_size( const char* arg )
+{
+    char* end;
+    size_t size = strtoull( arg, &end, 10 );
+    switch( *end ) {
+        case 'k': case 'K': size <<= 10; break;
+        case 'm': case 'M': size <<= 20; break;
+        case 'g': case 'G': size <<= 30; break;
+    }
+
+    if( size < 1 << 20 ) {
+        fprintf( stderr, "--sketch needs at least a megabyte, not '%s'.\n", arg );
+        exit(1);
+    }
+
+    return size;
+}
+
+
 void usage()
 {
     fprintf( stderr,
@@ -70,7 +456,21 @@ void usage()
              "-C, -Q, -S, -B        input is csfasta, fastq, sam, or bam, respectively.\n"
              "                      exactly one must be specified!\n" 
              "-n                    count reads containing 'N' or '.' characters\n"
-             "-d                    decode colorspace reads\n\n"
+             "-d                    decode colorspace reads\n"
+             "-@ N                  use N threads to decompress BAM input, or with\n"
+             "                      N > 1, a thread of its own for FASTQ\n"
+             "-j N                  hash reads on N threads, each counting its own\n"
+             "                      share of the reads, while another reads them\n"
+             "--sketch[=SIZE]       estimate counts in SIZE bytes (default 64M) instead\n"
+             "                      of hashing every read: prints the most frequent\n"
+             "                      reads, then the number of reads, the distinct reads\n"
+             "                      and the duplication rate, each with the half-width\n"
+             "                      of its 95%% interval, and by how much any count\n"
+             "                      may be over, with the probability it holds;\n"
+             "                      SIZE holds the counts and the most frequent\n"
+             "                      reads, the distinct reads always take 64K\n"
+             "--top=N               with --sketch, print the N most frequent reads\n"
+             "                      (default 100)\n\n"
              );
 }
 
@@ -97,9 +497,14 @@ int main( int argc, char* argv[] )
 
     int c;
 
-    const char* optstring = "CQSBnd";
+    static struct option long_options[] = {
+        {"sketch", optional_argument, 0, 's'},
+        {"top",    required_argument, 0, 't'},
+        {0, 0, 0, 0} };
+
+    const char* optstring = "CQSBnd@:j:";
     do {
-        c = getopt( argc, argv, optstring );
+        c = getopt_long( argc, argv, optstring, long_options, NULL );
         switch( c ) {
             case 'C': C_opt = 1; break;
             case 'Q': Q_opt = 1; break;
@@ -107,6 +512,11 @@ int main( int argc, char* argv[] )
             case 'B': B_opt = 1; break;
             case 'n': ignore_N = false; break;
             case 'd': decode_colorspace = true; break;
+            case '@': n_threads = atoi(optarg); break;
+            case 'j': n_jobs = atoi(optarg); break;
+            case 's': sketch_mem = optarg ? parse_size(optarg) : 64 << 20; break;
+            case 't': sketch_top = atoi(optarg); break;
+            case '?': usage(); exit(1);
         }
     } while( c != -1 );
 
@@ -124,27 +534,40 @@ int main( int argc, char* argv[] )
 
     const char* fn = argv[optind];
     READ_FILE f;
-    struct table* T = NULL;
+    readget getread;
+    struct table** T = NULL;
+    struct sketch S;
+    int n_tables = n_jobs > 1 ? n_jobs : 1;
+    int i;
 
     if( C_opt ) {
         if( (f.rawf = gzopen( fn, "r" )) == NULL ) file_not_found( fn );
-        T = hash_reads( &f, csfasta_getread, &num_ignored );
-        gzclose( f.rawf );
+        getread = csfasta_getread;
     }
     else if( Q_opt ) {
-        if( (f.rawf = gzopen( argv[optind], "r" )) == NULL ) file_not_found( fn );
-        T = hash_reads( &f, fastq_getread, &num_ignored );
-        gzclose( f.rawf );
+        int fd = open( fn, O_RDONLY );
+        if( fd < 0 ) file_not_found( fn );
+        f.fq = fastq_reader_open( fd, n_threads > 1 );
+        getread = fastq_getread;
     }
-    else if( S_opt ) {
-        if( (f.samf = samopen( argv[optind], "r", NULL )) == NULL ) file_not_found( fn );
-        T = hash_reads( &f, sam_getread, &num_ignored );
-        samclose(f.samf);
+    else {
+        if( (f.samf = samopen( fn, B_opt ? "rb" : "r", NULL )) == NULL ) file_not_found( fn );
+        if( B_opt ) samthreads( f.samf, n_threads, 0 );
+        getread = sam_getread;
     }
-    else if( B_opt ) {
-        if( (f.samf = samopen( argv[optind], "rb", NULL )) == NULL ) file_not_found( fn );
-        T = hash_reads( &f, sam_getread, &num_ignored );
-        samclose(f.samf);
+
+    if( sketch_mem ) sketch_reads( &f, getread, &S, &num_ignored );
+    else             T = hash_reads_any( &f, getread, &num_ignored, n_tables );
+
+    if( C_opt )      gzclose( f.rawf );
+    else if( Q_opt ) fastq_reader_close( f.fq );
+    else             samclose( f.samf );
+
+    if( sketch_mem ) {
+        print_sketch( &S );
+        fprintf( stdout, "ignored\t%zu\n", num_ignored );
+        sketch_destroy( &S );
+        return 0;
     }
 
     if( T == NULL ) {
@@ -153,24 +576,17 @@ int main( int argc, char* argv[] )
     }
 
 
-    struct hashed_value** S;
-
-    fprintf( stderr, "sorting ... " );
-    sort_by_count( T, &S );
-    fprintf( stderr, "done.\n" );
-
-    fprintf( stderr, "printing ... " );
-    size_t i;
-    for( i = 0; i < T->m; i++ ) {
-        fprintf( stdout, "%s\t%d\n", S[i]->seq, S[i]->count );
-    }
+    print_by_count( T, n_tables );
     fprintf( stdout, "ignored\t%zu\n", num_ignored );
 
     fprintf( stderr, "done.\n" );
 
     fprintf( stderr, "dismantling table ... " );
-    free(S);
-    table_destroy( T );
+    for( i = 0; i < n_tables; i++ ) {
+        table_destroy( T[i] );
+        free( T[i] );
+    }
+    free(T);
     fprintf( stderr, "done.\n" );
     return 0;
 }
@@ -190,13 +606,13 @@ bool strchrlen( const char* s, char c, size_t* len )
 }
 
 
-size_t csfasta_getread( READ_FILE* f, char* read )
+ssize_t csfasta_getread( READ_FILE* f, char* read )
 {
     /* get read name */
-    if( !gzgets( f->rawf, read, MAX_LINE_WIDTH ) ) return 0;
+    if( !gzgets( f->rawf, read, MAX_LINE_WIDTH ) ) return -1;
 
     /* get read sequence */
-    if( !gzgets( f->rawf, read, MAX_LINE_WIDTH ) ) return 0;
+    if( !gzgets( f->rawf, read, MAX_LINE_WIDTH ) ) return -1;
 
     size_t n = 0;
     bool N_found = strchrlen( read, '.', &n );
@@ -204,7 +620,7 @@ size_t csfasta_getread( READ_FILE* f, char* read )
     if( N_found ) read[0] = '\0';
     read[ n-1 ] = '\0'; /* trim newline */
 
-    if( decode_colorspace ) dibase_decode( read, read );
+    if( decode_colorspace && read[0] ) cs_decode( read, n-1, read );
 
     return n-1;
 };
@@ -212,16 +628,46 @@ size_t csfasta_getread( READ_FILE* f, char* read )
 
 
 
-size_t fastq_getread  ( READ_FILE* f, char* read )
+ssize_t fastq_getread  ( READ_FILE* f, char* read )
 {
-    not_implemented( __func__ );
-    return 0;
+    fastq_record_t rec;
+    if( !fastq_reader_next( f->fq, &rec ) ) return -1;
+
+    /* longer reads are cut short, as from SAM */
+    size_t n = rec.seq.n;
+    if( n >= MAX_LINE_WIDTH ) n = MAX_LINE_WIDTH - 1;
+    memcpy( read, rec.seq.s, n );
+    read[n] = '\0';
+
+    if( ignore_N && memchr( read, 'N', n ) ) read[0] = '\0';
+
+    return n;
 };
 
-size_t sam_getread    ( READ_FILE* f, char* read )
+ssize_t sam_getread    ( READ_FILE* f, char* read )
 {
-    not_implemented( __func__ );
-    return 0;
+    static bam1_t* b = NULL;
+    if( b == NULL ) b = bam_init1();
+
+    if( samread( f->samf, b ) < 0 ) {
+        bam_destroy1(b);
+        b = NULL;
+        return -1;
+    }
+
+    size_t i, n = b->core.l_qseq;
+    if( n >= MAX_LINE_WIDTH ) n = MAX_LINE_WIDTH - 1;
+
+    bool N_found = false;
+    for( i = 0; i < n; i++ ) {
+        read[i] = bam_nt16_rev_table[bam1_seqi( bam1_seq(b), i )];
+        if( read[i] == 'N' ) N_found = true;
+    }
+    read[n] = '\0';
+
+    if( N_found && ignore_N ) read[0] = '\0';
+
+    return n;
 };
 
 
@@ -0,0 +1,528 @@
+/* The MIT License
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/*
+  Whole-block inflate for BGZF, and the backend switch used by bgzf.c.
+
+  The block decoder follows the structure of Mark Adler's puff.c, but keeps
+  up to 64 bits of input in a register, refilled with one unaligned load,
+  and decodes Huffman codes through a lookup table, falling back to puff's
+  canonical decode for codes longer than the table. Since the whole output
+  block is in memory there is no sliding window, and matches are copied a
+  word at a time when they do not overlap themselves.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "bgzf_inflate.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BGZF_HAVE_PCLMUL
+#include <immintrin.h>
+#endif
+
+#define BLOCK_HEADER_LENGTH 18
+#define BLOCK_FOOTER_LENGTH 8
+
+static inline uint32_t unpack32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * zlib backend
+ */
+
+static int zlib_usable(void) { return 1; }
+
+static int zlib_inflate(const uint8_t *src, int src_len, uint8_t *dst, int dst_size)
+{
+	z_stream zs;
+	int status;
+	memset(&zs, 0, sizeof(z_stream));
+	zs.next_in = (Bytef*)src;
+	zs.avail_in = src_len;
+	zs.next_out = dst;
+	zs.avail_out = dst_size;
+	if (inflateInit2(&zs, -15) != Z_OK) return -1;
+	status = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+	return status == Z_STREAM_END? (int)zs.total_out : -1;
+}
+
+static uint32_t zlib_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	return crc32(crc, buf, len);
+}
+
+/*
+ * Whole-block decoder
+ */
+
+#define MAX_CODE_BITS 15
+#define LITLEN_TABLE_BITS 10
+#define DIST_TABLE_BITS 8
+#define CODELEN_TABLE_BITS 7
+
+/* A table entry: bits 0-3 code length (0 if the code is longer than the
+ * table), bits 4-5 kind, bits 8-11 extra bits, bits 16-31 literal or base. */
+enum { K_LITERAL, K_MATCH, K_END, K_INVALID };
+#define ENTRY(kind, extra, value) ((uint32_t)(value) << 16 | (extra) << 8 | (kind) << 4)
+#define E_LEN(e) ((e) & 15)
+#define E_KIND(e) ((e) >> 4 & 3)
+#define E_EXTRA(e) ((e) >> 8 & 15)
+#define E_VALUE(e) ((e) >> 16)
+
+typedef struct {
+	int bits;
+	const uint32_t *entry; // symbol -> entry, without the code length
+	uint16_t count[MAX_CODE_BITS + 1];
+	uint16_t symbol[288];
+	uint32_t table[1 << LITLEN_TABLE_BITS];
+} huff_t;
+
+static uint32_t litlen_entry[288], dist_entry[32], codelen_entry[19];
+static huff_t fixed_litlen, fixed_dist;
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static const uint8_t codelen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Build the decoding table for a canonical code with code lengths lens[0..n).
+ * Returns -1 if the code is over-subscribed, or incomplete other than having
+ * no codes or a single one-bit code, which zlib also accepts. Unused codes
+ * decode as errors. */
+static int huff_build(huff_t *h, const uint8_t *lens, int n, int bits, const uint32_t *entry)
+{
+	uint16_t offs[MAX_CODE_BITS + 2], next[MAX_CODE_BITS + 1];
+	int len, sym, left, i;
+	h->bits = bits;
+	h->entry = entry;
+	memset(h->count, 0, sizeof(h->count));
+	for (sym = 0; sym < n; ++sym) ++h->count[lens[sym]];
+	h->count[0] = 0;
+	for (len = 1, left = 1; len <= MAX_CODE_BITS; ++len) {
+		left = (left << 1) - h->count[len];
+		if (left < 0) return -1;
+	}
+	if (left > 0 && left != 1 << MAX_CODE_BITS && !(h->count[1] == 1 && left == 1 << (MAX_CODE_BITS - 1)))
+		return -1;
+	offs[1] = next[0] = 0;
+	for (len = 1; len <= MAX_CODE_BITS; ++len) {
+		offs[len + 1] = offs[len] + h->count[len];
+		next[len] = (next[len - 1] + h->count[len - 1]) << 1;
+	}
+	memset(h->table, 0, sizeof(uint32_t) << bits);
+	for (sym = 0; sym < n; ++sym) {
+		uint32_t code, rev = 0;
+		if ((len = lens[sym]) == 0) continue;
+		h->symbol[offs[len]++] = sym;
+		code = next[len]++;
+		if (len > bits) continue;
+		for (i = 0; i < len; ++i) rev |= (code >> i & 1) << (len - 1 - i);
+		for (i = rev; i < 1 << bits; i += 1 << len)
+			h->table[i] = entry[sym] | len;
+	}
+	return 0;
+}
+
+/* Decode a code longer than the table one bit at a time, as puff does.
+ * Returns the entry, or 0 if the bits are not a code. */
+static uint32_t huff_slow(const huff_t *h, uint64_t bitbuf)
+{
+	int len, code = 0, first = 0, index = 0, count;
+	for (len = 1; len <= MAX_CODE_BITS; ++len) {
+		code |= bitbuf & 1;
+		bitbuf >>= 1;
+		count = h->count[len];
+		if (code - count < first)
+			return h->entry[h->symbol[index + (code - first)]] | len;
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return 0;
+}
+
+static void init_tables(void)
+{
+	static const uint16_t len_base[29] = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const uint8_t len_extra[29] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const uint16_t dist_base[30] = {
+		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+		8193, 12289, 16385, 24577 };
+	static const uint8_t dist_extra[30] = {
+		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	uint8_t lens[288];
+	int i;
+	for (i = 0; i < 256; ++i) litlen_entry[i] = ENTRY(K_LITERAL, 0, i);
+	litlen_entry[256] = ENTRY(K_END, 0, 0);
+	for (i = 0; i < 29; ++i) litlen_entry[257 + i] = ENTRY(K_MATCH, len_extra[i], len_base[i]);
+	litlen_entry[286] = litlen_entry[287] = ENTRY(K_INVALID, 0, 0);
+	for (i = 0; i < 30; ++i) dist_entry[i] = ENTRY(K_MATCH, dist_extra[i], dist_base[i]);
+	dist_entry[30] = dist_entry[31] = ENTRY(K_INVALID, 0, 0);
+	for (i = 0; i < 19; ++i) codelen_entry[i] = ENTRY(K_LITERAL, 0, i);
+
+	for (i = 0; i < 144; ++i) lens[i] = 8;
+	for (; i < 256; ++i) lens[i] = 9;
+	for (; i < 280; ++i) lens[i] = 7;
+	for (; i < 288; ++i) lens[i] = 8;
+	huff_build(&fixed_litlen, lens, 288, LITLEN_TABLE_BITS, litlen_entry);
+	for (i = 0; i < 32; ++i) lens[i] = 5;
+	huff_build(&fixed_dist, lens, 32, DIST_TABLE_BITS, dist_entry);
+}
+
+static inline uint64_t load64le(const uint8_t *p)
+{
+	uint64_t x;
+	memcpy(&x, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	x = __builtin_bswap64(x);
+#endif
+	return x;
+}
+
+/* The bit buffer holds bitcnt valid bits; bits above them, if any, are the
+ * bits that follow in the input, so a refill may OR them in again. Past the
+ * end of the input zero bytes are fed in and counted in pad. After REFILL
+ * there are at least 57 bits, enough for a length code, its extra bits, a
+ * distance code and its extra bits. */
+#define REFILL() do { \
+		if (bitcnt > 56) break; \
+		if (in_end - in >= 8) { \
+			bitbuf |= load64le(in) << bitcnt; \
+			in += (63 - bitcnt) >> 3; \
+			bitcnt |= 56; \
+		} else { \
+			while (bitcnt <= 56) { \
+				if (in < in_end) bitbuf |= (uint64_t)*in++ << bitcnt; \
+				else if (++pad > 8) return -1; \
+				bitcnt += 8; \
+			} \
+		} \
+	} while (0)
+#define BITS(n) ((uint32_t)(bitbuf & ((1ULL << (n)) - 1)))
+#define DROP(n) do { bitbuf >>= (n); bitcnt -= (n); } while (0)
+#define DECODE(h, e) do { \
+		(e) = (h)->table[bitbuf & ((1U << (h)->bits) - 1)]; \
+		if (E_LEN(e) == 0 && ((e) = huff_slow((h), bitbuf)) == 0) return -1; \
+		DROP(E_LEN(e)); \
+	} while (0)
+
+static int block_inflate(const uint8_t *src, int src_len, uint8_t *dst, int dst_size)
+{
+	const uint8_t *in = src, *in_end = src + src_len;
+	uint8_t *out = dst, *out_end = dst + dst_size;
+	uint64_t bitbuf = 0;
+	int bitcnt = 0, pad = 0, last;
+	huff_t litlen, dist;
+	const huff_t *hl, *hd;
+
+	pthread_once(&tables_once, init_tables);
+	do {
+		int type;
+		REFILL();
+		last = BITS(1);
+		type = bitbuf >> 1 & 3;
+		DROP(3);
+		if (type == 0) { // stored: realign to the byte after the header
+			int n;
+			DROP(bitcnt & 7);
+			if ((bitcnt >> 3) < pad) return -1;
+			in -= (bitcnt >> 3) - pad;
+			bitbuf = 0; bitcnt = pad = 0;
+			if (in_end - in < 4) return -1;
+			n = in[0] | in[1] << 8;
+			if ((n ^ (in[2] | in[3] << 8)) != 0xffff) return -1;
+			in += 4;
+			if (n > in_end - in || n > out_end - out) return -1;
+			memcpy(out, in, n);
+			in += n; out += n;
+			continue;
+		} else if (type == 1) {
+			hl = &fixed_litlen; hd = &fixed_dist;
+		} else if (type == 2) {
+			uint8_t lens[288 + 32];
+			huff_t codelen;
+			int nlen, ndist, ncode, i;
+			nlen = BITS(5) + 257; DROP(5);
+			ndist = BITS(5) + 1; DROP(5);
+			ncode = BITS(4) + 4; DROP(4);
+			if (nlen > 286 || ndist > 30) return -1;
+			memset(lens, 0, 19);
+			for (i = 0; i < ncode; ++i) {
+				REFILL();
+				lens[codelen_order[i]] = BITS(3); DROP(3);
+			}
+			if (huff_build(&codelen, lens, 19, CODELEN_TABLE_BITS, codelen_entry) < 0) return -1;
+			for (i = 0; i < nlen + ndist;) {
+				uint32_t e;
+				int sym, len = 0, rep;
+				REFILL();
+				DECODE(&codelen, e);
+				sym = E_VALUE(e);
+				if (sym < 16) { lens[i++] = sym; continue; }
+				if (sym == 16) {
+					if (i == 0) return -1;
+					len = lens[i - 1];
+					rep = 3 + BITS(2); DROP(2);
+				} else if (sym == 17) {
+					rep = 3 + BITS(3); DROP(3);
+				} else {
+					rep = 11 + BITS(7); DROP(7);
+				}
+				if (i + rep > nlen + ndist) return -1;
+				while (rep--) lens[i++] = len;
+			}
+			if (lens[256] == 0) return -1; // no end-of-block code
+			if (huff_build(&litlen, lens, nlen, LITLEN_TABLE_BITS, litlen_entry) < 0) return -1;
+			if (huff_build(&dist, lens + nlen, ndist, DIST_TABLE_BITS, dist_entry) < 0) return -1;
+			hl = &litlen; hd = &dist;
+		} else return -1;
+
+		for (;;) {
+			uint32_t e;
+			int length, distance;
+			const uint8_t *from;
+			REFILL();
+			DECODE(hl, e);
+			if (E_KIND(e) == K_LITERAL) {
+				if (out == out_end) return -1;
+				*out++ = E_VALUE(e);
+				continue;
+			}
+			if (E_KIND(e) == K_END) break;
+			if (E_KIND(e) == K_INVALID) return -1;
+			length = E_VALUE(e) + BITS(E_EXTRA(e)); DROP(E_EXTRA(e));
+			DECODE(hd, e);
+			if (E_KIND(e) == K_INVALID) return -1;
+			distance = E_VALUE(e) + BITS(E_EXTRA(e)); DROP(E_EXTRA(e));
+			if (distance > out - dst || length > out_end - out) return -1;
+			from = out - distance;
+			if (distance >= 16 && out_end - out >= length + 16) {
+				uint8_t *end = out + length;
+				do { memcpy(out, from, 16); out += 16; from += 16; } while (out < end);
+				out = end;
+			} else if (distance >= 8 && out_end - out >= length + 8) {
+				uint8_t *end = out + length;
+				do { memcpy(out, from, 8); out += 8; from += 8; } while (out < end);
+				out = end;
+			} else if (distance == 1) {
+				memset(out, *from, length);
+				out += length;
+			} else {
+				while (length--) *out++ = *from++;
+			}
+		}
+	} while (!last);
+	if (bitcnt < pad * 8) return -1; // used bits past the end of the input
+	return out - dst;
+}
+
+static int block_usable(void) { return 1; }
+
+/*
+ * CRC-32 by carry-less multiplication, folding 64 bytes at a time, with the
+ * constants from Intel's "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction" for the bit-reflected gzip polynomial.
+ */
+
+#ifdef BGZF_HAVE_PCLMUL
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold(const uint8_t *buf, size_t len, uint32_t crc)
+{
+	// len is at least 64 and a multiple of 16
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	buf += 64; len -= 64;
+
+	for (; len >= 64; buf += 64, len -= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(buf + 0x30)));
+	}
+
+	// fold the four lanes into one
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	for (; len >= 16; buf += 16, len -= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)buf)), x5);
+	}
+
+	// 128 bits to 64
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return _mm_extract_epi32(x1, 1);
+}
+
+static int pclmul_usable(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+static uint32_t pclmul_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	if (len >= 64) {
+		size_t n = len & ~(size_t)15;
+		crc = ~crc32_fold(buf, n, ~crc);
+		buf += n; len -= n;
+	}
+	return len? crc32(crc, buf, len) : crc;
+}
+#else
+static int pclmul_usable(void) { return 0; }
+#define pclmul_crc32 zlib_crc32
+#endif
+
+/*
+ * Backend selection
+ */
+
+static const bgzf_inflater_t inflaters[] = {
+	{ "block-pclmul", pclmul_usable, block_inflate, pclmul_crc32 },
+	{ "block", block_usable, block_inflate, zlib_crc32 },
+	{ "zlib", zlib_usable, zlib_inflate, zlib_crc32 },
+	{ 0, 0, 0, 0 }
+};
+
+static const bgzf_inflater_t *active;
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+
+static const bgzf_inflater_t *find_inflater(const char *name)
+{
+	const bgzf_inflater_t *p;
+	for (p = inflaters; p->name; ++p)
+		if ((name == 0 || strcmp(p->name, name) == 0) && p->usable()) return p;
+	return 0;
+}
+
+static void probe(void)
+{
+	const char *name = getenv("BGZF_INFLATER");
+	if (name && *name && (active = find_inflater(name)) == 0)
+		fprintf(stderr, "[bgzf_inflate] BGZF_INFLATER=%s is unknown or not supported here; ignored.\n", name);
+	if (active == 0) active = find_inflater(0);
+}
+
+const bgzf_inflater_t *bgzf_get_inflater(void)
+{
+	pthread_once(&probe_once, probe);
+	return active;
+}
+
+const bgzf_inflater_t *bgzf_inflaters(void)
+{
+	return inflaters;
+}
+
+int bgzf_set_inflater(const char *name)
+{
+	const bgzf_inflater_t *p;
+	pthread_once(&probe_once, probe);
+	if ((p = find_inflater(name)) == 0) return -1;
+	active = p;
+	return 0;
+}
+
+uint32_t bgzf_crc32(uint32_t crc, const void *buf, size_t len)
+{
+	return bgzf_get_inflater()->crc32(crc, (const uint8_t*)buf, len);
+}
+
+int bgzf_inflate_block(const uint8_t *block, int block_length,
+                       uint8_t *dst, int dst_size, const char **error)
+{
+	const bgzf_inflater_t *b = bgzf_get_inflater();
+	const uint8_t *footer;
+	int size;
+	if (block_length < BLOCK_HEADER_LENGTH + BLOCK_FOOTER_LENGTH) {
+		*error = "invalid block length";
+		return -1;
+	}
+	footer = block + block_length - BLOCK_FOOTER_LENGTH;
+	size = b->inflate(block + BLOCK_HEADER_LENGTH, block_length - BLOCK_HEADER_LENGTH - BLOCK_FOOTER_LENGTH,
+			dst, dst_size);
+	if (size < 0) {
+		*error = "inflate failed";
+		return -1;
+	}
+	if ((uint32_t)size != unpack32(footer + 4)) {
+		*error = "inflated size does not match block footer";
+		return -1;
+	}
+	if (b->crc32(0, dst, size) != unpack32(footer)) {
+		*error = "CRC32 checksum mismatch";
+		return -1;
+	}
+	return size;
+}
@@ -0,0 +1,278 @@
+
+#include "sketch.h"
+#include <string.h>
+#include <math.h>
+
+
+#define HLL_BITS  16
+#define CMS_DEPTH 4
+
+
+static inline uint64_t fmix64( uint64_t k )
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+
+/* 64 bits are needed for HyperLogLog over billions of reads, beyond what
+ * the 32-bit table hash gives. Eight bytes at a time, then mixed. */
+static uint64_t hash64( const char* seq, size_t len )
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len, w;
+
+    while( len >= 8 ) {
+        memcpy( &w, seq, 8 );
+        h = fmix64( h ^ w );
+        seq += 8;
+        len -= 8;
+    }
+
+    w = 0;
+    memcpy( &w, seq, len );
+    return fmix64( h ^ w ^ 0x5bd1e995 );
+}
+
+
+void sketch_create( struct sketch* S, size_t mem, size_t top )
+{
+    S->p   = HLL_BITS;
+    S->hll = malloc( (size_t)1 << S->p );
+    memset( S->hll, 0, (size_t)1 << S->p );
+
+    /* the heap's sequences are not counted, being few */
+    S->max_heap = top;
+    S->pos_size = 16;
+    while( S->pos_size < 2 * top ) S->pos_size *= 2;
+
+    size_t fixed = ((size_t)1 << S->p)
+                 + top * sizeof(struct heavy_hitter)
+                 + S->pos_size * sizeof(uint32_t);
+
+    S->depth = CMS_DEPTH;
+    S->width = mem > fixed ? (mem - fixed) / (S->depth * sizeof(uint32_t)) : 0;
+    if( S->width < 1024 ) S->width = 1024;
+    S->cms = malloc( S->depth * S->width * sizeof(uint32_t) );
+    memset( S->cms, 0, S->depth * S->width * sizeof(uint32_t) );
+
+    S->heap   = malloc( top * sizeof(struct heavy_hitter) );
+    S->n_heap = 0;
+    S->pos    = malloc( S->pos_size * sizeof(uint32_t) );
+    memset( S->pos, 0, S->pos_size * sizeof(uint32_t) );
+
+    S->n = 0;
+}
+
+
+void sketch_destroy( struct sketch* S )
+{
+    size_t i;
+    for( i = 0; i < S->n_heap; i++ ) free( S->heap[i].seq );
+
+    free( S->hll );
+    free( S->cms );
+    free( S->heap );
+    free( S->pos );
+}
+
+
+
+/* Where the entry with hash h is, or would go, in pos. */
+static size_t pos_slot( const struct sketch* S, uint64_t h, const char* seq )
+{
+    size_t i = h & (S->pos_size - 1);
+    const struct heavy_hitter* e;
+
+    while( S->pos[i] ) {
+        e = &S->heap[S->pos[i] - 1];
+        if( e->h == h && strcmp( e->seq, seq ) == 0 ) break;
+        i = (i + 1) & (S->pos_size - 1);
+    }
+
+    return i;
+}
+
+
+/* Remove slot i from pos, shifting back any entries that probed past it. */
+static void pos_remove( struct sketch* S, size_t i )
+{
+    size_t j = i, k;
+    S->pos[i] = 0;
+
+    while( true ) {
+        j = (j + 1) & (S->pos_size - 1);
+        if( S->pos[j] == 0 ) break;
+
+        k = S->heap[S->pos[j] - 1].h & (S->pos_size - 1);
+
+        /* j's entry can move to i if its home is not within (i, j] */
+        if( (i <= j) ? (i < k && k <= j) : (i < k || k <= j) ) continue;
+
+        S->pos[i] = S->pos[j];
+        S->pos[j] = 0;
+        i = j;
+    }
+}
+
+
+static void heap_swap( struct sketch* S, size_t a, size_t b )
+{
+    size_t sa = pos_slot( S, S->heap[a].h, S->heap[a].seq );
+    size_t sb = pos_slot( S, S->heap[b].h, S->heap[b].seq );
+
+    struct heavy_hitter t = S->heap[a];
+    S->heap[a] = S->heap[b];
+    S->heap[b] = t;
+
+    S->pos[sa] = b + 1;
+    S->pos[sb] = a + 1;
+}
+
+
+static void sift_down( struct sketch* S, size_t i )
+{
+    size_t j;
+    while( (j = 2 * i + 1) < S->n_heap ) {
+        if( j + 1 < S->n_heap && S->heap[j + 1].count < S->heap[j].count ) j++;
+        if( S->heap[i].count <= S->heap[j].count ) break;
+        heap_swap( S, i, j );
+        i = j;
+    }
+}
+
+
+static void sift_up( struct sketch* S, size_t i )
+{
+    while( i > 0 && S->heap[i].count < S->heap[(i - 1) / 2].count ) {
+        heap_swap( S, i, (i - 1) / 2 );
+        i = (i - 1) / 2;
+    }
+}
+
+
+/* Keep the read among the heavy hitters if it now counts among them. */
+static void heap_offer( struct sketch* S, const char* seq, size_t len,
+                        uint64_t h, uint64_t count )
+{
+    size_t i = pos_slot( S, h, seq );
+
+    if( S->pos[i] ) {
+        S->heap[S->pos[i] - 1].count = count;
+        sift_down( S, S->pos[i] - 1 );
+        return;
+    }
+
+    if( S->max_heap == 0 ) return;
+
+    if( S->n_heap == S->max_heap ) {
+        if( count <= S->heap[0].count ) return;
+
+        /* evict the least, putting the last in its place */
+        size_t last = S->n_heap - 1;
+        if( last > 0 ) heap_swap( S, 0, last );
+        pos_remove( S, pos_slot( S, S->heap[last].h, S->heap[last].seq ) );
+        free( S->heap[last].seq );
+        S->n_heap--;
+        sift_down( S, 0 );
+        i = pos_slot( S, h, seq );
+    }
+
+    struct heavy_hitter* e = &S->heap[S->n_heap];
+    e->count = count;
+    e->h     = h;
+    e->seq   = malloc( len + 1 );
+    memcpy( e->seq, seq, len + 1 );
+
+    S->pos[i] = ++S->n_heap;
+    sift_up( S, S->n_heap - 1 );
+}
+
+
+void sketch_add( struct sketch* S, const char* seq, size_t len )
+{
+    uint64_t h = hash64( seq, len );
+    S->n++;
+
+    /* HyperLogLog: the top bits pick a register, which keeps the longest
+     * run of leading zeros seen in the rest */
+    size_t  r   = h >> (64 - S->p);
+    uint8_t rho = __builtin_clzll( (h << S->p) | (1ULL << (S->p - 1)) ) + 1;
+    if( rho > S->hll[r] ) S->hll[r] = rho;
+
+    /* count-min, with conservative update: only the smallest counters,
+     * the ones that bound the count, are raised */
+    uint64_t g  = fmix64( h ^ 0x2545f4914f6cdd1dULL );
+    uint32_t h1 = g, h2 = (g >> 32) | 1;
+    size_t   idx[CMS_DEPTH];
+    uint32_t min = UINT32_MAX;
+    int d;
+
+    for( d = 0; d < S->depth; d++ ) {
+        idx[d] = d * S->width + (h1 + (uint32_t)d * h2) % S->width;
+        if( S->cms[idx[d]] < min ) min = S->cms[idx[d]];
+    }
+
+    if( min < UINT32_MAX ) min++;
+    for( d = 0; d < S->depth; d++ ) {
+        if( S->cms[idx[d]] < min ) S->cms[idx[d]] = min;
+    }
+
+    heap_offer( S, seq, len, h, min );
+}
+
+
+double sketch_distinct( const struct sketch* S, double* err )
+{
+    size_t m = (size_t)1 << S->p, i, zeros = 0;
+    double sum = 0.0, e, t;
+
+    for( i = 0; i < m; i++ ) {
+        sum += ldexp( 1.0, -S->hll[i] );
+        if( S->hll[i] == 0 ) zeros++;
+    }
+
+    e = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+
+    /* the raw estimate runs high up to about 5m (as HyperLogLog++ found),
+     * where linear counting, with its own variance, is still sound so long
+     * as some registers are empty */
+    if( e <= 5.0 * m && zeros > 0 ) {
+        t = log( (double)m / zeros );
+        *err = 2.0 * sqrt( m * (exp( t ) - t - 1.0) );
+        return m * t;
+    }
+
+    *err = 2.0 * 1.04 / sqrt( (double)m ) * e;
+    return e;
+}
+
+
+uint64_t sketch_count_error( const struct sketch* S, double* prob )
+{
+    /* with probability 1 - e^-depth, no count is over by more than
+     * e/width of all the reads */
+    *prob = 1.0 - exp( -(double)S->depth );
+    return (uint64_t) ceil( M_E / S->width * S->n );
+}
+
+
+static int comp_heavy_hitter( const void* x, const void* y )
+{
+    const struct heavy_hitter* a = x;
+    const struct heavy_hitter* b = y;
+
+    if( a->count > b->count ) return -1;
+    if( a->count < b->count ) return 1;
+    return strcmp( a->seq, b->seq );
+}
+
+
+void sketch_sort( struct sketch* S )
+{
+    qsort( S->heap, S->n_heap, sizeof(struct heavy_hitter), comp_heavy_hitter );
+}
+
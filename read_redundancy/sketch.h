@@ -0,0 +1,62 @@
+
+#ifndef READ_REDUNDANCY_SKETCH
+#define READ_REDUNDANCY_SKETCH
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+/* Redundancy in fixed memory: a HyperLogLog estimate of the number of
+ * distinct reads, a count-min sketch of how often each was seen, and a
+ * heap of the reads the sketch says are most frequent. */
+
+
+struct heavy_hitter
+{
+    uint64_t count;  /* as the count-min sketch has it */
+    uint64_t h;
+    char*    seq;
+};
+
+
+struct sketch
+{
+    uint8_t*  hll;      /* HyperLogLog registers */
+    int       p;        /* of which there are 2^p */
+
+    uint32_t* cms;      /* count-min sketch, depth rows of width counters */
+    size_t    width;
+    int       depth;
+
+    struct heavy_hitter* heap;  /* min-heap by count */
+    size_t    n_heap, max_heap;
+    uint32_t* pos;      /* heap entries by hash, as index + 1, 0 if empty */
+    size_t    pos_size;
+
+    uint64_t  n;        /* reads added */
+};
+
+
+/* Set up a sketch using about mem bytes, keeping the top reads. The
+ * HyperLogLog registers are fixed in number, and so in accuracy, with the
+ * rest of mem going to the count-min sketch. */
+void sketch_create( struct sketch*, size_t mem, size_t top );
+void sketch_destroy( struct sketch* );
+
+void sketch_add( struct sketch*, const char* seq, size_t len );
+
+/* The estimated number of distinct reads, with the half-width of its 95%
+ * confidence interval in err. */
+double sketch_distinct( const struct sketch*, double* err );
+
+/* Counts are overestimates, by at most the returned amount with the
+ * probability in prob. */
+uint64_t sketch_count_error( const struct sketch*, double* prob );
+
+/* Sort the heap by decreasing count, after which nothing may be added. */
+void sketch_sort( struct sketch* );
+
+
+#endif
+